@@ -11,8 +11,11 @@ app.get('/:command', function (req, res) {
 
 
 if(req.params.command == 'setup'){
-	configured = panel.setup();
-	res.send("1 " + configured);
+	// a abertura da porta serial é feita fora do loop de eventos
+	panel.setup().then(function(status){
+		configured = status;
+		res.send("1 " + configured);
+	});
 	
 }else if(req.params.command == 'run'){
 	if (configured)
@@ -22,10 +25,11 @@ if(req.params.command == 'setup'){
 
 }else if(req.params.command == 'exit'){
 	if(configured){
-		panel.exit('0');
 		configured = false;
+		panel.exit(0).then(function(){ res.send("OK!"); });
+	}else{
+		res.send("OK!");
 	}
-	res.send("OK!");
 
 }else if(req.params.command == 'update'){
 	if(configured){
@@ -35,11 +39,16 @@ if(req.params.command == 'setup'){
 
 }else{
 	if(configured && !isNaN(req.params.command)){
-		console.log(panel.update(req.params.command));
-		var data = panel.getvalues();
-	    console.log(req.params.command);
-		console.log(JSON.parse(data));
-	    res.send(data);
+		// a leitura é feita após o RH confirmar a gravação dos reles, então já reflete a alteração
+		panel.applysample({relays: Number(req.params.command)}).then(function(report){
+			console.log(req.params.command, report.applied, report.sampled, report.ms);
+			if(!report.applied || !report.sampled){
+				res.send("NOK!");
+				return;
+			}
+			console.log(JSON.parse(report.values));
+			res.send(report.values);
+		}, function(){ res.send("NOK!"); });
 	}else{
 	    res.send("NOK!");
 
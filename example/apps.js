@@ -9,46 +9,58 @@ var port =  80;
 
 app.use(express.static(__dirname + '/public'));
 
+// contadores da aquisição e do barramento para o Prometheus
+app.get('/metrics', function (req, res) {
+  res.set('Content-Type', 'text/plain; version=0.0.4');
+  res.send(panel.getmetrics());
+});
+
 server.listen(port, function () {
   console.log('Server listening at port %d', port);
   
 });
 
 
-var configured = false, authenticated = false;
+// uma única inscrição no painel repassa as leituras a todos os clientes autenticados (sala 'readings'),
+// o painel aceita poucas inscrições e cada socket com a sua deixaria de receber as leituras a partir de um certo número
+var subscription = 0, last = "";
+
+function Broadcast(data){
+  // somente leituras que mudaram algum valor são enviadas aos clientes
+  if (data != last){
+	io.to('readings').emit('data received', data);
+	last = data;
+  }
+}
 
 io.on('connection', function (socket) {
   var password  = ""; 
-  var sync = 0, interval=0;
+  var attached = null, authenticated = false;
 
   
-  function SendMessage(socket){
-	  if (sync < 10){
-		var data = panel.getvalues();
-		socket.emit('data received', data);
-        sync = sync+1;
-	  }else{
-		  sync=0;
-    	  clearInterval(interval);
-	  }
-  }
-  
   socket.on('new connection', function(data){
 	  // fazer acesso ao rlms para autenticar
      //password = data.pass;
 	  //console.log('new connection' + data);
 
 	  authenticated = true;
-	  configured = panel.setup();
-	  if(configured){
-		  panel.run();
-	  }else{
-		  panel.exit();
-		  panel.setup();
-  		  panel.run();
+	  // a sessão é compartilhada: somente o primeiro cliente abre a UART e cria a thread
+	  // o attach é resolvido fora do loop de eventos, o detach do disconnect espera por ele
+	  if(!attached){
+		  attached = panel.attach();
 	  }
 	  
-	  SendMessage(socket);
+	  socket.emit('data received', panel.getvalues());
+	  // as leituras chegam assim que a thread as publica, sem polling
+	  if(!subscription){
+		  subscription = panel.subscribe(function(data, seq){ Broadcast(data); });
+	  }
+	  if(subscription){
+		  socket.join('readings');
+	  } else {
+		  console.log('subscribe failed');
+		  socket.emit('readings unavailable');
+	  }
 
   });
   
@@ -56,17 +68,11 @@ io.on('connection', function (socket) {
   socket.on('new message', function (data) {
 	console.log('new message' + data);
 	if(authenticated){
-		  clearInterval(interval);
 		  console.log(data);
-		  var sum = 0; 
-		  for(var x=0; x<7;x++){
-			   sum = sum + (data.sw[x] << x);
-		  }
-			  
-		  panel.update(sum);
-		  SendMessage(socket);
-		  sync = 0;
-		  interval = setInterval(function(){SendMessage(socket) },1000);
+		  // cada chave liga um rele, a gravação é confirmada pelo RH antes da Promise ser resolvida
+		  panel.apply({relays: data.sw.slice(0, 7)}).then(function(report){
+			  if (!report.applied) console.log('relays not applied', report);
+		  });
 	}
 	  
   });
@@ -74,15 +80,12 @@ io.on('connection', function (socket) {
 
   socket.on('disconnect', function () {
 	console.log('disconnected');
-
-    if (configured) {
-		configured = authenticated = false;
-		panel.exit();
-    }else{
-		panel.setup();
-  		panel.run();
-		panel.exit();
-	}
+	// a socket.io remove o socket da sala, a inscrição continua para os demais clientes
+    if (attached) {
+		attached.then(function(clients){ if (clients > 0) panel.detach(); });
+		attached = null;
+    }
+	authenticated = false;
   });
   
   
@@ -0,0 +1,156 @@
+/* Benchmark do armazenamento colunar (src/colstore)
+ *
+ * Uso: colstore [segmento.rec ...]
+ * 	 Codifica e decodifica as amostras dos segmentos gravados por panel.record(). Sem argumentos usa um traço
+ * 	 sintético de 16 multímetros com leitura a cada ~30ms.
+ * 	 Reporta a taxa de compressão em relação ao registro do recorder (tRecord) e a vazão de codificação e
+ * 	 decodificação em amostras/s e MB/s de registros.
+ * */
+
+#include "../src/colstore/colstore.h"
+#include "../src/recorder/recorder.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define nSYNTHETIC 200000
+
+static tSample* samples;
+static uint nSamples;
+
+static double Now(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void Add(const tSample* s) {
+	static uint size;
+	if (nSamples == size) {
+		size = size ? size * 2 : 4096;
+		samples = (tSample*)realloc(samples, size * sizeof(tSample));
+	}
+	samples[nSamples++] = *s;
+}
+
+// Correntes e tensões lentas com ruído de ±2 unidades, jitter de ±2ms no período e um sensor ocasionalmente fora de escala
+static void Synthetic(void) {
+	tSample s;
+	memset(&s, 0, sizeof(s));
+	s.time = 1420070400000000ull;
+	s.stsCom = 5;
+	s.nMultimeters = nMULTIMETER;
+	srand(1);
+
+	uint k, x;
+	for (k=0; k<nSYNTHETIC; k++) {
+		s.seq = k + 1;
+		s.time += 30000 + (rand() % 4001) - 2000;
+		if (k % 5000 == 0) s.relays = rand() & 0xffff;
+		for (x=0; x<nMULTIMETER; x++) {
+			tMultimeter* m = &s.multimeter[x];
+			m->func = x & 1;
+			m->stsCom = 5;
+			m->value = (m->func ? 5000 : 200) * (1 + (int)((s.relays >> x) & 1)) + (rand() % 5) - 2;
+			m->sts = (rand() % 20000 == 0) ? 3 : 1;
+		}
+		Add(&s);
+	}
+}
+
+static void Load(const char* path) {
+	tRecording r;
+	if (recorder_OpenSegment(path, &r) == pdFAIL) {
+		fprintf(stderr, "%s: segmento inválido\n", path);
+		return;
+	}
+
+	uint k, x;
+	for (k=0; k<r.count; k++) {
+		const tRecord* rec = &r.records[k];
+		if (!recorder_Valid(rec)) continue;
+
+		tSample s;
+		s.seq = rec->seq;
+		s.time = rec->time;
+		s.stsCom = rec->stsCom;
+		s.relays = rec->relays;
+		s.douts = rec->douts;
+		s.nMultimeters = rec->nMultimeters;
+		for (x=0; x<nMULTIMETER; x++) {
+			s.multimeter[x].value = rec->channel[x].value;
+			s.multimeter[x].sts = rec->channel[x].sts;
+			s.multimeter[x].func = rec->channel[x].func;
+			s.multimeter[x].stsCom = rec->channel[x].stsCom;
+		}
+		Add(&s);
+	}
+	recorder_CloseSegment(&r);
+}
+
+static int Equal(const tSample* a, const tSample* b) {
+	if (a->seq != b->seq || a->time != b->time || a->stsCom != b->stsCom || a->relays != b->relays ||
+		a->douts != b->douts || a->nMultimeters != b->nMultimeters) return pdFALSE;
+	uint x; for (x=0; x<a->nMultimeters; x++) {
+		const tMultimeter* ma = &a->multimeter[x];
+		const tMultimeter* mb = &b->multimeter[x];
+		if (ma->value != mb->value || ma->sts != mb->sts || ma->func != mb->func || ma->stsCom != mb->stsCom) return pdFALSE;
+	}
+	return pdTRUE;
+}
+
+int main(int argc, char** argv) {
+	static tColEncoder enc;
+	static tSample decoded[COLSTORE_BLOCK];
+	int x;
+
+	for (x=1; x<argc; x++) Load(argv[x]);
+	if (argc <= 1) Synthetic();
+	if (nSamples == 0) return 1;
+
+	// codifica tudo num único buffer para medir a decodificação em seguida
+	u8* out = (u8*)malloc((size_t)(nSamples / COLSTORE_BLOCK + 1) * lenCOLSTORE_BLOCK);
+	uint* lens = (uint*)malloc((nSamples / COLSTORE_BLOCK + 2) * sizeof(uint));
+	uint nBlocks = 0;
+	size_t total = 0;
+	uint k;
+
+	colstore_Reset(&enc);
+	double t0 = Now();
+	for (k=0; k<nSamples; k++) {
+		if (colstore_Push(&enc, &samples[k]) == pdFAIL) {
+			total += lens[nBlocks++] = colstore_Flush(&enc, &out[total]);
+			colstore_Push(&enc, &samples[k]);
+		}
+	}
+	if (enc.count) total += lens[nBlocks++] = colstore_Flush(&enc, &out[total]);
+	double tEnc = Now() - t0;
+
+	uint n = 0, errors = 0;
+	size_t pos = 0;
+	t0 = Now();
+	for (k=0; k<nBlocks; k++) {
+		int count = colstore_Decode(&out[pos], lens[k], decoded, COLSTORE_BLOCK);
+		if (count == pdFAIL) errors++;
+		pos += lens[k];
+		int i; for (i=0; i<count; i++, n++)
+			if (!Equal(&decoded[i], &samples[n])) errors++;
+	}
+	double tDec = Now() - t0;
+
+	double raw = (double)nSamples * sizeof(tRecord);
+	printf("amostras:     %u (%s)\n", nSamples, (argc > 1) ? "segmentos gravados" : "traço sintético");
+	printf("blocos:       %u\n", nBlocks);
+	printf("bruto:        %.0f bytes (%u bytes/amostra)\n", raw, (uint)sizeof(tRecord));
+	printf("comprimido:   %zu bytes (%.1f bytes/amostra)\n", total, (double)total / nSamples);
+	printf("taxa:         %.1fx\n", raw / total);
+	printf("codificação:  %.2f Mamostras/s, %.0f MB/s\n", nSamples / tEnc / 1e6, raw / tEnc / 1e6);
+	printf("decodificação:%.2f Mamostras/s, %.0f MB/s\n", nSamples / tDec / 1e6, raw / tDec / 1e6);
+	printf("erros:        %u\n", errors);
+
+	free(out);
+	free(lens);
+	free(samples);
+	return errors ? 1 : 0;
+}
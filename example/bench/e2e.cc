@@ -0,0 +1,328 @@
+/* Benchmark da aquisição completa contra um RH simulado
+ *
+ * Uso: e2e [-c canais] [-b baudrates] [-s segundos]
+ * 	 canais e baudrates são listas separadas por vírgula, ex: e2e -c 1,9,16 -b 9600,115200 -s 10
+ * 	 Cada combinação é medida numa sessão nova durante segundos.
+ * 	 O resultado vai para o stdout em JSON e uma tabela para o stderr.
+ *
+ * Cria um par pty: o lado escravo é aberto pela sessão como uma porta serial comum, com o mestre modbus e a thread
+ * modbus_Process do addon sem alterações. No lado mestre uma thread executa o modbus_slave com o mapa de registradores
+ * do RH: 0x000 modelo e firmware, 0x200 saídas digitais, 0x300 reles e 0x400 quatro registradores por multímetro.
+ * O pty entrega os bytes sem atraso, então o RH simulado espera o tempo que o comando e a resposta ocupariam na
+ * linha na velocidade emulada, a 10 bits por byte, antes de responder. O silêncio de 10ms que o modbus_slave espera
+ * para processar o comando é o mesmo do RH real.
+ *
+ * Mede as amostras publicadas por segundo, as transações por segundo, os percentis da latência das leituras dos
+ * multímetros (função 3) do stats_Read, a ocupação do barramento e o uso de CPU da aquisição e do RH simulado.
+ * */
+
+#include "../src/_config_cpu_.h"
+#include "../src/app.h"
+#include "../src/modbus/modbus_slave.h"
+#include "../src/timer/timer.h"
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <time.h>
+#include <unistd.h>
+
+#define RH_ID 1
+#define MAX_CONFIGS 16
+#define FIRST_SAMPLE_TIMEOUT 3000	// ms para a primeira amostra, senão a sessão não está comunicando com o RH simulado
+
+// RH simulado, o modbus_slave tem um único escravo por processo
+typedef struct {
+	int fd;					// Lado mestre do pty
+	uint bps;				// Velocidade emulada
+	u8 rx[256];				// Bytes do comando recebidos e ainda não processados pelo modbus_slave
+	int rxLen, rxPos;
+	int stop;
+	u16 douts, relays;
+	uint reads;				// Leituras dos multímetros respondidas, muda os valores a cada leitura
+	pthread_t thread;
+} tDevice;
+
+typedef struct {
+	uint channels, bps;
+	double seconds;
+	double samples;			// Amostras publicadas por segundo
+	double transactions;	// Respostas validadas por segundo
+	uint p50, p90, p99, max; // Latência em us das leituras dos multímetros
+	uint errors;			// Comandos sem resposta válida
+	double utilization;
+	double cpuAcquisition;	// Fração de uma CPU usada pelo processo menos o RH simulado
+	double cpuDevice;		// Fração de uma CPU usada pelo RH simulado
+} tResult;
+
+static tDevice device;
+
+static double Now(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static double Cpu(clockid_t clock) {
+	struct timespec ts;
+	clock_gettime(clock, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// Lê uma lista de inteiros separados por vírgula
+static uint ParseList(const char* s, uint* out) {
+	uint n = 0;
+	while (*s && n < MAX_CONFIGS) {
+		char* end;
+		out[n++] = (uint)strtoul(s, &end, 10);
+		if (*end != ',') break;
+		s = end + 1;
+	}
+	return n;
+}
+
+// #####################################################################################################################
+// RH SIMULADO
+// #####################################################################################################################
+
+// Valor do registrador addr do RH
+// Retorna pdFAIL se o registrador não existe
+static int Register(uint addr, u16* value) {
+	static const char model[] = "RH01";
+	static const char firmware[] = "12";
+
+	if (addr <= 1) *value = (u16)(model[2*addr] | (model[2*addr + 1] << 8));
+	else if (addr == 2) *value = (u16)(firmware[0] | (firmware[1] << 8));
+	else if (addr == 0x200) *value = device.douts;
+	else if (addr == 0x300) *value = device.relays;
+	else if (addr >= 0x400 && addr < 0x400 + 4*nMULTIMETER) {
+		uint ch = (addr - 0x400) / 4;
+		int mv = ((ch & 1) ? 12000 : 1500) + (int)(ch * 10) + (int)(device.reads % 100);
+		switch ((addr - 0x400) % 4) {
+		case 0: *value = 5; break;							// stsCom: comunicação estabelecida
+		case 1: *value = (u16)(((ch & 1) << 4) | 1); break;	// voltímetro nos canais ímpares, valor convertido
+		case 2: *value = (u16)(mv & 0xffff); break;
+		default: *value = (u16)((u32)mv >> 16); break;
+		}
+	} else return pdFAIL;
+	return pdPASS;
+}
+
+static int ReadRegs(uint addrInit, u8* query, uint count) {
+	if (count < 1 || count > 125) return modbusILLEGAL_DATA_VALUE;
+	uint x; for (x=0; x<count; x++) {
+		u16 value;
+		if (Register(addrInit + x, &value) != pdPASS) return modbusILLEGAL_DATA_ADDRESS;
+		query[2*x] = (u8)(value >> 8);
+		query[2*x + 1] = (u8)(value & 0xff);
+	}
+	if (addrInit == 0x400) device.reads++;
+	return modbusNO_ERROR;
+}
+
+static int WriteReg(uint addr, u16 value) {
+	if (addr == 0x200) device.douts = value;
+	else if (addr == 0x300) device.relays = value;
+	else return modbusILLEGAL_DATA_ADDRESS;
+	return modbusNO_ERROR;
+}
+
+// Lê do pty os bytes que chegaram, retorna quantos ainda não foram consumidos pelo modbus_slave
+static int ByteAvailable(void) {
+	if (device.rxLen < (int)sizeof(device.rx)) {
+		int n = read(device.fd, &device.rx[device.rxLen], sizeof(device.rx) - device.rxLen);
+		if (n > 0) device.rxLen += n;
+	}
+	return device.rxLen - device.rxPos;
+}
+
+static int Getc(u8* ch) {
+	if (device.rxPos >= device.rxLen) return pdFAIL;
+	*ch = device.rx[device.rxPos++];
+	return pdPASS;
+}
+
+static void FlushRX(void) {
+	device.rxLen = device.rxPos = 0;
+}
+
+// Responde após o tempo de linha do comando, que ainda está em rx, e da resposta
+static int Puts(u8* buffer, u16 count) {
+	usleep((useconds_t)((u64)(device.rxLen + count) * 10 * 1000000 / device.bps));
+	int sent = 0;
+	while (sent < count) {
+		int n = write(device.fd, buffer + sent, count - sent);
+		if (n > 0) sent += n;
+		else if (n < 0) {
+			struct pollfd p = { device.fd, POLLOUT, 0 };
+			if (poll(&p, 1, 10) < 0 || (p.revents & (POLLHUP | POLLERR))) return pdFAIL;
+		}
+	}
+	return pdPASS;
+}
+
+// Thread do RH simulado: processa os comandos e dorme até chegar um byte ou no máximo 1ms, assim o silêncio de
+// fim de comando é detectado com atraso de até 1ms sem ocupar uma CPU
+static void* DeviceProcess(void* params) {
+	while (!__atomic_load_n(&device.stop, __ATOMIC_ACQUIRE)) {
+		if (modbus_SlaveProcess() == pdPASS) continue;
+		struct pollfd p = { device.fd, POLLIN, 0 };
+		// sem a porta aberta do outro lado o poll retorna POLLHUP imediatamente
+		if (poll(&p, 1, 1) > 0 && (p.revents & POLLHUP)) usleep(1000);
+	}
+	return NULL;
+}
+
+// Cria o pty e inicia o RH simulado
+// Retorna o nome do lado escravo do pty, ou NULL se houve erro
+static const char* DeviceStart(uint bps) {
+	memset(&device, 0, sizeof(device));
+	device.bps = bps;
+	device.fd = posix_openpt(O_RDWR | O_NOCTTY | O_NONBLOCK);
+	if (device.fd < 0) return NULL;
+	const char* name = (grantpt(device.fd) == 0 && unlockpt(device.fd) == 0) ? ptsname(device.fd) : NULL;
+	if (!name) {
+		close(device.fd);
+		return NULL;
+	}
+
+	modbus_SlaveInit(RH_ID, Puts, Getc, ByteAvailable, FlushRX);
+	modbus_SlaveAppendFunctions(now, ReadRegs, WriteReg, NULL);
+	if (pthread_create(&device.thread, NULL, DeviceProcess, NULL)) {
+		close(device.fd);
+		return NULL;
+	}
+	return name;
+}
+
+static void DeviceStop(void) {
+	__atomic_store_n(&device.stop, pdTRUE, __ATOMIC_RELEASE);
+	pthread_join(device.thread, NULL);
+	close(device.fd);
+}
+
+// #####################################################################################################################
+// MEDIÇÃO
+// #####################################################################################################################
+
+static double ProcessCpu(void) {
+	struct rusage ru;
+	getrusage(RUSAGE_SELF, &ru);
+	return ru.ru_utime.tv_sec + ru.ru_stime.tv_sec + (ru.ru_utime.tv_usec + ru.ru_stime.tv_usec) / 1e6;
+}
+
+// Mede uma combinação de canais e velocidade
+// Retorna pdFAIL se a sessão não pôde ser aberta ou não recebeu nenhuma amostra
+static int Run(uint channels, uint bps, uint seconds, tResult* r) {
+	memset(r, 0, sizeof(*r));
+	r->channels = channels;
+	r->bps = bps;
+
+	const char* name = DeviceStart(bps);
+	if (!name) {
+		fprintf(stderr, "não foi possível criar o pty\n");
+		return pdFAIL;
+	}
+	clockid_t deviceClock;
+	pthread_getcpuclockid(device.thread, &deviceClock);
+
+	tPanel* panel = session_New(name, uart_Speed(bps), RH_ID, channels);
+	if (!panel || session_Open(panel) != pdPASS || session_Start(panel) != pdPASS) {
+		fprintf(stderr, "não foi possível iniciar a sessão em %s\n", name);
+		if (panel) session_Free(panel);
+		DeviceStop();
+		return pdFAIL;
+	}
+
+	// aquecimento: a leitura das informações do RH e a primeira amostra ficam fora da medição
+	tTime t = now();
+	while (history_Last(panel->history) < 2 && now() - t < FIRST_SAMPLE_TIMEOUT) usleep(1000);
+	int ret = (history_Last(panel->history) >= 2) ? pdPASS : pdFAIL;
+
+	if (ret == pdPASS) {
+		tStats stats[nSTATS];
+		tBus bus;
+		stats_Read(panel->stats, stats, NULL, pdTRUE);
+		uint seq = history_Last(panel->history);
+		double wall = Now(), cpu = ProcessCpu(), cpuDevice = Cpu(deviceClock);
+
+		usleep(seconds * 1000000);
+
+		int n = stats_Read(panel->stats, stats, &bus, pdFALSE);
+		r->seconds = Now() - wall;
+		r->samples = (history_Last(panel->history) - seq) / r->seconds;
+		r->transactions = bus.rxFrames / r->seconds;
+		r->utilization = stats_Utilization(&bus, bps);
+		r->cpuDevice = (Cpu(deviceClock) - cpuDevice) / r->seconds;
+		r->cpuAcquisition = (ProcessCpu() - cpu) / r->seconds - r->cpuDevice;
+		int x; for (x=0; x<n; x++) {
+			r->errors += stats[x].requests - stats[x].responses;
+			if (stats[x].function != 3) continue;
+			r->p50 = stats[x].p50;
+			r->p90 = stats[x].p90;
+			r->p99 = stats[x].p99;
+			r->max = stats[x].max;
+		}
+	} else fprintf(stderr, "nenhuma amostra em %dms com %u canais a %u bps\n", FIRST_SAMPLE_TIMEOUT, channels, bps);
+
+	session_Stop(panel, pdTRUE, NULL);
+	session_Free(panel);
+	DeviceStop();
+	return ret;
+}
+
+int main(int argc, char** argv) {
+	uint channels[MAX_CONFIGS] = { 1, 9, nMULTIMETER }, nChannels = 3;
+	uint bauds[MAX_CONFIGS] = { 9600, 115200 }, nBauds = 2;
+	uint seconds = 5;
+
+	int opt;
+	while ((opt = getopt(argc, argv, "c:b:s:")) != -1) {
+		if (opt == 'c') nChannels = ParseList(optarg, channels);
+		else if (opt == 'b') nBauds = ParseList(optarg, bauds);
+		else if (opt == 's') seconds = (uint)atoi(optarg);
+		else {
+			fprintf(stderr, "uso: %s [-c canais] [-b baudrates] [-s segundos]\n", argv[0]);
+			return 1;
+		}
+	}
+	uint x, y;
+	for (x=0; x<nChannels; x++) if (channels[x] < 1 || channels[x] > nMULTIMETER) {
+		fprintf(stderr, "canais de 1 até %d\n", nMULTIMETER);
+		return 1;
+	}
+	for (x=0; x<nBauds; x++) if (!uart_Speed(bauds[x])) {
+		fprintf(stderr, "velocidade não suportada: %u\n", bauds[x]);
+		return 1;
+	}
+	if (seconds < 1) seconds = 1;
+
+	// somente as medições na saída
+	log_SetLevel(-1, logOFF);
+
+	printf("{\"suite\":\"e2e\",\"seconds\":%u,\"runs\":[", seconds);
+	fprintf(stderr, "%8s %8s %10s %10s %8s %8s %8s %8s %7s %6s %8s %8s\n", "channels", "baud", "samples/s", "trans/s",
+		"p50 us", "p90 us", "p99 us", "max us", "errors", "bus", "cpu acq", "cpu rh");
+	int first = 1, failed = 0;
+	for (y=0; y<nBauds; y++) for (x=0; x<nChannels; x++) {
+		tResult r;
+		if (Run(channels[x], bauds[y], seconds, &r) != pdPASS) {
+			failed = 1;
+			continue;
+		}
+		printf("%s\n{\"channels\":%u,\"baud\":%u,\"seconds\":%.3f,\"samples_per_s\":%.2f,\"transactions_per_s\":%.2f,"
+			"\"p50_us\":%u,\"p90_us\":%u,\"p99_us\":%u,\"max_us\":%u,\"errors\":%u,\"utilization\":%.4f,"
+			"\"cpu_acquisition\":%.4f,\"cpu_device\":%.4f}",
+			first ? "" : ",", r.channels, r.bps, r.seconds, r.samples, r.transactions,
+			r.p50, r.p90, r.p99, r.max, r.errors, r.utilization, r.cpuAcquisition, r.cpuDevice);
+		fprintf(stderr, "%8u %8u %10.1f %10.1f %8u %8u %8u %8u %7u %5.1f%% %7.1f%% %7.1f%%\n", r.channels, r.bps,
+			r.samples, r.transactions, r.p50, r.p90, r.p99, r.max, r.errors, r.utilization * 100,
+			r.cpuAcquisition * 100, r.cpuDevice * 100);
+		first = 0;
+	}
+	printf("\n]}\n");
+	return failed;
+}
@@ -0,0 +1,120 @@
+/* Benchmark da serialização do GetValues
+ *
+ * Compara a implementação anterior do GetValues (concatenação de std::string e sprintf) com o escritor
+ * src/json usado em snapshot_Multimeters. Ambas geram o mesmo texto, que é conferido antes da medição.
+ * A criação da string V8 é igual nas duas e fica fora da medição.
+ * */
+
+#include "../src/json/json.h"
+#include "../src/app.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include <new>
+#include <time.h>
+
+#define nCALLS 1000000
+
+static unsigned long allocations;
+
+void* operator new(size_t size) {
+	allocations++;
+	return malloc(size);
+}
+
+void operator delete(void* p) noexcept {
+	free(p);
+}
+
+void operator delete(void* p, size_t) noexcept {
+	free(p);
+}
+
+static double Now(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// Implementação anterior do GetValues
+static std::string OldJsonMultimeters(const tMultimeter* multimeter, uint n) {
+	uint i;
+	std::string buffer_amp = "", buffer_volt = "";
+	char value[12];
+	buffer_amp = std::string("\"amperemeter\":[");
+	buffer_volt = std::string("\"voltmeter\":[");
+
+	for(i =0; i < n ; i++){
+		if(multimeter[i].sts)
+				sprintf( value, "%i", multimeter[i].value);
+		else
+				sprintf( value, "%i", 0);
+
+		std::string& buffer = multimeter[i].func ? buffer_amp : buffer_volt;
+		if(buffer[buffer.size()-1] != '[')
+			buffer = buffer + std::string(",");
+		buffer = buffer + std::string(value);
+	}
+	buffer_amp = buffer_amp + std::string("]");
+    buffer_volt = buffer_volt + std::string("]");
+
+	return buffer_amp + "," + buffer_volt;
+}
+
+static std::string OldGetValues(const tMultimeter* multimeter) {
+	return "{" + OldJsonMultimeters(multimeter, nMULTIMETER) + "}";
+}
+
+static void NewGetValues(tJson* json, const tMultimeter* multimeter) {
+	json_Reset(json);
+	json_Char(json, '{');
+	snapshot_Multimeters(json, multimeter, nMULTIMETER);
+	json_Char(json, '}');
+}
+
+int main(void) {
+	tMultimeter multimeter[nMULTIMETER];
+	static tJson json;
+	size_t bytes = 0;
+	int k, x;
+
+	for (x=0; x<nMULTIMETER; x++) {
+		multimeter[x].func = x & 1;
+		multimeter[x].sts = (x == 5) ? 0 : 1;
+		multimeter[x].value = (x & 1) ? 12034 - x*517 : -x*37;
+	}
+
+	NewGetValues(&json, multimeter);
+	std::string old = OldGetValues(multimeter);
+	if (old != std::string(json.buf, json.len)) {
+		printf("saídas diferentes:\n%s\n%.*s\n", old.c_str(), (int)json.len, json.buf);
+		return 1;
+	}
+	printf("saída:      %s\n", json.buf);
+
+	unsigned long a0 = allocations;
+	double t0 = Now();
+	for (k=0; k<nCALLS; k++) {
+		multimeter[k & 15].value ^= 1;
+		bytes += OldGetValues(multimeter).size();
+	}
+	double tOld = Now() - t0;
+	double allocOld = (double)(allocations - a0) / nCALLS;
+
+	uint size = json.size;
+	a0 = allocations;
+	t0 = Now();
+	for (k=0; k<nCALLS; k++) {
+		multimeter[k & 15].value ^= 1;
+		NewGetValues(&json, multimeter);
+		bytes += json.len;
+	}
+	double tNew = Now() - t0;
+	int grew = json.size != size || allocations != a0;
+
+	printf("anterior:   %.2f Mchamadas/s, %.1f alocações/chamada\n", nCALLS / tOld / 1e6, allocOld);
+	printf("src/json:   %.2f Mchamadas/s, %s\n", nCALLS / tNew / 1e6, grew ? "buffer realocado" : "0 alocações/chamada");
+	printf("ganho:      %.1fx\n", tOld / tNew);
+	return bytes == 0;
+}
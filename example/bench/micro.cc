@@ -0,0 +1,285 @@
+/* Microbenchmarks do caminho de cada transação modbus
+ *
+ * Uso: micro [filtro]
+ * 	 Mede os CRCs, a montagem das queries e o processamento da resposta do mestre modbus, a decodificação do bloco
+ * 	 dos multímetros e a serialização do GetValues, somente os benchmarks cujo nome contém filtro.
+ * 	 O resultado vai para o stdout em JSON, para ser guardado e comparado entre versões, e uma tabela para o stderr.
+ *
+ * Cada benchmark é calibrado para que uma medição dure ao menos MIN_RUN_MS, executado uma vez para aquecer os caches
+ * e depois medido nRUNS vezes. O resultado é a mediana em ns por operação, com o mínimo e a dispersão
+ * (interquartil/mediana) para julgar se a diferença entre duas versões é maior que o ruído da máquina.
+ * O processo é fixado na CPU em que começou para não medir migrações.
+ * */
+
+#include "../src/json/json.h"
+#include "../src/app.h"
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define nRUNS 11
+#define MIN_RUN_MS 20
+#define lenRESPONSE (3 + 2*4*nMULTIMETER_GEREN + 2)	// Resposta da leitura dos multímetros gerenciados pelo RH
+
+typedef struct {
+	const char* name;
+	uint bytes;				// Bytes processados por operação, 0 se não se aplica
+	void (*run)(uint n);
+} tBench;
+
+typedef struct {
+	double ns, min, spread;
+	uint iterations;
+} tResult;
+
+static volatile uint sink;	// Consome os resultados para o compilador não eliminar as operações
+static u8 frame[256];
+static u8 response[lenRESPONSE];
+static u16 regs[4*nMULTIMETER];
+static modbusMaster_t master;
+static uint rxPos;
+static tTime ticks;
+
+static double Now(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// #####################################################################################################################
+// PORTA SIMULADA DO MESTRE
+// #####################################################################################################################
+
+static int Puts(void* port, u8* buffer, u16 count) {
+	return count;
+}
+
+// Entrega os bytes de response, um por chamada como a UART
+static int Getc(void* port, u8* ch) {
+	if (rxPos >= sizeof(response)) return pdFAIL;
+	*ch = response[rxPos++];
+	return pdPASS;
+}
+
+static void FlushRX(void* port) {
+}
+
+// Relógio que avança 11ms por consulta, assim o silêncio de 10ms que encerra a resposta é detectado na primeira
+// consulta após o último byte, sem espera real
+static tTime Clock(void) {
+	return ticks += 11;
+}
+
+// #####################################################################################################################
+// BENCHMARKS
+// #####################################################################################################################
+
+static void Crc16Modbus8(uint n) {
+	uint k; for (k=0; k<n; k++) { frame[0] = k; sink += crc16_MODBUS(frame, 8); }
+}
+
+static void Crc16ModbusResponse(uint n) {
+	uint k; for (k=0; k<n; k++) { frame[0] = k; sink += crc16_MODBUS(frame, lenRESPONSE); }
+}
+
+static void Crc16Modbus256(uint n) {
+	uint k; for (k=0; k<n; k++) { frame[0] = k; sink += crc16_MODBUS(frame, 256); }
+}
+
+static void Crc16Xmodem(uint n) {
+	uint k; for (k=0; k<n; k++) { frame[0] = k; sink += crc16_XMODEM(frame, lenRESPONSE); }
+}
+
+static void Crc16Dnp3(uint n) {
+	uint k; for (k=0; k<n; k++) { frame[0] = k; sink += crc16_DNP3(frame, lenRESPONSE); }
+}
+
+static void Crc16Nbr14522(uint n) {
+	uint k; for (k=0; k<n; k++) { frame[0] = k; sink += crc16_NBR14522(frame, lenRESPONSE); }
+}
+
+static void Crc8Hex(uint n) {
+	uint k; for (k=0; k<n; k++) { frame[0] = k; sink += crc8_HEX(frame, lenRESPONSE); }
+}
+
+static void Crc7(uint n) {
+	uint k; for (k=0; k<n; k++) { frame[0] = k; sink += crc7(frame, lenRESPONSE); }
+}
+
+// Query da leitura dos multímetros (função 3), como no modbus_SendCommand
+static void ReadRequest(uint n) {
+	uint k; for (k=0; k<n; k++) {
+		master.waitResponse = pdFALSE;
+		modbus_MasterReadRegisters(&master, 1, 0x400, 4*nMULTIMETER_GEREN, regs);
+		sink += master.querie[7];
+	}
+}
+
+// Query da gravação dos reles (função 6)
+static void WriteRequest(uint n) {
+	uint k; for (k=0; k<n; k++) {
+		master.waitResponse = pdFALSE;
+		modbus_MasterWriteRegister(&master, 1, 0x300, (u16)k);
+		sink += master.querie[7];
+	}
+}
+
+// Recepção byte a byte, CRC, validação e cópia dos registradores da resposta da leitura dos multímetros.
+// O estado do mestre é o deixado pelo modbus_MasterReadRegisters, sem o custo da montagem da query
+static void ParseResponse(uint n) {
+	uint k; for (k=0; k<n; k++) {
+		master.slaveID = 1;
+		master.cmd = 3;
+		master.len = 4*nMULTIMETER_GEREN;
+		master.regs = regs;
+		master.sts = errMODBUS_BUSY;
+		master.waitResponse = pdTRUE;
+		master.rxLen = 0;
+		master.firstByte = pdTRUE;
+		master.tout = ticks;
+		rxPos = 0;
+		while (master.sts == errMODBUS_BUSY) modbus_MasterProcess(&master);
+		sink += master.sts + regs[0];
+	}
+}
+
+static void DecodeMultimeters(uint n) {
+	static tMultimeter multimeter[nMULTIMETER];
+	uint k; for (k=0; k<n; k++) {
+		regs[2] = k;
+		modbus_DecodeMultimeters(multimeter, nMULTIMETER, regs);
+		sink += multimeter[0].value;
+	}
+}
+
+// Corpo do GetValues, a criação da string V8 fica fora
+static void GetValues(uint n) {
+	static tMultimeter multimeter[nMULTIMETER];
+	static tJson json;
+	uint k, x;
+	for (x=0; x<nMULTIMETER; x++) {
+		multimeter[x].func = x & 1;
+		multimeter[x].sts = 1;
+		multimeter[x].value = (x & 1) ? 12034 - x*517 : -x*37;
+	}
+	for (k=0; k<n; k++) {
+		multimeter[k & 15].value ^= 1;
+		json_Reset(&json);
+		json_Char(&json, '{');
+		snapshot_Multimeters(&json, multimeter, nMULTIMETER);
+		json_Char(&json, '}');
+		sink += json.len;
+	}
+}
+
+static const tBench benches[] = {
+	{ "crc16_MODBUS/8", 8, Crc16Modbus8 },
+	{ "crc16_MODBUS/response", lenRESPONSE, Crc16ModbusResponse },
+	{ "crc16_MODBUS/256", 256, Crc16Modbus256 },
+	{ "crc16_XMODEM/response", lenRESPONSE, Crc16Xmodem },
+	{ "crc16_DNP3/response", lenRESPONSE, Crc16Dnp3 },
+	{ "crc16_NBR14522/response", lenRESPONSE, Crc16Nbr14522 },
+	{ "crc8_HEX/response", lenRESPONSE, Crc8Hex },
+	{ "crc7/response", lenRESPONSE, Crc7 },
+	{ "frame/read_request", 8, ReadRequest },
+	{ "frame/write_request", 8, WriteRequest },
+	{ "frame/parse_read_response", lenRESPONSE, ParseResponse },
+	{ "decode/multimeters", 8*nMULTIMETER, DecodeMultimeters },
+	{ "json/getvalues", 0, GetValues },
+};
+
+// #####################################################################################################################
+// MEDIÇÃO
+// #####################################################################################################################
+
+static int Compare(const void* a, const void* b) {
+	double x = *(const double*)a, y = *(const double*)b;
+	return (x > y) - (x < y);
+}
+
+static void Measure(const tBench* b, tResult* r) {
+	double runs[nRUNS];
+	uint n = 1;
+
+	// calibração: dobra as iterações até a medição durar MIN_RUN_MS
+	for (;;) {
+		double t0 = Now();
+		b->run(n);
+		if ((Now() - t0) * 1000 >= MIN_RUN_MS || n >= (1u << 30)) break;
+		n *= 2;
+	}
+
+	b->run(n);
+	int x; for (x=0; x<nRUNS; x++) {
+		double t0 = Now();
+		b->run(n);
+		runs[x] = (Now() - t0) * 1e9 / n;
+	}
+	qsort(runs, nRUNS, sizeof(double), Compare);
+	r->ns = runs[nRUNS/2];
+	r->min = runs[0];
+	r->spread = (runs[3*nRUNS/4] - runs[nRUNS/4]) / r->ns;
+	r->iterations = n;
+}
+
+// Resposta válida do RH com os multímetros gerenciados, a mesma usada em todas as medições do processamento
+static void Setup(void) {
+	uint x;
+	for (x=0; x<sizeof(frame); x++) frame[x] = (u8)(x * 37 + 11);
+
+	response[0] = 1;
+	response[1] = 3;
+	response[2] = 2*4*nMULTIMETER_GEREN;
+	for (x=0; x<4*nMULTIMETER_GEREN; x++) {
+		u16 reg = (x % 4 == 0) ? 5 : (x % 4 == 1) ? (u16)(0x01 | ((x/4 & 1) << 4)) : (x % 4 == 2) ? (u16)(1000 + x) : 0;
+		response[3 + 2*x] = reg >> 8;
+		response[4 + 2*x] = reg & 0xff;
+	}
+	u16 crc = crc16_MODBUS(response, lenRESPONSE - 2);
+	response[lenRESPONSE - 2] = crc & 0xff;
+	response[lenRESPONSE - 1] = crc >> 8;
+	for (x=0; x<4*nMULTIMETER; x++) regs[x] = (u16)(x * 7919);
+
+	modbus_MasterInit(&master, NULL, Puts, Getc, FlushRX);
+	modbus_MasterAppendTime(&master, Clock, 3000);
+}
+
+int main(int argc, char** argv) {
+	const char* filter = (argc > 1) ? argv[1] : "";
+	uint nBenches = sizeof(benches) / sizeof(benches[0]);
+
+	int cpu = sched_getcpu();
+	if (cpu >= 0) {
+		cpu_set_t set;
+		CPU_ZERO(&set);
+		CPU_SET(cpu, &set);
+		sched_setaffinity(0, sizeof(set), &set);
+	}
+
+	Setup();
+	ParseResponse(1);
+	if (master.sts != pdPASS || regs[2] != 1002) {
+		fprintf(stderr, "resposta simulada não foi aceita pelo mestre: status %d\n", master.sts);
+		return 1;
+	}
+
+	printf("{\"suite\":\"micro\",\"runs\":%d,\"cpu\":%d,\"benchmarks\":[", nRUNS, cpu);
+	fprintf(stderr, "%-28s %10s %10s %8s %10s\n", "benchmark", "ns/op", "min", "spread", "MB/s");
+	int first = 1;
+	uint x; for (x=0; x<nBenches; x++) {
+		const tBench* b = &benches[x];
+		if (!strstr(b->name, filter)) continue;
+
+		tResult r;
+		Measure(b, &r);
+		double mbps = (b->bytes) ? b->bytes * 1e3 / r.ns : 0;
+		printf("%s\n{\"name\":\"%s\",\"ns\":%.2f,\"min\":%.2f,\"spread\":%.4f,\"iterations\":%u,\"bytes\":%u,\"MBps\":%.1f}",
+			first ? "" : ",", b->name, r.ns, r.min, r.spread, r.iterations, b->bytes, mbps);
+		fprintf(stderr, "%-28s %10.2f %10.2f %7.1f%% %10.1f\n", b->name, r.ns, r.min, r.spread * 100, mbps);
+		first = 0;
+	}
+	printf("\n]}\n");
+	return sink == 0xffffffff;
+}
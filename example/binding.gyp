@@ -0,0 +1,42 @@
+{
+  "targets": [
+    {
+      "target_name": "panel",
+      "sources": [
+        "src/panel.cc",
+        "src/session.cc",
+        "src/modbus.cc",
+        "src/outputs.cc",
+        "src/history.cc",
+        "src/aggregate.cc",
+        "src/deadband.cc",
+        "src/snapshot.cc",
+        "src/events.cc",
+        "src/stats.cc",
+        "src/log.cc",
+        "src/uart/uart.cc",
+        "src/modbus/modbus_master.cc",
+        "src/modbus/modbus_slave.cc",
+        "src/crc/crc.cc",
+        "src/timer/timer.cc",
+        "src/json/json.cc",
+        "src/recorder/recorder.cc",
+        "src/colstore/colstore.cc",
+        "src/colstore/archive.cc",
+        "src/capture/capture.cc",
+        "src/trace/trace.cc"
+      ],
+      "include_dirs": [
+        "src",
+        "src/uart",
+        "src/modbus",
+        "src/crc",
+        "src/timer"
+      ],
+      "defines": [ "NAPI_VERSION=6" ],
+      "cflags": [ "-pthread", "-Wall", "-Wextra", "-Wno-unused-parameter" ],
+      "cflags_cc": [ "-fno-rtti", "-fno-exceptions" ],
+      "ldflags": [ "-pthread" ]
+    }
+  ]
+}
@@ -1,154 +0,0 @@
-# This file is generated by gyp; do not edit.
-
-TOOLSET := target
-TARGET := panel
-DEFS_Debug := \
-	'-D_LARGEFILE_SOURCE' \
-	'-D_FILE_OFFSET_BITS=64' \
-	'-DBUILDING_NODE_EXTENSION' \
-	'-DDEBUG' \
-	'-D_DEBUG'
-
-# Flags passed to all source files.
-CFLAGS_Debug := \
-	-fPIC \
-	-pthread \
-	-Wall \
-	-Wextra \
-	-Wno-unused-parameter \
-	-g \
-	-O0
-
-# Flags passed to only C files.
-CFLAGS_C_Debug :=
-
-# Flags passed to only C++ files.
-CFLAGS_CC_Debug := \
-	-fno-rtti \
-	-fno-exceptions
-
-INCS_Debug := \
-	-I/root/.node-gyp/0.12.1/src \
-	-I/root/.node-gyp/0.12.1/deps/uv/include \
-	-I/root/.node-gyp/0.12.1/deps/v8/include \
-	-I$(srcdir)/node_modules/nan \
-	-I$(srcdir)/src \
-	-I$(srcdir)/src/uart \
-	-I$(srcdir)/src/modbus \
-	-I$(srcdir)/src/crc \
-	-I$(srcdir)/src/timer
-
-DEFS_Release := \
-	'-D_LARGEFILE_SOURCE' \
-	'-D_FILE_OFFSET_BITS=64' \
-	'-DBUILDING_NODE_EXTENSION'
-
-# Flags passed to all source files.
-CFLAGS_Release := \
-	-fPIC \
-	-pthread \
-	-Wall \
-	-Wextra \
-	-Wno-unused-parameter \
-	-O3 \
-	-ffunction-sections \
-	-fdata-sections \
-	-fno-tree-vrp \
-	-fno-omit-frame-pointer
-
-# Flags passed to only C files.
-CFLAGS_C_Release :=
-
-# Flags passed to only C++ files.
-CFLAGS_CC_Release := \
-	-fno-rtti \
-	-fno-exceptions
-
-INCS_Release := \
-	-I/root/.node-gyp/0.12.1/src \
-	-I/root/.node-gyp/0.12.1/deps/uv/include \
-	-I/root/.node-gyp/0.12.1/deps/v8/include \
-	-I$(srcdir)/node_modules/nan \
-	-I$(srcdir)/src \
-	-I$(srcdir)/src/uart \
-	-I$(srcdir)/src/modbus \
-	-I$(srcdir)/src/crc \
-	-I$(srcdir)/src/timer
-
-OBJS := \
-	$(obj).target/$(TARGET)/src/modbus.o \
-	$(obj).target/$(TARGET)/src/panel.o \
-	$(obj).target/$(TARGET)/src/crc/crc.o \
-	$(obj).target/$(TARGET)/src/uart/uart.o \
-	$(obj).target/$(TARGET)/src/timer/timer.o \
-	$(obj).target/$(TARGET)/src/modbus/modbus_master.o \
-	$(obj).target/$(TARGET)/src/modbus/modbus_slave.o
-
-# Add to the list of files we specially track dependencies for.
-all_deps += $(OBJS)
-
-# CFLAGS et al overrides must be target-local.
-# See "Target-specific Variable Values" in the GNU Make manual.
-$(OBJS): TOOLSET := $(TOOLSET)
-$(OBJS): GYP_CFLAGS := $(DEFS_$(BUILDTYPE)) $(INCS_$(BUILDTYPE))  $(CFLAGS_$(BUILDTYPE)) $(CFLAGS_C_$(BUILDTYPE))
-$(OBJS): GYP_CXXFLAGS := $(DEFS_$(BUILDTYPE)) $(INCS_$(BUILDTYPE))  $(CFLAGS_$(BUILDTYPE)) $(CFLAGS_CC_$(BUILDTYPE))
-
-# Suffix rules, putting all outputs into $(obj).
-
-$(obj).$(TOOLSET)/$(TARGET)/%.o: $(srcdir)/%.cc FORCE_DO_CMD
-	@$(call do_cmd,cxx,1)
-
-$(obj).$(TOOLSET)/$(TARGET)/%.o: $(srcdir)/%.c FORCE_DO_CMD
-	@$(call do_cmd,cc,1)
-
-# Try building from generated source, too.
-
-$(obj).$(TOOLSET)/$(TARGET)/%.o: $(obj).$(TOOLSET)/%.cc FORCE_DO_CMD
-	@$(call do_cmd,cxx,1)
-
-$(obj).$(TOOLSET)/$(TARGET)/%.o: $(obj).$(TOOLSET)/%.c FORCE_DO_CMD
-	@$(call do_cmd,cc,1)
-
-$(obj).$(TOOLSET)/$(TARGET)/%.o: $(obj)/%.cc FORCE_DO_CMD
-	@$(call do_cmd,cxx,1)
-
-$(obj).$(TOOLSET)/$(TARGET)/%.o: $(obj)/%.c FORCE_DO_CMD
-	@$(call do_cmd,cc,1)
-
-# End of this set of suffix rules
-### Rules for final target.
-LDFLAGS_Debug := \
-	-pthread \
-	-rdynamic
-
-LDFLAGS_Release := \
-	-pthread \
-	-rdynamic
-
-LIBS :=
-
-$(obj).target/panel.node: GYP_LDFLAGS := $(LDFLAGS_$(BUILDTYPE))
-$(obj).target/panel.node: LIBS := $(LIBS)
-$(obj).target/panel.node: TOOLSET := $(TOOLSET)
-$(obj).target/panel.node: $(OBJS) FORCE_DO_CMD
-	$(call do_cmd,solink_module)
-
-all_deps += $(obj).target/panel.node
-# Add target alias
-.PHONY: panel
-panel: $(builddir)/panel.node
-
-# Copy this to the executable output path.
-$(builddir)/panel.node: TOOLSET := $(TOOLSET)
-$(builddir)/panel.node: $(obj).target/panel.node FORCE_DO_CMD
-	$(call do_cmd,copy)
-
-all_deps += $(builddir)/panel.node
-# Short alias for building this executable.
-.PHONY: panel.node
-panel.node: $(obj).target/panel.node $(builddir)/panel.node
-
-# Add executable to "all" target.
-.PHONY: all
-all: $(builddir)/panel.node
-
@@ -0,0 +1,146 @@
+#include "timer/timer.h"
+#include "_config_cpu_.h"
+#include "app.h"
+#include <pthread.h>
+#include <math.h>
+#include <stdlib.h>
+
+// Estatísticas das janelas móveis dos multímetros (mínimo, máximo, média e RMS)
+//	Cada janela é dividida em nAGGREGATE_BUCKETS fatias de tempo. A thread modbus_Process acumula cada amostra
+//	somente na fatia atual de cada janela, ou seja, custo O(1) por amostra. A leitura combina as fatias que
+//	ainda estão dentro da janela, assim o custo da consulta não depende da taxa de amostragem nem da quantidade de clientes.
+//	A janela cobre entre 1 e 1+1/nAGGREGATE_BUCKETS do seu tamanho, conforme a posição dentro da fatia atual.
+
+typedef struct {
+	u64 index;			// Índice absoluto da fatia (tempo / largura da fatia), usado para saber se a fatia está vencida
+	uint count;			// Quantidade de amostras acumuladas
+	s64 sum;			// Soma dos valores
+	double sumsq;		// Soma dos quadrados dos valores
+	int min, max;
+} tBucket;
+
+typedef struct {
+	tBucket bucket[nAGGREGATE_BUCKETS+1];	// Uma fatia a mais para a fatia atual que ainda está sendo preenchida
+	int func;								// Última função assumida pelo multímetro
+} tChannelAgg;
+
+struct tAggregator {
+	tChannelAgg agg[nAGGREGATE_WINDOWS][nMULTIMETER];
+	uint nChannels;
+	uint seq;				// Sequência da última amostra acumulada
+	pthread_mutex_t lock;
+};
+
+static const tTime windows[nAGGREGATE_WINDOWS] = { 1000, 10000, 60000 }; // Tamanho das janelas em ms
+
+// largura da fatia da janela w em us
+static u64 BucketWidth(int w) {
+	return (u64)windows[w] * 1000ull / nAGGREGATE_BUCKETS;
+}
+
+// -------------------------------------------------------------------------------------------------------------------
+// FUNÇÃO:		aggregate_New
+// Retorna:		Janelas vazias de um painel, ou NULL se não há memória
+// -------------------------------------------------------------------------------------------------------------------
+tAggregator* aggregate_New(void) {
+	tAggregator* aggregator = (tAggregator*)calloc(1, sizeof(tAggregator));
+	if (aggregator) pthread_mutex_init(&aggregator->lock, NULL);
+	return aggregator;
+}
+
+// -------------------------------------------------------------------------------------------------------------------
+// FUNÇÃO:		aggregate_Free
+// -------------------------------------------------------------------------------------------------------------------
+void aggregate_Free(tAggregator* aggregator) {
+	if (!aggregator) return;
+	pthread_mutex_destroy(&aggregator->lock);
+	free(aggregator);
+}
+
+// -------------------------------------------------------------------------------------------------------------------
+// FUNÇÃO:		aggregate_Push
+// Descrição: 	Acumula uma amostra em todas as janelas. Somente os multímetros com valor convertido (sts == 1) são acumulados
+// -------------------------------------------------------------------------------------------------------------------
+void aggregate_Push(tAggregator* aggregator, const tSample* sample) {
+	int w; uint x;
+
+	pthread_mutex_lock(&aggregator->lock);
+	for (w=0; w<nAGGREGATE_WINDOWS; w++) {
+		u64 index = sample->time / BucketWidth(w);
+		for (x=0; x<sample->nMultimeters; x++) {
+			const tMultimeter* m = &sample->multimeter[x];
+			tChannelAgg* ch = &aggregator->agg[w][x];
+			ch->func = m->func;
+			if (m->sts != 1) continue;
+
+			// a fatia é reaproveitada quando pertence a uma volta anterior do buffer
+			tBucket* b = &ch->bucket[index % (nAGGREGATE_BUCKETS+1)];
+			if (b->index != index || b->count == 0) {
+				b->index = index;
+				b->count = 0;
+				b->sum = 0;
+				b->sumsq = 0;
+				b->min = b->max = m->value;
+			}
+
+			b->count++;
+			b->sum += m->value;
+			b->sumsq += (double)m->value * m->value;
+			if (m->value < b->min) b->min = m->value;
+			if (m->value > b->max) b->max = m->value;
+		}
+	}
+	aggregator->nChannels = sample->nMultimeters;
+	aggregator->seq = sample->seq;
+	pthread_mutex_unlock(&aggregator->lock);
+}
+
+// -------------------------------------------------------------------------------------------------------------------
+// FUNÇÃO:		aggregate_Read
+// Descrição: 	Calcula as estatísticas de todos os multímetros na janela w
+// Parametros:	w: Índice da janela, de 0 a nAGGREGATE_WINDOWS-1
+//				out: Buffer para nMULTIMETER estatísticas
+//				last: Retorna a sequência da última amostra acumulada, pode ser NULL
+// Retorna:		Quantidade de multímetros em out
+// -------------------------------------------------------------------------------------------------------------------
+int aggregate_Read(tAggregator* aggregator, int w, tAggregate* out, uint* last) {
+	uint x; int k;
+	u64 index = now_us() / BucketWidth(w);
+
+	pthread_mutex_lock(&aggregator->lock);
+	for (x=0; x<aggregator->nChannels; x++) {
+		tChannelAgg* ch = &aggregator->agg[w][x];
+		s64 sum = 0;
+		double sumsq = 0;
+
+		out[x].func = ch->func;
+		out[x].count = 0;
+		out[x].min = out[x].max = 0;
+		for (k=0; k<nAGGREGATE_BUCKETS+1; k++) {
+			tBucket* b = &ch->bucket[k];
+			if (b->count == 0 || b->index > index || b->index + nAGGREGATE_BUCKETS < index) continue;
+
+			if (out[x].count == 0 || b->min < out[x].min) out[x].min = b->min;
+			if (out[x].count == 0 || b->max > out[x].max) out[x].max = b->max;
+			out[x].count += b->count;
+			sum += b->sum;
+			sumsq += b->sumsq;
+		}
+
+		out[x].mean = out[x].count ? (double)sum / out[x].count : 0;
+		out[x].rms = out[x].count ? sqrt(sumsq / out[x].count) : 0;
+	}
+	if (last) *last = aggregator->seq;
+	int n = aggregator->nChannels;
+	pthread_mutex_unlock(&aggregator->lock);
+
+	return n;
+}
+
+// -------------------------------------------------------------------------------------------------------------------
+// FUNÇÃO:		aggregate_Window
+// Retorna:		Tamanho em ms da janela w
+// -------------------------------------------------------------------------------------------------------------------
+tTime aggregate_Window(int w) {
+	return windows[w];
+}
@@ -1,10 +1,6 @@
 #ifndef APP_H
 #define APP_H
 
-// ###########################################################################################################################################
-// DESENVOLVIMENTO
-#define LOG_MODBUS		pdON
-
 // ###########################################################################################################################################
 // MODEL WORKTEMP
 
@@ -36,6 +32,13 @@
 									// Ou a tolerancia de erro no rasp no  to grande como no PC onde o ARM tem um erro considervel
 									//	TODO Quando usar o oscilador interno do ARM refazer os testes a sabe com usando oscilador interno do ARM isso se resolve
 
+// ###########################################################################################################################################
+// SESSO
+#define SESSION_IDLE_GRACE	30000	// Tempo em ms que a UART e a thread continuam ativas aps o ltimo cliente se desanexar
+#define SESSION_STOP_TIMEOUT	500	// Tempo mximo em ms que a thread espera o frame em andamento e a gravao das sadas pendentes antes de sair
+#define OUTPUTS_TIMEOUT		1000	// Tempo mximo em ms que o panel.apply espera a confirmao da gravao das sadas pelo RH
+#define MODBUS_POLL_PERIOD	1		// Tempo mximo em ms que a thread modbus_Process dorme esperando bytes da resposta do RH
+
 // ###########################################################################################################################################
 // CONTROLE DO SISTEMA
 
@@ -66,7 +69,7 @@ typedef enum {
 } tFuncEx;
 
 typedef struct {
-	unsigned exit:1;		// 1 Sinaliza para cair fora do programa
+	volatile unsigned exit;	// 1 Sinaliza para cair fora do programa. Fora dos campos de bits porque  escrito pelo JS enquanto a thread escreve os demais
 	unsigned getInfo:1;		// Sinaliza para capturar as informaes do recurso de hardware
 	unsigned getRelays:1;	// Sinaliza para capturar as informaes dos reles do recurso de hardware
 	unsigned getDouts:1;	// Sinaliza para capturar as informaes das sadas digitais do recurso de hardware
@@ -92,6 +95,64 @@ typedef struct {
 	uint relaysOld, doutsOld;
 } tControl, *pControl;
 
+// Amostra publicada pela thread modbus_Process a cada leitura completa dos multmetros
+typedef struct {
+	uint seq;				// Nmero de sequncia da amostra, cresce a cada leitura publicada
+	u64 time;				// Instante da leitura em us desde epoch
+	int stsCom;				// Status de comunicao com RH no momento da leitura
+	uint relays;			// Estados dos reles no momento da leitura
+	uint douts;				// Estados das saidas digitais no momento da leitura
+	uint nMultimeters;		// Quantidade de multmetros vlidos em multimeter
+	tMultimeter multimeter[nMULTIMETER];
+} tSample;
+#define nHISTORY 2048		// Quantidade de amostras mantidas no histrico. Com uma leitura a cada ~30ms cobre ~1 minuto
+
+// Estatsticas de um multmetro numa janela mvel de tempo
+typedef struct {
+	int func;				// Funo assumida do multmetro, ver tMultimeter
+	uint count;				// Quantidade de amostras na janela
+	int min, max;			// Valores em miliampers ou milivolts
+	double mean, rms;
+} tAggregate;
+#define nAGGREGATE_WINDOWS	3	// Janelas de 1s, 10s e 60s, ver aggregate.cc
+#define nAGGREGATE_BUCKETS	10	// Quantidade de fatias de cada janela, determina a resoluo da janela
+
+// Disposio do Int32Array retornado pelo panel.values(), ver snapshot_Values
+//	valHEADER inteiros de cabealho seguidos de nMULTIMETER grupos de valCHANNEL inteiros, um por multmetro
+//	Os inteiros sem sinal (seq, relays, douts) devem ser lidos com >>> 0 no JS
+typedef enum {
+	valSEQ = 0,				// Sequncia da amostra, 0 se nenhuma amostra foi publicada
+	valN_MULTIMETERS,		// Quantidade de multmetros vlidos
+	valSTS_COM,				// Status de comunicao com RH
+	valRELAYS,				// Estados dos reles
+	valDOUTS,				// Estados das saidas digitais
+	valTIME_LOW,			// Instante da leitura em ms desde epoch: valTIME_HIGH * 2^32 + valTIME_LOW
+	valTIME_HIGH,
+	valRESERVED,
+	valHEADER				// ndice do primeiro multmetro
+} tValuesHeader;
+
+typedef enum {
+	valVALUE = 0,			// valores em miliampers ou milivolts, 0 enquanto sts  0
+	valSTS,
+	valFUNC,
+	valMULTIMETER_STS_COM,
+	valCHANNEL				// Quantidade de inteiros por multmetro
+} tValuesChannel;
+#define lenVALUES (valHEADER + nMULTIMETER*valCHANNEL)
+
+// Banda morta de um multmetro, ver deadband.cc
+typedef enum {
+	deadbandABSOLUTE = 0,	// band em miliampers ou milivolts
+	deadbandRELATIVE		// band em porcentagem do ltimo valor reportado
+} tDeadbandMode;
+
+typedef struct {
+	uint channel;			// ndice do multmetro
+	uint seq;				// Sequncia da amostra em que o multmetro saiu da banda morta
+	tMultimeter multimeter;	// Leitura reportada
+} tChange;
+
 
 
 
@@ -107,13 +168,214 @@ typedef enum {
 
 typedef enum {readREGS, writeREG, writeREGS} tcmd;
 
+// Gravao das sadas pedida pelo panel.apply, ver outputs.cc
+#define outRELAYS	0x01
+#define outDOUTS	0x02
+typedef struct tApply {
+	int mask;				// Sadas a gravar: outRELAYS e/ou outDOUTS
+	uint relays, douts;		// Estados pedidos. No retorno, estados confirmados pelo RH
+	int sample;				// pdTRUE para esperar tambm a primeira leitura dos multmetros enviada aps a confirmao
+	int status;				// pdPASS se o RH confirmou a gravao
+	u64 latency;			// Tempo em us entre o pedido e a confirmao
+	u64 requested;			// Instante em us da chamada no JS, ver trace/trace.cc. 0 se no  conhecido
+	tSample read;			// Primeira amostra lida aps a confirmao, se sample. seq 0 se a leitura falhou ou no chegou a tempo
+	void (*done)(struct tApply* apply);	// Chamada pela thread modbus_Process ao concluir a transao, ver outputs_Apply
+	void* context;			// Livre para quem pediu a gravao
+} tApply;
+
+// Estatsticas das transaes modbus com um escravo numa funo, ver stats.cc
+typedef struct {
+	int slave;				// ID do escravo no barramento modbus
+	int function;			// Cdigo da funo modbus: 3, 6 ou 16
+	uint requests;			// Comandos enviados
+	uint retries;			// Comandos reenviados aps uma falha do mesmo comando
+	uint responses;			// Respostas validadas, as latncias abaixo so somente destas respostas
+	uint timeouts;			// errMODBUS_TIMEOUT
+	uint crcs;				// errMODBUS_CRC
+	uint exceptions;		// errMODBUS_EXCEPTION
+	uint lenPackets;		// errMODBUS_LENPACKET
+	uint others;			// Demais erros, inclusive falhas no envio
+	uint min, mean, p50, p90, p99, p999, max;	// Latncia em us entre o envio do comando e a resposta validada
+} tStats;
+#define nSTATS 8			// Pares escravo/funo registrados por painel
+
+// Ocupao do barramento de um painel, ver stats_Read
+typedef struct {
+	u64 elapsed;			// Tempo em us coberto pela contagem
+	u64 txBytes, rxBytes;	// Bytes enviados e recebidos pela UART
+	uint txFrames;			// Comandos enviados
+	uint rxFrames;			// Respostas validadas
+	uint turnaround;		// Tempo mdio em us entre o fim da transmisso do comando e o primeiro byte da resposta
+	uint idle;				// Tempo mdio em us com o barramento parado entre a concluso de um comando e o envio do prximo
+} tBus;
+
+// Nveis e categorias do log, ver log.cc. Os quadros do barramento so capturados em binrio, ver capture/capture.cc
+typedef enum {
+	logOFF = 0,
+	logERROR,
+	logWARN,
+	logINFO,				// Nvel inicial de todas as categorias
+	logDEBUG,
+	logTRACE
+} tLogLevel;
+
+typedef enum {
+	logSESSION = 0,			// Abertura da UART, incio e parada da thread
+	logMODBUS,				// Comandos enviados e respostas do RH
+	logSAMPLES,				// Valores lidos dos multmetros
+	nLOG_CATEGORIES
+} tLogCategory;
+
+extern int logLevels[nLOG_CATEGORIES];
+#define log_Enabled(category, level)	((level) <= __atomic_load_n(&logLevels[category], __ATOMIC_RELAXED))
+#define LOG(category, level, ...)		do { if (log_Enabled(category, level)) log_Write(category, level, __VA_ARGS__); } while (0)
+
 
 // ###############################################################################
+#include "json/json.h"
+#include "uart/uart.h"
+#include "modbus/modbus_master.h"
+
+// Estado de cada mdulo, os campos ficam no .cc do mdulo
+typedef struct tSession tSession;
+typedef struct tHistory tHistory;
+typedef struct tAggregator tAggregator;
+typedef struct tDeadband tDeadband;
+typedef struct tSnapshot tSnapshot;
+typedef struct tEvents tEvents;
+typedef struct tOutputs tOutputs;
+typedef struct tStatistics tStatistics;
+typedef struct tRecorder tRecorder;	// ver recorder/recorder.h
+typedef struct tArchive tArchive;	// ver colstore/colstore.h
+typedef struct tCapture tCapture;	// ver capture/capture.h
+typedef struct tTrace tTrace;		// ver trace/trace.h
+
+// Painel (bancada) criado pelo session_New
+//	Cada painel tem a sua porta UART, o seu mestre modbus, a sua thread modbus_Process e os consumidores das amostras,
+//	assim um mesmo processo pode atender vrias bancadas, cada uma na sua porta serial.
+//	O session_Acquire compartilha o painel de uma porta entre todos os objetos Panel do processo, inclusive os de worker_threads
+typedef struct tPanel {
+	char port[64];			// Porta UART, ver COM_PORT
+	uint baudrate;			// Constante do termios, ver MODBUS_BAUDRATE
+	uint rhID;				// ID do RH no barramento modbus
+	uint nMultimeters;		// Quantidade de multmetros que o RH deve gerenciar, at nMULTIMETER
+
+	tControl control;
+	tUart uart;
+	modbusMaster_t master;
+
+	// vars da thread modbus_Process, ver modbus.cc
+	int waitResponse;
+	tCommand cmd;
+	u16 regs[120];			// registrador de trabalho para troca de dados com os multimetros
+	uint seq;				// sequncia da ltima amostra publicada, mantida entre reinicializaes da thread
+	tSample sample;			// ltima amostra publicada
+	int function;			// cdigo da funo modbus do comando em andamento, ver tStats
+	u16 written;			// valor enviado pelo cmdSET_RELAYS ou cmdSET_DOUTS em andamento, confirmado na resposta do RH
+	u64 sentAt;				// instante em us do envio do comando em andamento
+	tCommand failed;		// ltimo comando que falhou, o seu prximo envio  contado como retentativa
+	u64 txEnd;				// instante estimado em us do fim da transmisso do comando em andamento, ver UartPuts
+	u64 rxFirst;			// instante em us do primeiro byte da resposta, 0 enquanto no chegou
+	u64 doneAt;				// instante em us da concluso do comando anterior, 0 no incio da thread
+
+	tSession* session;
+	tHistory* history;
+	tAggregator* aggregator;
+	tDeadband* deadband;
+	tSnapshot* snapshot;
+	tEvents* events;
+	tOutputs* outputs;
+	tStatistics* stats;
+	tRecorder* recorder;
+	tArchive* archive;
+	tCapture* capture;
+	tTrace* trace;
+
+	uint refs;				// Objetos Panel que usam o painel, ver session_Acquire
+	struct tPanel* next;
+} tPanel;
+
 // PROTOTIPOS
 
-int modbus_Init(void);
-void modbus_SendCommand( tCommand c) ;
-void init_control_tad();
+int modbus_Init(tPanel* panel);
+void modbus_SendCommand(tPanel* panel, tCommand c);
+void modbus_DecodeMultimeters(tMultimeter* multimeter, uint n, const u16* regs);
+void init_control_tad(tPanel* panel);
 void * modbus_Process(void * params);
 
+tPanel* session_New(const char* port, uint baudrate, uint rhID, uint nMultimeters);
+void session_Free(tPanel* panel);
+tPanel* session_Acquire(const char* port, uint baudrate, uint rhID, uint nMultimeters);
+void session_Release(tPanel* panel);
+int session_Open(tPanel* panel);
+int session_Start(tPanel* panel);
+int session_Stop(tPanel* panel, int closePort, tTime* elapsed);
+int session_Attach(tPanel* panel);
+int session_Detach(tPanel* panel);
+int session_Clients(tPanel* panel);
+void session_Lock(tPanel* panel);
+void session_Unlock(tPanel* panel);
+int session_Expired(tPanel* panel);
+
+tHistory* history_New(void);
+void history_Free(tHistory* history);
+void history_Push(tHistory* history, const tSample* sample);
+int history_Read(tHistory* history, uint since, tSample* samples, int max, uint* lost);
+uint history_Last(tHistory* history);
+
+tAggregator* aggregate_New(void);
+void aggregate_Free(tAggregator* aggregator);
+void aggregate_Push(tAggregator* aggregator, const tSample* sample);
+int aggregate_Read(tAggregator* aggregator, int w, tAggregate* out, uint* last);
+tTime aggregate_Window(int w);
+
+tDeadband* deadband_New(void);
+void deadband_Free(tDeadband* deadband);
+void deadband_Push(tDeadband* deadband, const tSample* sample);
+int deadband_Set(tDeadband* deadband, int channel, tDeadbandMode mode, double band);
+int deadband_Changes(tDeadband* deadband, uint since, tChange* out, uint* last);
+
+tSnapshot* snapshot_New(void);
+void snapshot_Free(tSnapshot* snapshot);
+void snapshot_Push(tSnapshot* snapshot, const tSample* sample);
+void snapshot_Multimeters(tJson* json, const tMultimeter* multimeter, uint n);
+const char* snapshot_Acquire(tSnapshot* snapshot, uint* len, uint* seq);
+void snapshot_Release(tSnapshot* snapshot);
+uint snapshot_Values(tSnapshot* snapshot, int* values, uint seq);
+
+typedef void (*tEventsNotify)(void* context);
+tEvents* events_New(void);
+void events_Free(tEvents* events);
+int events_Start(tEvents* events, tEventsNotify n, void* context);
+void events_Stop(tEvents* events, void* context);
+void events_Delivered(tEvents* events, void* context);
+void events_Publish(tEvents* events);
+
+tOutputs* outputs_New(void);
+void outputs_Free(tOutputs* outputs);
+int outputs_Apply(tPanel* panel, tApply* apply);
+int outputs_Cancel(tOutputs* outputs, tApply* apply);
+void outputs_Run(tOutputs* outputs, const tControl* control, int running);
+void outputs_Next(tOutputs* outputs, tControl* control);
+void outputs_Expire(tOutputs* outputs, const tControl* control);
+void outputs_Step(tOutputs* outputs, const tControl* control, tCommand cmd, int ret, const tSample* sample);
+
+tStatistics* stats_New(void);
+void stats_Free(tStatistics* stats);
+void stats_Start(tStatistics* stats);
+void stats_Cpu(tStatistics* stats, u64 cpu);
+void stats_Request(tStatistics* stats, int slave, int function, int retry);
+void stats_Response(tStatistics* stats, int slave, int function, int ret, u64 latency);
+void stats_Bus(tStatistics* stats, u64 txBytes, u64 rxBytes, s64 turnaround, s64 idle);
+int stats_Read(tStatistics* stats, tStats* out, tBus* bus, int reset);
+double stats_Utilization(const tBus* bus, uint bps);
+void stats_Metrics(tPanel* panel, tJson* text);
+
+int log_Start(void);
+void log_Flush(void);
+void log_SetLevel(int category, int level);
+int log_Level(const char* name);
+int log_Category(const char* name);
+void log_Write(int category, int level, const char* fmt, ...) __attribute__((format(printf, 3, 4)));
+
 #endif
@@ -0,0 +1,247 @@
+/* Captura dos quadros RTU trocados no barramento modbus
+ *
+ * Substitui os printf do LOG_MODBUS: cada comando enviado e cada resposta recebida pelo mestre é copiado, com
+ * o instante, a direção e o status da decodificação, num buffer circular de CAPTURE_RING quadros. A thread de
+ * aquisição é a única escritora e a thread de fundo a única leitora, então o buffer não usa lock: a thread de
+ * aquisição somente copia o quadro e avança head, sem chamadas de sistema. Se a thread de fundo não esvaziou o
+ * buffer a tempo o quadro é descartado e contado em dropped, a aquisição nunca espera pela gravação.
+ *
+ * A thread de fundo grava os quadros a cada CAPTURE_FLUSH_PERIOD ms num arquivo pcap (microssegundos,
+ * LINKTYPE_USER0). Cada pacote é um tCaptureHeader seguido do quadro RTU com o CRC. No Wireshark configurar em
+ * DLT_USER o DLT 147 com o protocolo "mbrtu" e header size 4. As respostas com timeout não têm bytes, somente
+ * o pseudo-cabeçalho com o status.
+ * */
+
+#include "capture.h"
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define PCAP_MAGIC				0xa1b2c3d4	// pcap com tempo em microssegundos, na ordem de bytes da máquina
+
+typedef struct {
+	uint magic;
+	u16 versionMajor;
+	u16 versionMinor;
+	int thiszone;
+	uint sigfigs;
+	uint snaplen;
+	uint network;
+} tPcapHeader;
+
+typedef struct {
+	uint sec;
+	uint usec;
+	uint inclLen;
+	uint origLen;
+} tPcapRecord;
+
+typedef struct {
+	u64 time;				// Instante em us desde epoch
+	u8 direction;
+	s8 status;
+	u16 len;
+	u8 data[CAPTURE_FRAME_SIZE];
+} tFrame;
+
+struct tCapture {
+	tFrame* ring;			// Alocado no primeiro capture_Start e mantido até o capture_Free
+	uint head;				// Próximo quadro a ser escrito, somente a thread de aquisição altera
+	uint tail;				// Próximo quadro a ser gravado, somente a thread de fundo altera
+	volatile int active;
+	int stop;				// Sinaliza para a thread de fundo terminar
+	uint dropped;			// Quadros descartados por o buffer estar cheio
+	FILE* file;
+	pthread_t thread;
+	pthread_mutex_t lock;
+	pthread_cond_t wake;
+};
+
+// #####################################################################################################################
+// AUX
+// #####################################################################################################################
+
+// Grava no arquivo os quadros que estão no buffer
+static void Drain(tCapture* capture) {
+	uint head = __atomic_load_n(&capture->head, __ATOMIC_ACQUIRE);
+	uint tail = capture->tail;
+
+	while (tail != head) {
+		const tFrame* f = &capture->ring[tail % CAPTURE_RING];
+		tCaptureHeader h;
+		tPcapRecord r;
+		h.direction = f->direction;
+		h.status = f->status;
+		h.reserved[0] = h.reserved[1] = 0;
+		r.sec = (uint)(f->time / 1000000);
+		r.usec = (uint)(f->time % 1000000);
+		r.inclLen = r.origLen = sizeof(h) + f->len;
+		fwrite(&r, sizeof(r), 1, capture->file);
+		fwrite(&h, sizeof(h), 1, capture->file);
+		fwrite(f->data, 1, f->len, capture->file);
+		tail++;
+		// o quadro só é liberado para a thread de aquisição depois de copiado
+		__atomic_store_n(&capture->tail, tail, __ATOMIC_RELEASE);
+	}
+	fflush(capture->file);
+}
+
+// Thread de fundo: grava periodicamente os quadros capturados, e os que restaram no buffer ao terminar
+static void* Process(void* params) {
+	tCapture* capture = (tCapture*)params;
+
+	pthread_mutex_lock(&capture->lock);
+	while (!capture->stop) {
+		pthread_mutex_unlock(&capture->lock);
+		Drain(capture);
+		pthread_mutex_lock(&capture->lock);
+
+		struct timespec ts;
+		clock_gettime(CLOCK_REALTIME, &ts);
+		ts.tv_sec += CAPTURE_FLUSH_PERIOD / 1000;
+		ts.tv_nsec += (CAPTURE_FLUSH_PERIOD % 1000) * 1000000L;
+		if (ts.tv_nsec >= 1000000000L) { ts.tv_sec++; ts.tv_nsec -= 1000000000L; }
+		if (!capture->stop) pthread_cond_timedwait(&capture->wake, &capture->lock, &ts);
+	}
+	pthread_mutex_unlock(&capture->lock);
+	Drain(capture);
+	return NULL;
+}
+
+// #####################################################################################################################
+// FUNCTIONS
+// #####################################################################################################################
+
+// -------------------------------------------------------------------------------------------------------------------
+// FUNÇÃO:		capture_New
+// Retorna:		Captura de um painel, parada até o capture_Start, ou NULL se não há memória
+// -------------------------------------------------------------------------------------------------------------------
+tCapture* capture_New(void) {
+	tCapture* capture = (tCapture*)calloc(1, sizeof(tCapture));
+	if (capture) {
+		pthread_mutex_init(&capture->lock, NULL);
+		pthread_cond_init(&capture->wake, NULL);
+	}
+	return capture;
+}
+
+// -------------------------------------------------------------------------------------------------------------------
+// FUNÇÃO:		capture_Free
+// Descrição: 	Encerra a captura, se estiver em andamento, e libera a captura.
+//				A thread de aquisição já deve ter terminado, ver session_Free
+// -------------------------------------------------------------------------------------------------------------------
+void capture_Free(tCapture* capture) {
+	if (!capture) return;
+	capture_Stop(capture);
+	pthread_cond_destroy(&capture->wake);
+	pthread_mutex_destroy(&capture->lock);
+	free(capture->ring);
+	free(capture);
+}
+
+// -------------------------------------------------------------------------------------------------------------------
+// FUNÇÃO:		capture_Start
+// Descrição: 	Inicia a captura dos quadros do barramento no arquivo path, que é sobrescrito
+// Retorna:		pdPASS se a captura foi iniciada, pdFAIL se já está capturando, se não há memória ou
+//				se não foi possível criar o arquivo
+// -------------------------------------------------------------------------------------------------------------------
+int capture_Start(tCapture* capture, const char* path) {
+	if (capture->active) return pdFAIL;
+
+	// o buffer não é liberado no capture_Stop, a thread de aquisição pode estar terminando de escrever um quadro
+	if (!capture->ring) capture->ring = (tFrame*)malloc(CAPTURE_RING * sizeof(tFrame));
+	if (!capture->ring) return pdFAIL;
+
+	capture->file = fopen(path, "wb");
+	if (!capture->file) return pdFAIL;
+
+	tPcapHeader h;
+	h.magic = PCAP_MAGIC;
+	h.versionMajor = 2;
+	h.versionMinor = 4;
+	h.thiszone = 0;
+	h.sigfigs = 0;
+	h.snaplen = sizeof(tCaptureHeader) + CAPTURE_FRAME_SIZE;
+	h.network = CAPTURE_LINKTYPE;
+	if (fwrite(&h, sizeof(h), 1, capture->file) != 1) {
+		fclose(capture->file);
+		return pdFAIL;
+	}
+
+	// descarta os quadros de uma captura anterior que não foram gravados
+	__atomic_store_n(&capture->tail, __atomic_load_n(&capture->head, __ATOMIC_ACQUIRE), __ATOMIC_RELEASE);
+	__atomic_store_n(&capture->dropped, 0, __ATOMIC_RELAXED);
+	capture->stop = pdFALSE;
+	if (pthread_create(&capture->thread, NULL, Process, (void *) capture)) {
+		fclose(capture->file);
+		return pdFAIL;
+	}
+
+	__atomic_store_n(&capture->active, pdTRUE, __ATOMIC_RELEASE);
+	return pdPASS;
+}
+
+// -------------------------------------------------------------------------------------------------------------------
+// FUNÇÃO:		capture_Stop
+// Descrição: 	Encerra a captura, grava os quadros que restaram no buffer e fecha o arquivo
+// -------------------------------------------------------------------------------------------------------------------
+void capture_Stop(tCapture* capture) {
+	if (!capture->active) return;
+
+	pthread_mutex_lock(&capture->lock);
+	__atomic_store_n(&capture->active, pdFALSE, __ATOMIC_RELEASE);
+	capture->stop = pdTRUE;
+	pthread_cond_signal(&capture->wake);
+	pthread_mutex_unlock(&capture->lock);
+	pthread_join(capture->thread, NULL);
+
+	fclose(capture->file);
+	capture->file = (FILE*)NULL;
+}
+
+// -------------------------------------------------------------------------------------------------------------------
+// FUNÇÃO:		capture_Active
+// Retorna:		pdTRUE se a captura está em andamento
+// -------------------------------------------------------------------------------------------------------------------
+int capture_Active(tCapture* capture) {
+	return capture->active;
+}
+
+// -------------------------------------------------------------------------------------------------------------------
+// FUNÇÃO:		capture_Dropped
+// Retorna:		Quantidade de quadros descartados na captura atual por o buffer estar cheio
+// -------------------------------------------------------------------------------------------------------------------
+uint capture_Dropped(tCapture* capture) {
+	return __atomic_load_n(&capture->dropped, __ATOMIC_RELAXED);
+}
+
+// -------------------------------------------------------------------------------------------------------------------
+// FUNÇÃO:		capture_Frame
+// Descrição: 	Chamada pela thread de aquisição a cada quadro enviado ou recebido. Somente copia o quadro no buffer,
+//				sem lock e sem chamadas de sistema. Com a captura parada retorna sem fazer nada
+// Parametros:	direction: captureTX ou captureRX
+//				status: Status do envio ou da decodificação da resposta, ver tCaptureHeader
+//				data, len: Bytes do quadro RTU, len 0 se nenhum byte foi recebido
+//				time: Instante em us desde epoch
+// -------------------------------------------------------------------------------------------------------------------
+void capture_Frame(tCapture* capture, int direction, int status, const u8* data, uint len, u64 time) {
+	if (!__atomic_load_n(&capture->active, __ATOMIC_ACQUIRE)) return;
+
+	uint head = capture->head;
+	if (head - __atomic_load_n(&capture->tail, __ATOMIC_ACQUIRE) >= CAPTURE_RING) {
+		__atomic_fetch_add(&capture->dropped, 1, __ATOMIC_RELAXED);
+		return;
+	}
+
+	tFrame* f = &capture->ring[head % CAPTURE_RING];
+	if (len > CAPTURE_FRAME_SIZE) len = CAPTURE_FRAME_SIZE;
+	f->time = time;
+	f->direction = (u8)direction;
+	f->status = (s8)status;
+	f->len = (u16)len;
+	memcpy(f->data, data, len);
+	// o quadro deve estar completo na memória antes de ser entregue à thread de fundo
+	__atomic_store_n(&capture->head, head + 1, __ATOMIC_RELEASE);
+}
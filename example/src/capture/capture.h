@@ -0,0 +1,32 @@
+#ifndef CAPTURE_H
+#define CAPTURE_H
+
+#include "../_config_cpu_.h"
+#include "../app.h"
+
+// Formato dos arquivos de captura, ver capture.cc
+#define CAPTURE_LINKTYPE		147			// LINKTYPE_USER0 do pcap
+#define CAPTURE_FRAME_SIZE		256			// Tamanho máximo de um quadro RTU, o mesmo buffer querie do mestre
+#define CAPTURE_RING			1024		// Quadros no buffer entre a thread de aquisição e a de fundo, potência de 2
+#define CAPTURE_FLUSH_PERIOD	200			// Período em ms que a thread de fundo grava os quadros no arquivo
+
+#define captureTX				0			// Comando enviado pelo mestre
+#define captureRX				1			// Resposta do escravo
+
+// Pseudo-cabeçalho gravado antes dos bytes do quadro RTU em cada pacote do arquivo
+typedef struct {
+	u8 direction;			// captureTX ou captureRX
+	s8 status;				// TX: pdPASS ou pdFAIL se o envio falhou. RX: pdPASS ou o erro errMODBUS_xxx da resposta
+	u8 reserved[2];
+} tCaptureHeader;
+
+// Captura de um painel, os campos ficam em capture.cc
+tCapture* capture_New(void);
+void capture_Free(tCapture* capture);
+int capture_Start(tCapture* capture, const char* path);
+void capture_Stop(tCapture* capture);
+int capture_Active(tCapture* capture);
+uint capture_Dropped(tCapture* capture);
+void capture_Frame(tCapture* capture, int direction, int status, const u8* data, uint len, u64 time);
+
+#endif
@@ -0,0 +1,216 @@
+/* Arquivo comprimido de longa duração das amostras
+ *
+ * A thread de aquisição acrescenta cada amostra publicada no bloco colunar em construção (colstore_Push).
+ * Quando o bloco enche ele é fechado diretamente numa das ARCHIVE_QUEUE posições da fila, e uma thread de fundo
+ * grava o bloco no arquivo. Assim a thread de aquisição não faz chamadas de sistema; se o disco não acompanhar
+ * e a fila encher, o bloco é descartado e contabilizado em archive_Dropped.
+ *
+ * Formato do arquivo: sequência de frames
+ * 	 u32 tamanho do bloco (little endian), bloco (ver colstore.cc), u16 crc16_MODBUS do bloco
+ * Um frame incompleto no fim do arquivo (queda de energia) é detectado pelo tamanho ou pelo CRC.
+ * */
+
+#include "colstore.h"
+#include "../crc/crc.h"
+#include <pthread.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+typedef struct {
+	u8 block[lenCOLSTORE_BLOCK];
+	uint len;
+	uint count;				// Quantidade de amostras no bloco
+} tArchiveBlock;
+
+struct tArchive {
+	int fd;
+	tColEncoder enc;
+	tArchiveBlock queue[ARCHIVE_QUEUE];
+	uint head, tail;		// head: próximo bloco a ser fechado, tail: próximo bloco a ser gravado
+	volatile int active;
+	int stop;
+	uint dropped;			// Amostras descartadas por fila cheia ou erro de gravação
+	pthread_t thread;
+	pthread_mutex_t lock;
+	pthread_cond_t wake;
+};
+
+// #####################################################################################################################
+// AUX
+// #####################################################################################################################
+
+static int WriteAll(tArchive* archive, const u8* data, uint len) {
+	while (len) {
+		ssize_t n = write(archive->fd, data, len);
+		if (n <= 0) return pdFAIL;
+		data += n;
+		len -= n;
+	}
+	return pdPASS;
+}
+
+static int WriteFrame(tArchive* archive, tArchiveBlock* b) {
+	u8 head[4] = { (u8)b->len, (u8)(b->len >> 8), (u8)(b->len >> 16), (u8)(b->len >> 24) };
+	u16 crc = crc16_MODBUS(b->block, b->len);
+	u8 tail[2] = { (u8)crc, (u8)(crc >> 8) };
+
+	if (WriteAll(archive, head, sizeof(head)) == pdFAIL) return pdFAIL;
+	if (WriteAll(archive, b->block, b->len) == pdFAIL) return pdFAIL;
+	return WriteAll(archive, tail, sizeof(tail));
+}
+
+// Fecha o bloco em construção na fila. Chamada com o lock
+static void Close(tArchive* archive) {
+	if (archive->enc.count == 0) return;
+	if (archive->head - archive->tail >= ARCHIVE_QUEUE) {
+		archive->dropped += archive->enc.count;
+		colstore_Reset(&archive->enc);
+		return;
+	}
+
+	tArchiveBlock* b = &archive->queue[archive->head % ARCHIVE_QUEUE];
+	b->count = archive->enc.count;
+	b->len = colstore_Flush(&archive->enc, b->block);
+	archive->head++;
+	pthread_cond_signal(&archive->wake);
+}
+
+// Thread de fundo: grava os blocos fechados no arquivo
+static void* Process(void* params) {
+	tArchive* archive = (tArchive*)params;
+
+	pthread_mutex_lock(&archive->lock);
+	while (1) {
+		if (archive->tail != archive->head) {
+			// a posição só é reaproveitada depois que tail avança, então o bloco pode ser gravado sem o lock
+			tArchiveBlock* b = &archive->queue[archive->tail % ARCHIVE_QUEUE];
+			pthread_mutex_unlock(&archive->lock);
+			int ret = WriteFrame(archive, b);
+			pthread_mutex_lock(&archive->lock);
+			if (ret == pdFAIL) archive->dropped += b->count;
+			archive->tail++;
+			continue;
+		}
+		if (archive->stop) break;
+		pthread_cond_wait(&archive->wake, &archive->lock);
+	}
+	pthread_mutex_unlock(&archive->lock);
+	return NULL;
+}
+
+// #####################################################################################################################
+// FUNCTIONS
+// #####################################################################################################################
+
+// -------------------------------------------------------------------------------------------------------------------
+// FUNÇÃO:		archive_New
+// Retorna:		Arquivo de um painel, parado até o archive_Start, ou NULL se não há memória
+// -------------------------------------------------------------------------------------------------------------------
+tArchive* archive_New(void) {
+	tArchive* archive = (tArchive*)calloc(1, sizeof(tArchive));
+	if (archive) {
+		pthread_mutex_init(&archive->lock, NULL);
+		pthread_cond_init(&archive->wake, NULL);
+	}
+	return archive;
+}
+
+// -------------------------------------------------------------------------------------------------------------------
+// FUNÇÃO:		archive_Free
+// Descrição: 	Fecha o arquivo, se estiver em andamento, e libera a estrutura
+// -------------------------------------------------------------------------------------------------------------------
+void archive_Free(tArchive* archive) {
+	if (!archive) return;
+	archive_Stop(archive);
+	pthread_cond_destroy(&archive->wake);
+	pthread_mutex_destroy(&archive->lock);
+	free(archive);
+}
+
+// -------------------------------------------------------------------------------------------------------------------
+// FUNÇÃO:		archive_Start
+// Descrição: 	Inicia o arquivo comprimido das amostras publicadas. Se o arquivo já existe os blocos são acrescentados no fim
+// Retorna:		pdPASS se o arquivo foi iniciado, pdFAIL se já está arquivando ou não foi possível abrir o arquivo
+// -------------------------------------------------------------------------------------------------------------------
+int archive_Start(tArchive* archive, const char* path) {
+	if (archive->active) return pdFAIL;
+
+	archive->fd = open(path, O_WRONLY | O_CREAT | O_APPEND, 0644);
+	if (archive->fd == -1) return pdFAIL;
+
+	colstore_Reset(&archive->enc);
+	archive->head = archive->tail = 0;
+	archive->dropped = 0;
+	archive->stop = pdFALSE;
+	if (pthread_create(&archive->thread, NULL, Process, (void *) archive)) {
+		close(archive->fd);
+		return pdFAIL;
+	}
+
+	archive->active = pdTRUE;
+	return pdPASS;
+}
+
+// -------------------------------------------------------------------------------------------------------------------
+// FUNÇÃO:		archive_Stop
+// Descrição: 	Fecha o bloco em construção, aguarda a gravação de todos os blocos e fecha o arquivo
+// -------------------------------------------------------------------------------------------------------------------
+void archive_Stop(tArchive* archive) {
+	if (!archive->active) return;
+
+	pthread_mutex_lock(&archive->lock);
+	archive->active = pdFALSE;
+	Close(archive);
+	archive->stop = pdTRUE;
+	pthread_cond_signal(&archive->wake);
+	pthread_mutex_unlock(&archive->lock);
+	pthread_join(archive->thread, NULL);
+
+	fsync(archive->fd);
+	close(archive->fd);
+}
+
+// -------------------------------------------------------------------------------------------------------------------
+// FUNÇÃO:		archive_Dropped
+// Retorna:		Quantidade de amostras descartadas no arquivo atual
+// -------------------------------------------------------------------------------------------------------------------
+uint archive_Dropped(tArchive* archive) {
+	return archive->dropped;
+}
+
+// -------------------------------------------------------------------------------------------------------------------
+// FUNÇÃO:		archive_Append
+// Descrição: 	Chamada pela thread de aquisição a cada amostra publicada. Acrescenta a amostra no bloco em construção
+//				e fecha o bloco na fila quando ele enche
+// -------------------------------------------------------------------------------------------------------------------
+void archive_Append(tArchive* archive, const tSample* sample) {
+	if (!archive->active) return;
+
+	pthread_mutex_lock(&archive->lock);
+	if (archive->active && colstore_Push(&archive->enc, sample) == pdFAIL) {
+		Close(archive);
+		colstore_Push(&archive->enc, sample);
+	}
+	pthread_mutex_unlock(&archive->lock);
+}
+
+// -------------------------------------------------------------------------------------------------------------------
+// FUNÇÃO:		archive_ReadFrame
+// Descrição: 	Lê o próximo frame de um arquivo gerado por archive_Start
+// Parametros:	fd: Arquivo aberto para leitura
+//				block: Buffer com no mínimo lenCOLSTORE_BLOCK bytes
+// Retorna:		Tamanho do bloco lido, 0 no fim do arquivo ou num frame incompleto ou corrompido
+// -------------------------------------------------------------------------------------------------------------------
+uint archive_ReadFrame(int fd, u8* block) {
+	u8 head[4], tail[2];
+	if (read(fd, head, sizeof(head)) != sizeof(head)) return 0;
+
+	uint len = head[0] | (head[1] << 8) | (head[2] << 16) | ((uint)head[3] << 24);
+	if (len == 0 || len > lenCOLSTORE_BLOCK) return 0;
+	if (read(fd, block, len) != (ssize_t)len) return 0;
+	if (read(fd, tail, sizeof(tail)) != sizeof(tail)) return 0;
+	if ((tail[0] | (tail[1] << 8)) != crc16_MODBUS(block, len)) return 0;
+	return len;
+}
@@ -0,0 +1,257 @@
+/* Armazenamento colunar comprimido das amostras dos multímetros
+ *
+ * As amostras são agrupadas em blocos de até COLSTORE_BLOCK amostras, e cada campo da amostra é gravado
+ * numa coluna separada. Como os valores mudam pouco entre uma leitura e outra, cada coluna grava somente
+ * as diferenças, em varint com zig-zag (valores pequenos, positivos ou negativos, ocupam 1 byte):
+ *
+ * 	 time:					delta do delta, a leitura é periódica então sobra somente o jitter
+ * 	 seq:					run-length das diferenças, normalmente uma única sequência de 1
+ * 	 stsCom, relays, douts:	run-length dos valores, mudam raramente
+ * 	 value de cada multímetro:	diferença para a amostra anterior
+ * 	 sts, func e stsCom de cada multímetro: run-length dos três campos juntos (sts | func<<4 | stsCom<<8)
+ *
+ * O codificador é incremental: cada amostra é acrescentada nas colunas assim que chega (O(1) por amostra), e no
+ * fim do bloco as colunas são somente concatenadas.
+ *
+ * Formato do bloco:
+ * 	 'C', COLSTORE_VERSION, varint count, varint nMultimeters,
+ * 	 para cada uma das 5+2*nMultimeters colunas: varint tamanho em bytes, bytes da coluna
+ * O tamanho de cada coluna permite decodificar somente as colunas desejadas.
+ * */
+
+#include "colstore.h"
+#include <string.h>
+
+enum { colTIME = 0, colSEQ, colSTSCOM, colRELAYS, colDOUTS, colMULTIMETERS };
+
+// #####################################################################################################################
+// AUX
+// #####################################################################################################################
+
+static inline u64 ZigZag(s64 v) {
+	return ((u64)v << 1) ^ (u64)(v >> 63);
+}
+
+static inline s64 UnZigZag(u64 v) {
+	return (s64)(v >> 1) ^ -(s64)(v & 1);
+}
+
+static inline uint PutVarint(u8* p, u64 v) {
+	uint n = 0;
+	while (v >= 0x80) {
+		p[n++] = (u8)(v | 0x80);
+		v >>= 7;
+	}
+	p[n++] = (u8)v;
+	return n;
+}
+
+static inline uint GetVarint(const u8* p, const u8* end, u64* v) {
+	uint n = 0, shift = 0;
+	*v = 0;
+	while (p + n < end && shift < 64) {
+		u8 b = p[n++];
+		*v |= (u64)(b & 0x7f) << shift;
+		if (!(b & 0x80)) return n;
+		shift += 7;
+	}
+	return 0; // varint truncado
+}
+
+// Coluna em delta do delta
+static inline void PutDoD(tColumn* c, uint count, s64 v) {
+	if (count == 0) c->len += PutVarint(&c->data[c->len], (u64)v);
+	else {
+		s64 delta = v - c->last;
+		c->len += PutVarint(&c->data[c->len], ZigZag((count == 1) ? delta : delta - c->lastDelta));
+		c->lastDelta = delta;
+	}
+	c->last = v;
+}
+
+// Coluna em diferença para o valor anterior
+static inline void PutDelta(tColumn* c, uint count, s64 v) {
+	c->len += PutVarint(&c->data[c->len], ZigZag((count == 0) ? v : v - c->last));
+	c->last = v;
+}
+
+// Coluna em run-length: pares (tamanho da sequência, valor)
+static inline void FlushRun(tColumn* c) {
+	if (c->runLen == 0) return;
+	c->len += PutVarint(&c->data[c->len], c->runLen);
+	c->len += PutVarint(&c->data[c->len], ZigZag(c->run));
+	c->runLen = 0;
+}
+
+static inline void PutRLE(tColumn* c, s64 v) {
+	if (c->runLen && v == c->run) {
+		c->runLen++;
+		return;
+	}
+	FlushRun(c);
+	c->run = v;
+	c->runLen = 1;
+}
+
+// Lê uma coluna run-length em values
+static int GetRLE(const u8* p, const u8* end, s64* values, uint count) {
+	uint x = 0;
+	while (x < count) {
+		u64 len, v;
+		uint n = GetVarint(p, end, &len);
+		if (!n) return pdFAIL;
+		p += n;
+		if (!(n = GetVarint(p, end, &v))) return pdFAIL;
+		p += n;
+		if (len > count - x) return pdFAIL;
+		while (len--) values[x++] = UnZigZag(v);
+	}
+	return pdPASS;
+}
+
+// #####################################################################################################################
+// FUNCTIONS
+// #####################################################################################################################
+
+// -------------------------------------------------------------------------------------------------------------------
+// FUNÇÃO:		colstore_Reset
+// Descrição: 	Descarta o bloco em construção
+// -------------------------------------------------------------------------------------------------------------------
+void colstore_Reset(tColEncoder* enc) {
+	int x; for (x=0; x<nCOLSTORE_COLUMNS; x++) {
+		enc->column[x].len = 0;
+		enc->column[x].runLen = 0;
+	}
+	enc->count = 0;
+	enc->nMultimeters = 0;
+}
+
+// -------------------------------------------------------------------------------------------------------------------
+// FUNÇÃO:		colstore_Push
+// Descrição: 	Acrescenta uma amostra no bloco em construção
+// Retorna:		pdPASS se a amostra foi acrescentada
+//				pdFAIL se o bloco está cheio ou a amostra tem outra quantidade de multímetros, neste caso
+//					chamar colstore_Flush e acrescentar novamente
+// -------------------------------------------------------------------------------------------------------------------
+int colstore_Push(tColEncoder* enc, const tSample* sample) {
+	if (enc->count >= COLSTORE_BLOCK) return pdFAIL;
+	if (enc->count == 0) enc->nMultimeters = sample->nMultimeters;
+	else if (enc->nMultimeters != sample->nMultimeters) return pdFAIL;
+
+	tColumn* c = enc->column;
+	PutDoD(&c[colTIME], enc->count, (s64)sample->time);
+	PutRLE(&c[colSEQ], (enc->count == 0) ? sample->seq : (s64)sample->seq - c[colSEQ].last);
+	c[colSEQ].last = sample->seq;
+	PutRLE(&c[colSTSCOM], sample->stsCom);
+	PutRLE(&c[colRELAYS], sample->relays);
+	PutRLE(&c[colDOUTS], sample->douts);
+
+	uint x; for (x=0; x<enc->nMultimeters; x++) {
+		const tMultimeter* m = &sample->multimeter[x];
+		PutDelta(&c[colMULTIMETERS + 2*x], enc->count, m->value);
+		PutRLE(&c[colMULTIMETERS + 2*x + 1], (m->sts & 0xf) | ((m->func & 1) << 4) | ((m->stsCom & 0xff) << 8));
+	}
+
+	enc->count++;
+	return pdPASS;
+}
+
+// -------------------------------------------------------------------------------------------------------------------
+// FUNÇÃO:		colstore_Flush
+// Descrição: 	Fecha o bloco em construção em block e inicia um novo bloco
+// Parametros:	block: Buffer de saída com no mínimo lenCOLSTORE_BLOCK bytes
+// Retorna:		Tamanho do bloco em bytes, 0 se o bloco estava vazio
+// -------------------------------------------------------------------------------------------------------------------
+uint colstore_Flush(tColEncoder* enc, u8* block) {
+	if (enc->count == 0) return 0;
+
+	uint len = 0;
+	block[len++] = 'C';
+	block[len++] = COLSTORE_VERSION;
+	len += PutVarint(&block[len], enc->count);
+	len += PutVarint(&block[len], enc->nMultimeters);
+
+	uint x, nColumns = colMULTIMETERS + 2*enc->nMultimeters;
+	for (x=0; x<nColumns; x++) {
+		tColumn* c = &enc->column[x];
+		if (x != colTIME && (x < colMULTIMETERS || (x & 1) == 0)) FlushRun(c); // colunas em run-length
+		len += PutVarint(&block[len], c->len);
+		memcpy(&block[len], c->data, c->len);
+		len += c->len;
+	}
+
+	colstore_Reset(enc);
+	return len;
+}
+
+// -------------------------------------------------------------------------------------------------------------------
+// FUNÇÃO:		colstore_Decode
+// Descrição: 	Decodifica um bloco
+// Parametros:	block, len: Bloco gerado por colstore_Flush
+//				samples: Buffer de saída
+//				max: Tamanho do buffer de saída
+// Retorna:		Quantidade de amostras decodificadas, ou pdFAIL (0) se o bloco é inválido ou não cabe em samples
+// -------------------------------------------------------------------------------------------------------------------
+int colstore_Decode(const u8* block, uint len, tSample* samples, uint max) {
+	s64 values[COLSTORE_BLOCK];
+	const u8* p = block;
+	const u8* end = block + len;
+	u64 count, nMultimeters, v;
+	uint n, x, k;
+
+	if (len < 4 || p[0] != 'C' || p[1] != COLSTORE_VERSION) return pdFAIL;
+	p += 2;
+	if (!(n = GetVarint(p, end, &count))) return pdFAIL;
+	p += n;
+	if (!(n = GetVarint(p, end, &nMultimeters))) return pdFAIL;
+	p += n;
+	if (count > max || count > COLSTORE_BLOCK || nMultimeters > nMULTIMETER) return pdFAIL;
+
+	uint nColumns = colMULTIMETERS + 2*nMultimeters;
+	for (x=0; x<nColumns; x++) {
+		u64 clen;
+		if (!(n = GetVarint(p, end, &clen))) return pdFAIL;
+		p += n;
+		if (clen > (u64)(end - p)) return pdFAIL;
+		const u8* cend = p + clen;
+
+		if (x == colTIME || (x >= colMULTIMETERS && (x & 1))) {
+			// colunas em diferença (valores dos multímetros) e delta do delta (tempo)
+			s64 last = 0, delta = 0;
+			for (k=0; k<count; k++) {
+				if (!(n = GetVarint(p, cend, &v))) return pdFAIL;
+				p += n;
+				if (x == colTIME) {
+					if (k == 0) last = (s64)v;
+					else {
+						delta = (k == 1) ? UnZigZag(v) : delta + UnZigZag(v);
+						last += delta;
+					}
+					samples[k].time = (u64)last;
+				} else {
+					last = (k == 0) ? UnZigZag(v) : last + UnZigZag(v);
+					samples[k].multimeter[(x - colMULTIMETERS) / 2].value = (int)last;
+				}
+			}
+		} else {
+			if (GetRLE(p, cend, values, count) == pdFAIL) return pdFAIL;
+			s64 seq = 0;
+			for (k=0; k<count; k++) {
+				if (x == colSEQ) samples[k].seq = (uint)(seq += values[k]);
+				else if (x == colSTSCOM) samples[k].stsCom = (int)values[k];
+				else if (x == colRELAYS) samples[k].relays = (uint)values[k];
+				else if (x == colDOUTS) samples[k].douts = (uint)values[k];
+				else {
+					tMultimeter* m = &samples[k].multimeter[(x - colMULTIMETERS) / 2];
+					m->sts = values[k] & 0xf;
+					m->func = (values[k] >> 4) & 1;
+					m->stsCom = (values[k] >> 8) & 0xff;
+				}
+			}
+		}
+		p = cend;
+	}
+
+	for (k=0; k<count; k++) samples[k].nMultimeters = nMultimeters;
+	return count;
+}
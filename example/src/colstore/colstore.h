@@ -0,0 +1,44 @@
+#ifndef COLSTORE_H
+#define COLSTORE_H
+
+#include "../_config_cpu_.h"
+#include "../app.h"
+
+// Armazenamento colunar comprimido das amostras, ver colstore.cc
+#define COLSTORE_VERSION	1
+#define COLSTORE_BLOCK		256		// Quantidade máxima de amostras por bloco
+#define nCOLSTORE_COLUMNS	(5 + 2*nMULTIMETER)
+#define lenCOLSTORE_COLUMN	(COLSTORE_BLOCK*10) // pior caso: todos os valores com varint de 10 bytes
+#define lenCOLSTORE_BLOCK	(16 + nCOLSTORE_COLUMNS*(5 + lenCOLSTORE_COLUMN)) // pior caso de um bloco codificado
+#define ARCHIVE_QUEUE		4		// Blocos fechados aguardando a gravação no arquivo, ver archive.cc
+
+typedef struct {
+	u8 data[lenCOLSTORE_COLUMN];
+	uint len;
+	s64 last;			// Último valor da coluna
+	s64 lastDelta;		// Última diferença, usada no delta do delta
+	s64 run;			// Valor da sequência atual do run-length
+	uint runLen;		// Tamanho da sequência atual do run-length
+} tColumn;
+
+typedef struct {
+	tColumn column[nCOLSTORE_COLUMNS];
+	uint count;				// Quantidade de amostras no bloco em construção
+	uint nMultimeters;		// Quantidade de multímetros das amostras do bloco
+} tColEncoder;
+
+void colstore_Reset(tColEncoder* enc);
+int colstore_Push(tColEncoder* enc, const tSample* sample);
+uint colstore_Flush(tColEncoder* enc, u8* block);
+int colstore_Decode(const u8* block, uint len, tSample* samples, uint max);
+
+// Arquivo de um painel, os campos ficam em archive.cc
+tArchive* archive_New(void);
+void archive_Free(tArchive* archive);
+int archive_Start(tArchive* archive, const char* path);
+void archive_Stop(tArchive* archive);
+uint archive_Dropped(tArchive* archive);
+void archive_Append(tArchive* archive, const tSample* sample);
+uint archive_ReadFrame(int fd, u8* block);
+
+#endif
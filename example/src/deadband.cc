@@ -0,0 +1,125 @@
+#include "_config_cpu_.h"
+#include "app.h"
+#include <pthread.h>
+#include <math.h>
+#include <stdlib.h>
+
+// Detecção de mudança dos multímetros por banda morta
+//	A thread modbus_Process compara cada leitura com o último valor reportado do multímetro. O multímetro só é
+//	considerado alterado quando o valor sai da banda morta (absoluta ou relativa ao valor reportado), ou quando
+//	muda o status, a função ou o status de comunicação. Nesse caso a leitura passa a ser o valor reportado e
+//	recebe a sequência da amostra.
+//	Os clientes pedem somente os multímetros alterados após a última sequência que já receberam, assim num circuito
+//	parado a resposta fica vazia independente da quantidade de clientes.
+
+typedef struct {
+	tDeadbandMode mode;
+	double band;			// Banda morta, 0 reporta qualquer alteração
+	uint seq;				// Sequência da última alteração, 0 se ainda não foi reportado
+	tMultimeter reported;	// Última leitura reportada
+} tChannelBand;
+
+struct tDeadband {
+	tChannelBand channels[nMULTIMETER];
+	uint nChannels;
+	uint seq;				// Sequência da última amostra avaliada
+	pthread_mutex_t lock;
+};
+
+static int Changed(const tChannelBand* ch, const tMultimeter* m) {
+	if (ch->seq == 0) return pdTRUE;
+	if (m->sts != ch->reported.sts || m->func != ch->reported.func || m->stsCom != ch->reported.stsCom) return pdTRUE;
+
+	double diff = fabs((double)m->value - ch->reported.value);
+	if (ch->mode == deadbandRELATIVE) return diff > ch->band * fabs((double)ch->reported.value) / 100.0;
+	return diff > ch->band;
+}
+
+// -------------------------------------------------------------------------------------------------------------------
+// FUNÇÃO:		deadband_New
+// Retorna:		Bandas mortas de um painel, todas absolutas com banda 0, ou NULL se não há memória
+// -------------------------------------------------------------------------------------------------------------------
+tDeadband* deadband_New(void) {
+	tDeadband* deadband = (tDeadband*)calloc(1, sizeof(tDeadband));
+	if (deadband) pthread_mutex_init(&deadband->lock, NULL);
+	return deadband;
+}
+
+// -------------------------------------------------------------------------------------------------------------------
+// FUNÇÃO:		deadband_Free
+// -------------------------------------------------------------------------------------------------------------------
+void deadband_Free(tDeadband* deadband) {
+	if (!deadband) return;
+	pthread_mutex_destroy(&deadband->lock);
+	free(deadband);
+}
+
+// -------------------------------------------------------------------------------------------------------------------
+// FUNÇÃO:		deadband_Push
+// Descrição: 	Avalia a banda morta de todos os multímetros de uma amostra
+// -------------------------------------------------------------------------------------------------------------------
+void deadband_Push(tDeadband* deadband, const tSample* sample) {
+	uint x;
+
+	pthread_mutex_lock(&deadband->lock);
+	for (x=0; x<sample->nMultimeters; x++) {
+		tChannelBand* ch = &deadband->channels[x];
+		if (!Changed(ch, &sample->multimeter[x])) continue;
+		ch->reported = sample->multimeter[x];
+		ch->seq = sample->seq;
+	}
+	deadband->nChannels = sample->nMultimeters;
+	deadband->seq = sample->seq;
+	pthread_mutex_unlock(&deadband->lock);
+}
+
+// -------------------------------------------------------------------------------------------------------------------
+// FUNÇÃO:		deadband_Set
+// Descrição: 	Configura a banda morta de um multímetro. O novo valor vale a partir da próxima amostra, comparado
+//				com o último valor reportado
+// Parametros:	channel: Índice do multímetro, ou -1 para todos
+//				mode: Banda absoluta ou relativa
+//				band: Banda morta, 0 reporta qualquer alteração
+// Retorna:		pdPASS se configurado, pdFAIL se os parâmetros são inválidos
+// -------------------------------------------------------------------------------------------------------------------
+int deadband_Set(tDeadband* deadband, int channel, tDeadbandMode mode, double band) {
+	if (channel < -1 || channel >= nMULTIMETER || band < 0) return pdFAIL;
+	if (mode != deadbandABSOLUTE && mode != deadbandRELATIVE) return pdFAIL;
+
+	pthread_mutex_lock(&deadband->lock);
+	int x; for (x=0; x<nMULTIMETER; x++) {
+		if (channel != -1 && channel != x) continue;
+		deadband->channels[x].mode = mode;
+		deadband->channels[x].band = band;
+	}
+	pthread_mutex_unlock(&deadband->lock);
+	return pdPASS;
+}
+
+// -------------------------------------------------------------------------------------------------------------------
+// FUNÇÃO:		deadband_Changes
+// Descrição: 	Lê os multímetros que saíram da banda morta após a sequência since
+// Parametros:	since: Sequência da última amostra já recebida pelo cliente, 0 para todos os multímetros.
+//					Uma sequência maior que a última avaliada (sessão reiniciada) também retorna todos
+//				out: Buffer para nMULTIMETER alterações
+//				last: Retorna a sequência da última amostra avaliada, a ser usada como since na próxima consulta
+// Retorna:		Quantidade de alterações em out
+// -------------------------------------------------------------------------------------------------------------------
+int deadband_Changes(tDeadband* deadband, uint since, tChange* out, uint* last) {
+	int n = 0;
+	uint x;
+
+	pthread_mutex_lock(&deadband->lock);
+	if (since > deadband->seq) since = 0;
+	for (x=0; x<deadband->nChannels; x++) {
+		if (deadband->channels[x].seq == 0 || deadband->channels[x].seq <= since) continue;
+		out[n].channel = x;
+		out[n].seq = deadband->channels[x].seq;
+		out[n].multimeter = deadband->channels[x].reported;
+		n++;
+	}
+	*last = deadband->seq;
+	pthread_mutex_unlock(&deadband->lock);
+
+	return n;
+}
@@ -0,0 +1,110 @@
+#include "_config_cpu_.h"
+#include "app.h"
+#include <pthread.h>
+#include <stdlib.h>
+
+// Aviso de amostra publicada para os loops de eventos do node
+//	A thread modbus_Process chama events_Publish a cada amostra publicada. O aviso só é repassado a cada ouvinte
+//	(função notify, no addon uma napi_threadsafe_function) se o aviso anterior a ele já foi entregue, então uma rajada
+//	de amostras gera uma única chamada no JS, que recebe a última amostra publicada e pode pedir as anteriores
+//	ao histórico. Cada objeto Panel inscrito, inclusive em worker_threads diferentes, é um ouvinte identificado pelo
+//	seu context. events_Stop garante que notify não é mais chamada, assim o addon pode liberar a função.
+
+#define nEVENTS_LISTENERS 16
+
+typedef struct {
+	tEventsNotify notify;	// NULL se a posição está livre
+	void* context;			// Passado para notify, identifica o ouvinte
+	int pending;			// Aviso enviado e ainda não entregue ao JS
+} tListener;
+
+struct tEvents {
+	tListener listeners[nEVENTS_LISTENERS];
+	pthread_mutex_t lock;
+};
+
+// Retorna o ouvinte de context, ou NULL. Deve ser chamada com o lock adquirido
+static tListener* Find(tEvents* events, void* context) {
+	int x; for (x=0; x<nEVENTS_LISTENERS; x++)
+		if (events->listeners[x].notify && events->listeners[x].context == context) return &events->listeners[x];
+	return NULL;
+}
+
+// -------------------------------------------------------------------------------------------------------------------
+// FUNÇÃO:		events_New
+// Retorna:		Avisos de um painel, sem ouvintes até o events_Start, ou NULL se não há memória
+// -------------------------------------------------------------------------------------------------------------------
+tEvents* events_New(void) {
+	tEvents* events = (tEvents*)calloc(1, sizeof(tEvents));
+	if (events) pthread_mutex_init(&events->lock, NULL);
+	return events;
+}
+
+// -------------------------------------------------------------------------------------------------------------------
+// FUNÇÃO:		events_Free
+// -------------------------------------------------------------------------------------------------------------------
+void events_Free(tEvents* events) {
+	if (!events) return;
+	pthread_mutex_destroy(&events->lock);
+	free(events);
+}
+
+// -------------------------------------------------------------------------------------------------------------------
+// FUNÇÃO:		events_Start
+// Descrição: 	Inicia os avisos para um ouvinte
+// Parametros:	n: Função chamada pela thread modbus_Process para acordar o loop de eventos do node
+//				context: Passado para n, identifica o ouvinte no events_Stop e events_Delivered
+// Retorna:		pdPASS se o ouvinte foi registrado, pdFAIL se não há mais posições livres
+// -------------------------------------------------------------------------------------------------------------------
+int events_Start(tEvents* events, tEventsNotify n, void* context) {
+	pthread_mutex_lock(&events->lock);
+	tListener* l = Find(events, context);
+	int x; for (x=0; !l && x<nEVENTS_LISTENERS; x++)
+		if (!events->listeners[x].notify) l = &events->listeners[x];
+	if (l) {
+		l->notify = n;
+		l->context = context;
+		l->pending = pdFALSE;
+	}
+	pthread_mutex_unlock(&events->lock);
+	return (l) ? pdPASS : pdFAIL;
+}
+
+// -------------------------------------------------------------------------------------------------------------------
+// FUNÇÃO:		events_Stop
+// Descrição: 	Encerra os avisos para o ouvinte context. Após o retorno a sua notify não é mais chamada
+// -------------------------------------------------------------------------------------------------------------------
+void events_Stop(tEvents* events, void* context) {
+	pthread_mutex_lock(&events->lock);
+	tListener* l = Find(events, context);
+	if (l) l->notify = NULL;
+	pthread_mutex_unlock(&events->lock);
+}
+
+// -------------------------------------------------------------------------------------------------------------------
+// FUNÇÃO:		events_Delivered
+// Descrição: 	Chamada na thread do node antes de ler a última amostra, as amostras publicadas a partir daqui geram um
+//				novo aviso para o ouvinte context
+// -------------------------------------------------------------------------------------------------------------------
+void events_Delivered(tEvents* events, void* context) {
+	pthread_mutex_lock(&events->lock);
+	tListener* l = Find(events, context);
+	if (l) l->pending = pdFALSE;
+	pthread_mutex_unlock(&events->lock);
+}
+
+// -------------------------------------------------------------------------------------------------------------------
+// FUNÇÃO:		events_Publish
+// Descrição: 	Avisa os loops de eventos do node que uma nova amostra foi publicada. Chamada pela thread modbus_Process
+// -------------------------------------------------------------------------------------------------------------------
+void events_Publish(tEvents* events) {
+	pthread_mutex_lock(&events->lock);
+	int x; for (x=0; x<nEVENTS_LISTENERS; x++) {
+		tListener* l = &events->listeners[x];
+		if (l->notify && !l->pending) {
+			l->pending = pdTRUE;
+			l->notify(l->context);
+		}
+	}
+	pthread_mutex_unlock(&events->lock);
+}
@@ -0,0 +1,108 @@
+#include "_config_cpu_.h"
+#include "app.h"
+#include <stdlib.h>
+
+// Histórico das amostras dos multímetros
+//	Buffer circular de tamanho fixo preenchido pela thread modbus_Process a cada leitura publicada.
+//	Os clientes pedem todas as amostras após a última sequência que já receberam (o seu cursor), assim cada um
+//	consome no seu ritmo sem perder as leituras feitas entre as consultas.
+//	O buffer não usa lock: há um único escritor, a thread modbus_Process, que nunca espera pelos leitores.
+//	Cada posição guarda a sequência da amostra que contém, zerada durante a escrita. O leitor confere a sequência
+//	antes e depois da cópia, se mudou o escritor já deu a volta no buffer e a amostra é contada como perdida.
+//	A quantidade de leitores não altera o trabalho do escritor.
+
+typedef struct {
+	uint seq;				// Sequência da amostra em sample, 0 durante a escrita
+	tSample sample;
+} tSlot;
+
+struct tHistory {
+	tSlot slots[nHISTORY];
+	uint last;				// Sequência da última amostra publicada
+};
+
+// Copia a amostra seq em out
+// Retorna pdFAIL se a amostra já foi sobrescrita, ou se está sendo sobrescrita durante a cópia
+static int Copy(tHistory* history, uint seq, tSample* out) {
+	tSlot* slot = &history->slots[seq % nHISTORY];
+	if (__atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE) != seq) return pdFAIL;
+	*out = slot->sample;
+	__atomic_thread_fence(__ATOMIC_ACQUIRE); // a cópia deve terminar antes da nova leitura da sequência
+	return (__atomic_load_n(&slot->seq, __ATOMIC_RELAXED) == seq) ? pdPASS : pdFAIL;
+}
+
+// Sequência da amostra mais antiga que ainda pode estar no buffer
+static uint First(uint last) {
+	return (last >= nHISTORY) ? last - nHISTORY + 1 : 1;
+}
+
+// -------------------------------------------------------------------------------------------------------------------
+// FUNÇÃO:		history_New
+// Retorna:		Histórico vazio de um painel, ou NULL se não há memória
+// -------------------------------------------------------------------------------------------------------------------
+tHistory* history_New(void) {
+	return (tHistory*)calloc(1, sizeof(tHistory));
+}
+
+// -------------------------------------------------------------------------------------------------------------------
+// FUNÇÃO:		history_Free
+// -------------------------------------------------------------------------------------------------------------------
+void history_Free(tHistory* history) {
+	free(history);
+}
+
+// -------------------------------------------------------------------------------------------------------------------
+// FUNÇÃO:		history_Push
+// Descrição: 	Adiciona uma amostra no histórico, sobrescrevendo a mais antiga quando o buffer estiver cheio.
+//				As amostras devem ser adicionadas com sequência crescente de 1 em 1. Somente a thread modbus_Process escreve
+// -------------------------------------------------------------------------------------------------------------------
+void history_Push(tHistory* history, const tSample* sample) {
+	tSlot* slot = &history->slots[sample->seq % nHISTORY];
+	__atomic_store_n(&slot->seq, 0, __ATOMIC_RELAXED);
+	__atomic_thread_fence(__ATOMIC_RELEASE); // os leitores devem ver a sequência zerada antes dos novos dados
+	slot->sample = *sample;
+	__atomic_store_n(&slot->seq, sample->seq, __ATOMIC_RELEASE);
+	__atomic_store_n(&history->last, sample->seq, __ATOMIC_RELEASE);
+}
+
+// -------------------------------------------------------------------------------------------------------------------
+// FUNÇÃO:		history_Read
+// Descrição: 	Copia as amostras com sequência maior que since, da mais antiga para a mais recente
+// Parametros:	since: Última sequência já recebida pelo cliente, 0 para receber todo o histórico
+//				samples: Buffer onde as amostras serão copiadas
+//				max: Quantidade máxima de amostras a serem copiadas
+//				lost: Retorna quantas amostras após since já foram sobrescritas e não podem mais ser lidas, pode ser NULL
+// Retorna:		Quantidade de amostras copiadas. Para ler todo o histórico chamar novamente com a sequência
+//				da última amostra copiada até que retorne 0
+// -------------------------------------------------------------------------------------------------------------------
+int history_Read(tHistory* history, uint since, tSample* samples, int max, uint* lost) {
+	uint last = __atomic_load_n(&history->last, __ATOMIC_ACQUIRE);
+	uint missed = 0;
+	int n = 0;
+
+	if (since > last) since = First(last) - 1;	// sequência de uma sessão anterior, reenvia o histórico disponível
+	while (n < max && since != last) {
+		since++;
+		if (Copy(history, since, &samples[n]) == pdPASS) {
+			n++;
+			continue;
+		}
+		// o escritor passou o leitor: pula para a amostra mais antiga ainda disponível
+		uint first = First(__atomic_load_n(&history->last, __ATOMIC_ACQUIRE));
+		if (first > since) {
+			missed += first - since;
+			since = first - 1;
+		} else missed++;
+	}
+
+	if (lost) *lost = missed;
+	return n;
+}
+
+// -------------------------------------------------------------------------------------------------------------------
+// FUNÇÃO:		history_Last
+// Retorna:		Sequência da última amostra publicada, 0 se nenhuma amostra foi publicada
+// -------------------------------------------------------------------------------------------------------------------
+uint history_Last(tHistory* history) {
+	return __atomic_load_n(&history->last, __ATOMIC_ACQUIRE);
+}
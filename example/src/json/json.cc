@@ -0,0 +1,129 @@
+/* Escritor de json sem alocação em regime
+ *
+ * O texto é escrito num buffer que pertence ao tJson e é mantido entre as chamadas, somente json_Reset é
+ * chamado a cada nova resposta. O buffer só cresce (realloc) até o tamanho da maior resposta, depois disso
+ * nenhuma alocação é feita. Os inteiros são formatados de dois em dois dígitos por tabela, sem sprintf.
+ * */
+
+#include "json.h"
+#include <stdlib.h>
+#include <string.h>
+
+static const char digits[201] =
+	"00010203040506070809"
+	"10111213141516171819"
+	"20212223242526272829"
+	"30313233343536373839"
+	"40414243444546474849"
+	"50515253545556575859"
+	"60616263646566676869"
+	"70717273747576777879"
+	"80818283848586878889"
+	"90919293949596979899";
+
+// #####################################################################################################################
+// AUX
+// #####################################################################################################################
+
+// Garante espaço para mais n caracteres e o terminador
+static int Reserve(tJson* j, uint n) {
+	if (j->len + n + 1 <= j->size) return pdPASS;
+	if (j->overflow) return pdFAIL;
+
+	uint size = j->size ? j->size : 256;
+	while (size < j->len + n + 1) size *= 2;
+	char* buf = (char*)realloc(j->buf, size);
+	if (!buf) {
+		j->overflow = pdTRUE;
+		return pdFAIL;
+	}
+	j->buf = buf;
+	j->size = size;
+	return pdPASS;
+}
+
+// #####################################################################################################################
+// FUNCTIONS
+// #####################################################################################################################
+
+// -------------------------------------------------------------------------------------------------------------------
+// FUNÇÃO:		json_Reset
+// Descrição: 	Inicia uma nova resposta mantendo o buffer já alocado
+// -------------------------------------------------------------------------------------------------------------------
+void json_Reset(tJson* j) {
+	j->len = 0;
+	j->overflow = pdFALSE;
+	if (Reserve(j, 0) == pdPASS) j->buf[0] = 0;
+}
+
+// -------------------------------------------------------------------------------------------------------------------
+// FUNÇÃO:		json_Free
+// Descrição: 	Libera o buffer
+// -------------------------------------------------------------------------------------------------------------------
+void json_Free(tJson* j) {
+	free(j->buf);
+	j->buf = (char*)NULL;
+	j->len = j->size = 0;
+}
+
+// -------------------------------------------------------------------------------------------------------------------
+// FUNÇÃO:		json_Raw
+// Descrição: 	Escreve len caracteres sem escape
+// -------------------------------------------------------------------------------------------------------------------
+void json_Raw(tJson* j, const char* s, uint len) {
+	if (Reserve(j, len) == pdFAIL) return;
+	memcpy(&j->buf[j->len], s, len);
+	j->len += len;
+	j->buf[j->len] = 0;
+}
+
+// -------------------------------------------------------------------------------------------------------------------
+// FUNÇÃO:		json_Str
+// Descrição: 	Escreve uma string terminada em zero sem escape, usada para as chaves e a pontuação do json
+// -------------------------------------------------------------------------------------------------------------------
+void json_Str(tJson* j, const char* s) {
+	json_Raw(j, s, strlen(s));
+}
+
+// -------------------------------------------------------------------------------------------------------------------
+// FUNÇÃO:		json_Char
+// -------------------------------------------------------------------------------------------------------------------
+void json_Char(tJson* j, char c) {
+	if (Reserve(j, 1) == pdFAIL) return;
+	j->buf[j->len++] = c;
+	j->buf[j->len] = 0;
+}
+
+// -------------------------------------------------------------------------------------------------------------------
+// FUNÇÃO:		json_Uint
+// Descrição: 	Escreve um inteiro sem sinal em decimal
+// -------------------------------------------------------------------------------------------------------------------
+void json_Uint(tJson* j, u64 value) {
+	char tmp[20];
+	char* p = &tmp[sizeof(tmp)];
+
+	while (value >= 100) {
+		uint d = (uint)(value % 100) * 2;
+		value /= 100;
+		*--p = digits[d + 1];
+		*--p = digits[d];
+	}
+	if (value >= 10) {
+		uint d = (uint)value * 2;
+		*--p = digits[d + 1];
+		*--p = digits[d];
+	} else *--p = (char)('0' + value);
+
+	json_Raw(j, p, &tmp[sizeof(tmp)] - p);
+}
+
+// -------------------------------------------------------------------------------------------------------------------
+// FUNÇÃO:		json_Int
+// Descrição: 	Escreve um inteiro com sinal em decimal
+// -------------------------------------------------------------------------------------------------------------------
+void json_Int(tJson* j, s64 value) {
+	if (value < 0) {
+		json_Char(j, '-');
+		json_Uint(j, (u64)0 - (u64)value);
+	} else json_Uint(j, (u64)value);
+}
@@ -0,0 +1,22 @@
+#ifndef JSON_H
+#define JSON_H
+
+#include "../_config_cpu_.h"
+
+// Escritor de json num buffer reaproveitado entre as chamadas, ver json.cc
+typedef struct {
+	char* buf;
+	uint len;				// Quantidade de caracteres escritos, sem o terminador
+	uint size;				// Tamanho alocado de buf
+	int overflow;			// pdTRUE se não foi possível aumentar o buffer, o conteúdo está truncado
+} tJson;
+
+void json_Reset(tJson* j);
+void json_Free(tJson* j);
+void json_Raw(tJson* j, const char* s, uint len);
+void json_Str(tJson* j, const char* s);
+void json_Char(tJson* j, char c);
+void json_Int(tJson* j, s64 value);
+void json_Uint(tJson* j, u64 value);
+
+#endif
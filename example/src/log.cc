@@ -0,0 +1,358 @@
+#include "timer/timer.h"
+#include "_config_cpu_.h"
+#include "app.h"
+#include <pthread.h>
+#include <stdarg.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <time.h>
+#include <unistd.h>
+
+// Log assíncrono com níveis por categoria
+//	A macro LOG só chama log_Write se o nível da categoria está habilitado, o teste é uma leitura de memória, assim as
+//	mensagens desabilitadas não custam nada nas threads de aquisição. log_Write não formata a mensagem: copia o
+//	formato (um literal), os argumentos e as strings para o buffer circular da thread que chamou e retorna, sem lock e
+//	sem chamadas de sistema. Cada thread tem o seu buffer, com um único escritor, e a thread de fundo é a única leitora.
+//	Se o buffer da thread está cheio a mensagem é descartada e contada, quem loga nunca espera pela saída.
+//	A thread de fundo acorda a cada LOG_FLUSH_PERIOD ms, formata as mensagens na ordem em que foram escritas, mesmo
+//	entre threads diferentes, e as escreve no stdout. Os níveis podem ser alterados pelo JS a qualquer instante.
+//	Os argumentos aceitos são os do printf sem * na largura ou precisão, até LOG_ARGS por mensagem.
+
+#define LOG_ARGS				8			// Argumentos por mensagem, os excedentes não são impressos
+#define LOG_TEXT				96			// Bytes para as strings (%s) de uma mensagem, as maiores são truncadas
+#define LOG_RING				256			// Mensagens no buffer de cada thread, potência de 2
+#define LOG_THREADS				32			// Threads que podem logar ao mesmo tempo
+#define LOG_FLUSH_PERIOD		50			// Período em ms que a thread de fundo escreve as mensagens
+
+typedef enum {
+	argNONE = 0,
+	argINT,
+	argLONG,
+	argLLONG,
+	argSIZE,
+	argDOUBLE,
+	argSTRING,
+	argPOINTER
+} tArgType;
+
+typedef union {
+	long long i;
+	double d;
+	uint offset;			// Posição da string em text
+	const void* p;
+} tArg;
+
+typedef struct {
+	u64 time;				// Instante em us desde epoch
+	const char* fmt;
+	u8 level;
+	u8 category;
+	u8 nArgs;
+	tArg args[LOG_ARGS];
+	char text[LOG_TEXT];
+} tLogRecord;
+
+typedef struct {
+	tLogRecord records[LOG_RING];
+	uint head;				// Próxima mensagem a ser escrita, somente a thread dona altera
+	uint tail;				// Próxima mensagem a ser formatada, somente a thread de fundo altera
+	int used;				// Sinaliza que o buffer pertence a uma thread, liberado quando a thread termina
+} tLogRing;
+
+int logLevels[nLOG_CATEGORIES] = { logINFO, logINFO, logINFO };
+
+static const char* levels[] = { "OFF", "ERROR", "WARN", "INFO", "DEBUG", "TRACE" };
+static const char* categories[] = { "session", "modbus", "samples" };
+
+static tLogRing* rings[LOG_THREADS];
+static __thread tLogRing* ring;		// Buffer da thread que chama log_Write
+static uint dropped;				// Mensagens descartadas por buffer cheio ou por falta de buffer
+static pthread_key_t ringKey;
+static pthread_once_t once = PTHREAD_ONCE_INIT;
+static pthread_mutex_t ringsLock = PTHREAD_MUTEX_INITIALIZER;	// Registro dos buffers das threads
+static pthread_mutex_t sinkLock = PTHREAD_MUTEX_INITIALIZER;	// Serializa a thread de fundo e o log_Flush
+
+// #####################################################################################################################
+// AUX
+// #####################################################################################################################
+
+// Lê uma especificação de conversão do printf a partir do caractere após o %
+// Retorna o ponteiro para o caractere de conversão, e em type o tipo do argumento (argNONE para %% ou não suportada)
+static const char* Spec(const char* p, tArgType* type) {
+	int length = 0;		// 1 l, 2 ll, 3 z/j/t, -1 L
+
+	*type = argNONE;
+	while (*p && strchr("-+ #0'", *p)) p++;
+	while (*p >= '0' && *p <= '9') p++;
+	if (*p == '.') {
+		p++;
+		while (*p >= '0' && *p <= '9') p++;
+	}
+	for (;; p++) {
+		if (*p == 'h') continue;
+		else if (*p == 'l') length++;
+		else if (*p == 'z' || *p == 'j' || *p == 't') length = 3;
+		else if (*p == 'L') length = -1;
+		else break;
+	}
+
+	switch (*p) {
+	case 'd': case 'i': case 'u': case 'o': case 'x': case 'X': case 'c':
+		*type = (length == 1) ? argLONG : (length == 2) ? argLLONG : (length == 3) ? argSIZE : argINT;
+		break;
+	case 'f': case 'F': case 'e': case 'E': case 'g': case 'G': case 'a': case 'A':
+		if (length != -1) *type = argDOUBLE;
+		break;
+	case 's': *type = argSTRING; break;
+	case 'p': *type = argPOINTER; break;
+	}
+	return p;
+}
+
+static void ReleaseRing(void* r) {
+	__atomic_store_n(&((tLogRing*)r)->used, pdFALSE, __ATOMIC_RELEASE);
+}
+
+static void Init(void) {
+	pthread_key_create(&ringKey, ReleaseRing);
+}
+
+// Buffer da thread atual. Reaproveita o buffer de uma thread que terminou depois que todas as suas mensagens
+// foram escritas. Retorna NULL se todos os buffers estão em uso ou não há memória
+static tLogRing* Ring(void) {
+	if (ring) return ring;
+
+	pthread_once(&once, Init);
+	pthread_mutex_lock(&ringsLock);
+	int x; for (x=0; x<LOG_THREADS && !ring; x++) {
+		tLogRing* r = rings[x];
+		if (!r) {
+			r = (tLogRing*)calloc(1, sizeof(tLogRing));
+			if (!r) break;
+			__atomic_store_n(&rings[x], r, __ATOMIC_RELEASE);
+		} else if (__atomic_load_n(&r->used, __ATOMIC_ACQUIRE) || __atomic_load_n(&r->tail, __ATOMIC_ACQUIRE) != r->head) continue;
+		r->used = pdTRUE;
+		ring = r;
+	}
+	pthread_mutex_unlock(&ringsLock);
+
+	if (ring) pthread_setspecific(ringKey, ring);
+	return ring;
+}
+
+// Formata a mensagem em out, no máximo size bytes
+static void Format(const tLogRecord* r, char* out, size_t size) {
+	char spec[32];
+	size_t n = 0;
+	uint arg = 0;
+	const char* p = r->fmt;
+
+	while (*p && n + 1 < size) {
+		if (*p != '%') {
+			out[n++] = *p++;
+			continue;
+		}
+
+		tArgType type;
+		const char* end = Spec(p + 1, &type);
+		size_t len = end - p + 1;
+		if (!*end || type == argNONE || arg >= r->nArgs || len >= sizeof(spec)) {
+			if (*end == '%') out[n++] = '%';
+			p = (*end) ? end + 1 : end;
+			continue;
+		}
+
+		memcpy(spec, p, len);
+		spec[len] = '\0';
+		const tArg* a = &r->args[arg++];
+		int k = 0;
+		switch (type) {
+		case argINT: k = snprintf(out + n, size - n, spec, (int)a->i); break;
+		case argLONG: k = snprintf(out + n, size - n, spec, (long)a->i); break;
+		case argLLONG: k = snprintf(out + n, size - n, spec, a->i); break;
+		case argSIZE: k = snprintf(out + n, size - n, spec, (size_t)a->i); break;
+		case argDOUBLE: k = snprintf(out + n, size - n, spec, a->d); break;
+		case argSTRING: k = snprintf(out + n, size - n, spec, r->text + a->offset); break;
+		case argPOINTER: k = snprintf(out + n, size - n, spec, a->p); break;
+		default: break;
+		}
+		if (k > 0) n += ((size_t)k < size - n) ? (size_t)k : size - n - 1;
+		p = end + 1;
+	}
+	out[n] = '\0';
+}
+
+// Escreve no stdout as mensagens de todos os buffers, da mais antiga para a mais recente.
+// Deve ser chamada com o sinkLock adquirido
+static void Drain(void) {
+	static uint reported;
+	char line[512];
+	char msg[400];
+
+	for (;;) {
+		tLogRing* oldest = (tLogRing*)NULL;
+		int x; for (x=0; x<LOG_THREADS; x++) {
+			tLogRing* r = __atomic_load_n(&rings[x], __ATOMIC_ACQUIRE);
+			if (!r || r->tail == __atomic_load_n(&r->head, __ATOMIC_ACQUIRE)) continue;
+			if (!oldest || r->records[r->tail % LOG_RING].time < oldest->records[oldest->tail % LOG_RING].time) oldest = r;
+		}
+		if (!oldest) break;
+
+		const tLogRecord* r = &oldest->records[oldest->tail % LOG_RING];
+		struct tm tm;
+		time_t sec = (time_t)(r->time / 1000000);
+		localtime_r(&sec, &tm);
+		Format(r, msg, sizeof(msg));
+		size_t len = strlen(msg);
+		if (len && msg[len-1] == '\n') msg[--len] = '\0';
+		if (len && msg[len-1] == '\r') msg[--len] = '\0';
+		snprintf(line, sizeof(line), "%02d:%02d:%02d.%06u %-5s %-7s %s\n", tm.tm_hour, tm.tm_min, tm.tm_sec,
+			(uint)(r->time % 1000000), levels[r->level], categories[r->category], msg);
+		fputs(line, stdout);
+		__atomic_store_n(&oldest->tail, oldest->tail + 1, __ATOMIC_RELEASE);
+	}
+
+	uint d = __atomic_load_n(&dropped, __ATOMIC_RELAXED);
+	if (d != reported) {
+		fprintf(stdout, "log: %u mensagens descartadas" CMD_TERMINATOR, d - reported);
+		reported = d;
+	}
+	fflush(stdout);
+}
+
+static void* Process(void* params) {
+	for (;;) {
+		pthread_mutex_lock(&sinkLock);
+		Drain();
+		pthread_mutex_unlock(&sinkLock);
+		usleep(LOG_FLUSH_PERIOD * 1000);
+	}
+	return NULL;
+}
+
+// #####################################################################################################################
+// FUNCTIONS
+// #####################################################################################################################
+
+// -------------------------------------------------------------------------------------------------------------------
+// FUNÇÃO:		log_Start
+// Descrição: 	Inicia a thread de fundo que escreve as mensagens. Pode ser chamada várias vezes, inclusive por
+//				ambientes diferentes do node, somente a primeira chamada cria a thread, que vive até o fim do processo
+// Retorna:		pdPASS se a thread está em execução
+// -------------------------------------------------------------------------------------------------------------------
+int log_Start(void) {
+	static int started;
+	static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+	pthread_t thread;
+
+	pthread_mutex_lock(&lock);
+	if (!started && pthread_create(&thread, NULL, Process, NULL) == 0) {
+		pthread_detach(thread);
+		atexit(log_Flush);
+		started = pdTRUE;
+	}
+	pthread_mutex_unlock(&lock);
+	return (started) ? pdPASS : pdFAIL;
+}
+
+// -------------------------------------------------------------------------------------------------------------------
+// FUNÇÃO:		log_Flush
+// Descrição: 	Escreve as mensagens pendentes sem esperar a thread de fundo, usada no fim do processo
+// -------------------------------------------------------------------------------------------------------------------
+void log_Flush(void) {
+	pthread_mutex_lock(&sinkLock);
+	Drain();
+	pthread_mutex_unlock(&sinkLock);
+}
+
+// -------------------------------------------------------------------------------------------------------------------
+// FUNÇÃO:		log_SetLevel
+// Descrição: 	Altera o nível de uma categoria, as mensagens com nível maior são ignoradas
+// Parametros:	category: Categoria, ou -1 para todas
+//				level: logOFF até logTRACE
+// -------------------------------------------------------------------------------------------------------------------
+void log_SetLevel(int category, int level) {
+	int x; for (x=0; x<nLOG_CATEGORIES; x++)
+		if (category < 0 || category == x) __atomic_store_n(&logLevels[x], level, __ATOMIC_RELAXED);
+}
+
+// -------------------------------------------------------------------------------------------------------------------
+// FUNÇÃO:		log_Level
+// Retorna:		Índice do nível com nome name (OFF, ERROR, ... sem diferenciar maiúsculas), ou -1 se não existe
+// -------------------------------------------------------------------------------------------------------------------
+int log_Level(const char* name) {
+	int x; for (x=logOFF; x<=logTRACE; x++)
+		if (strcasecmp(name, levels[x]) == 0) return x;
+	return -1;
+}
+
+// -------------------------------------------------------------------------------------------------------------------
+// FUNÇÃO:		log_Category
+// Retorna:		Índice da categoria com nome name (session, modbus ou samples), ou -1 se não existe
+// -------------------------------------------------------------------------------------------------------------------
+int log_Category(const char* name) {
+	int x; for (x=0; x<nLOG_CATEGORIES; x++)
+		if (strcasecmp(name, categories[x]) == 0) return x;
+	return -1;
+}
+
+// -------------------------------------------------------------------------------------------------------------------
+// FUNÇÃO:		log_Write
+// Descrição: 	Copia a mensagem para o buffer da thread, a formatação é feita pela thread de fundo. Usar pela macro LOG,
+//				que só chama log_Write se o nível está habilitado
+// Parametros:	fmt: Formato do printf, deve ser um literal, somente o ponteiro é guardado
+// -------------------------------------------------------------------------------------------------------------------
+void log_Write(int category, int level, const char* fmt, ...) {
+	tLogRing* r = Ring();
+	if (!r || r->head - __atomic_load_n(&r->tail, __ATOMIC_ACQUIRE) >= LOG_RING) {
+		__atomic_fetch_add(&dropped, 1, __ATOMIC_RELAXED);
+		return;
+	}
+
+	tLogRecord* m = &r->records[r->head % LOG_RING];
+	uint text = 0;
+	va_list ap;
+	m->time = now_us();
+	m->fmt = fmt;
+	m->level = (u8)level;
+	m->category = (u8)category;
+	m->nArgs = 0;
+
+	va_start(ap, fmt);
+	const char* p; for (p = fmt; *p && m->nArgs < LOG_ARGS; p++) {
+		if (*p != '%') continue;
+		tArgType type;
+		p = Spec(p + 1, &type);
+		if (!*p) break;
+		tArg* a = &m->args[m->nArgs];
+		switch (type) {
+		case argINT: a->i = va_arg(ap, int); break;
+		case argLONG: a->i = va_arg(ap, long); break;
+		case argLLONG: a->i = va_arg(ap, long long); break;
+		case argSIZE: a->i = (long long)va_arg(ap, size_t); break;
+		case argDOUBLE: a->d = va_arg(ap, double); break;
+		case argPOINTER: a->p = va_arg(ap, void*); break;
+		case argSTRING: {
+			const char* s = va_arg(ap, const char*);
+			if (!s) s = "(null)";
+			size_t len = strlen(s);
+			if (text >= LOG_TEXT) text = LOG_TEXT - 1;	// sem espaço, aponta para o terminador da última string
+			if (len > LOG_TEXT - 1 - text) len = LOG_TEXT - 1 - text;
+			memcpy(m->text + text, s, len);
+			m->text[text + len] = '\0';
+			a->offset = text;
+			text += len + 1;
+			break;
+		}
+		default: continue;
+		}
+		m->nArgs++;
+	}
+	va_end(ap);
+
+	// a mensagem deve estar completa na memória antes de ser entregue à thread de fundo
+	__atomic_store_n(&r->head, r->head + 1, __ATOMIC_RELEASE);
+}
@@ -2,52 +2,79 @@
 #include "_config_cpu_.h"
 #include "uart/uart.h"
 #include "modbus/modbus_master.h"
+#include "recorder/recorder.h"
+#include "colstore/colstore.h"
+#include "capture/capture.h"
+#include "trace/trace.h"
 #include "app.h"
 #include <unistd.h>
+#include <poll.h>
 #include <pthread.h>
 #include <stdio.h>
 #include <string.h>
+#include <time.h>
+
+
+// Funções da UART do painel passadas para o mestre modbus
+//	A porta passada ao mestre é o próprio painel, assim os envios e recepções marcam os instantes usados no turnaround
+static int UartPuts(void* port, u8* buffer, u16 count) {
+	tPanel* panel = (tPanel*)port;
+	int ret = uart_SendBuffer(&panel->uart, buffer, count);
+	u64 t = now_us();
+	capture_Frame(panel->capture, captureTX, (ret < 0) ? pdFAIL : pdPASS, buffer, count, t);
+	// o write retorna ao copiar os bytes para o driver, o fim da transmissão é estimado pela velocidade da UART (10 bits por byte)
+	uint bps = uart_Bps(panel->baudrate);
+	panel->txEnd = t + ((bps) ? (u64)count * 10 * 1000000 / bps : 0);
+	panel->rxFirst = 0;
+	return ret;
+}
 
+static int UartGetc(void* port, u8* ch) {
+	tPanel* panel = (tPanel*)port;
+	if (uart_GetChar(&panel->uart, ch) == pdFAIL) return pdFAIL;
+	if (!panel->rxFirst) panel->rxFirst = now_us();
+	return pdPASS;
+}
+
+static void UartFlushRX(void* port) {
+	uart_ClearBufferRx(&((tPanel*)port)->uart);
+}
 
-static int waitResponse = pdFALSE;
-static tCommand cmd;
-static u16 regs[120]; // registrador de trabalho para troca de dados com os multimetros
-extern tControl control;
-
-int modbus_Init(void) {
-	//fprintf(flog, "Abrindo UART %s"CMD_TERMINATOR, COM_PORT);
-	#if (LOG_MODBUS == pdON)
-		printf("Abrindo UART %s"CMD_TERMINATOR, COM_PORT);
-	#endif
-	if (uart_Init(COM_PORT, MODBUS_BAUDRATE) == pdFAIL ) {
-   		//fprintf(flog, "Erro ao abrir a porta UART"CMD_TERMINATOR);
-		//fprintf(flog, "    Verifique se essa porta não esteja sendo usada por outro programa,"CMD_TERMINATOR);
-		//fprintf(flog, "    ou se o usuário tem permissão para usar essa porta: chmod a+rw %s"CMD_TERMINATOR, COM_PORT);
-   		#if (LOG_MODBUS == pdON)
-			printf("Erro ao abrir a porta UART"CMD_TERMINATOR);
-			printf("    Verifique se essa porta não esteja sendo usada por outro programa,"CMD_TERMINATOR);
-			printf("    ou se o usuário tem permissão para usar essa porta: chmod a+rw %s"CMD_TERMINATOR, COM_PORT);
-		#endif
+int modbus_Init(tPanel* panel) {
+	LOG(logSESSION, logINFO, "Abrindo UART %s", panel->port);
+	if (uart_Init(&panel->uart, panel->port, panel->baudrate) == pdFAIL ) {
+		LOG(logSESSION, logERROR, "Erro ao abrir a porta UART %s: verifique se ela não está sendo usada por outro programa, ou se o usuário tem permissão para usá-la: chmod a+rw %s", panel->port, panel->port);
 		return pdFAIL;
 	}
 
-	//fprintf(flog, "Port UART %s aberto com sucesso"CMD_TERMINATOR, COM_PORT);
-	#if (LOG_MODBUS == pdON)
-	printf("Port UART %s aberto com sucesso a %d bps"CMD_TERMINATOR, COM_PORT, MODBUS_BAUDRATE);
-	#endif
-	modbus_MasterInit(uart_SendBuffer, uart_GetChar, uart_ClearBufferRx);
-	modbus_MasterAppendTime(now, 3000);
+	LOG(logSESSION, logINFO, "Port UART %s aberto com sucesso", panel->port);
+	modbus_MasterInit(&panel->master, panel, UartPuts, UartGetc, UartFlushRX);
+	modbus_MasterAppendTime(&panel->master, now, 3000);
 
 	return pdPASS;
 }
 
 
 
+// Contabiliza a conclusão do comando em andamento nas estatísticas do painel, ver stats.cc
+static void Account(tPanel* panel, int ret) {
+	struct timespec cpu;
+	u64 t = now_us();
+	clock_gettime(CLOCK_THREAD_CPUTIME_ID, &cpu);
+	stats_Cpu(panel->stats, (u64)cpu.tv_sec * 1000000 + cpu.tv_nsec / 1000);
+	stats_Response(panel->stats, panel->control.rhID, panel->function, ret, t - panel->sentAt);
+	trace_Ack(panel->trace, ret, panel->txEnd, panel->rxFirst, t);
+	stats_Bus(panel->stats, panel->uart.txBytes, panel->uart.rxBytes,
+		(!panel->rxFirst) ? -1 : (panel->rxFirst > panel->txEnd) ? (s64)(panel->rxFirst - panel->txEnd) : 0,
+		(panel->doneAt) ? (s64)(panel->sentAt - panel->doneAt) : -1);
+	panel->doneAt = t;
+	panel->rxFirst = 0;
+}
 
-void modbus_SendCommand( tCommand c) {
-    if (waitResponse) return ;// pdFAIL;
+void modbus_SendCommand(tPanel* panel, tCommand c) {
+    if (panel->waitResponse) return ;// pdFAIL;
 
-	cmd = c;
+	panel->cmd = c;
     // APONTA QUAIS REGISTRADORES A ACESSAR NO DISPOSITIVO
     // -----------------------------------------------------------------------------------------------------------------
 
@@ -58,64 +85,61 @@ void modbus_SendCommand( tCommand c) {
 	u16 value = 0;
 
     // comando para ler os estados das saidas digitais
-    if (cmd == cmdGET_DOUTS) {
+    if (panel->cmd == cmdGET_DOUTS) {
         addrInit = 0x200;
         nRegs = 1;
 
     // comando para gravar os estados das saidas digitais
-    } else if (cmd == cmdSET_DOUTS) {
+    } else if (panel->cmd == cmdSET_DOUTS) {
         typeCMD = writeREG;
         addrInit = 0x200;
         nRegs = 1;
-        value = control.douts;
+        value = panel->control.douts;
 
 	// comando para ler os estados dos reles
-    } else if (cmd == cmdGET_RELAYS) {
+    } else if (panel->cmd == cmdGET_RELAYS) {
         addrInit = 0x300;
         nRegs= 1;
 
     // comando para gravar os estados dos reles
-    } else if (cmd == cmdSET_RELAYS) {
+    } else if (panel->cmd == cmdSET_RELAYS) {
         typeCMD = writeREG;
         addrInit = 0x300;
         nRegs = 1;
-        value = control.relays;
+        value = panel->control.relays;
 
     // Comando para ler os valores dos sensores
-    } else if (cmd == cmdGET_MULTIMETERS) {
+    } else if (panel->cmd == cmdGET_MULTIMETERS) {
         addrInit = 0x400;
-        nRegs = control.nMultimetersGeren*4;
+        nRegs = panel->control.nMultimetersGeren*4;
     }
 
    	// ENVIA O COMANDO AO DISPOSITIVO ESCRAVO
    	// -----------------------------------------------------------------------------------------------------------------
    	int ret;
+	panel->function = (typeCMD == writeREG) ? 6 : (typeCMD == writeREGS) ? 16 : 3;
+	stats_Request(panel->stats, panel->control.rhID, panel->function, panel->failed == c);
+	panel->sentAt = now_us();
     if (typeCMD == writeREG) {
-    	#if (LOG_MODBUS == pdON)
-    	//fprintf(flog, "modbus WriteReg [cmd %d] [slave %d] [reg 0x%x] [value 0x%x]"CMD_TERMINATOR, cmd, control.rhID, addrInit, value);
-    	printf("modbus WriteReg [cmd %d] [slave %d] [reg 0x%x] [value 0x%x]"CMD_TERMINATOR, cmd, control.rhID, addrInit, value);
-    	#endif
-		ret =  modbus_MasterWriteRegister(control.rhID, addrInit, value);
+		panel->written = value;
+		trace_Send(panel->trace, (panel->cmd == cmdSET_DOUTS) ? outDOUTS : outRELAYS, value, panel->sentAt);
+		LOG(logMODBUS, logDEBUG, "modbus WriteReg [cmd %d] [slave %d] [reg 0x%x] [value 0x%x]", panel->cmd, panel->control.rhID, addrInit, value);
+		ret =  modbus_MasterWriteRegister(&panel->master, panel->control.rhID, addrInit, value);
 	} else if (typeCMD == writeREGS) {
-	   	#if (LOG_MODBUS == pdON)
-    	//fprintf(flog, "modbus WriteRegs [cmd %d] [slave %d] [reg 0x%x] [len %d]"CMD_TERMINATOR, cmd, control.rhID, addrInit, nRegs);
-    	printf("modbus WriteRegs [cmd %d] [slave %d] [reg 0x%x] [len %d]"CMD_TERMINATOR, cmd, control.rhID, addrInit, nRegs);
-    	#endif
-        ret = modbus_MasterWriteRegisters(control.rhID, addrInit, nRegs, regs);
+		LOG(logMODBUS, logDEBUG, "modbus WriteRegs [cmd %d] [slave %d] [reg 0x%x] [len %d]", panel->cmd, panel->control.rhID, addrInit, nRegs);
+        ret = modbus_MasterWriteRegisters(&panel->master, panel->control.rhID, addrInit, nRegs, panel->regs);
     } else {
-    	#if (LOG_MODBUS == pdON)
-    	//fprintf(flog, "modbus ReadRegs [cmd %d] [slave %d] [reg 0x%x] [len %d]"CMD_TERMINATOR, cmd, control.rhID, addrInit, nRegs);
-    	printf("modbus ReadRegs [cmd %d] [slave %d] [reg 0x%x] [len %d]"CMD_TERMINATOR, cmd, control.rhID, addrInit, nRegs);
-    	#endif
-		ret = modbus_MasterReadRegisters(control.rhID, addrInit, nRegs, regs);
+		LOG(logMODBUS, logDEBUG, "modbus ReadRegs [cmd %d] [slave %d] [reg 0x%x] [len %d]", panel->cmd, panel->control.rhID, addrInit, nRegs);
+		ret = modbus_MasterReadRegisters(&panel->master, panel->control.rhID, addrInit, nRegs, panel->regs);
 	}
 
 	// se foi enviado com sucesso ficaremos na espera da resposta do recurso de hardware
-	if (ret == pdPASS) waitResponse = pdTRUE;
-	#if (LOG_MODBUS == pdON)
-	//else fprintf(flog, "modbus err[%d] send querie"CMD_TERMINATOR, modbus_MasterReadStatus());
-	else printf("modbus err[%d] SEND querie"CMD_TERMINATOR, modbus_MasterReadStatus());
-	#endif
+	if (ret == pdPASS) panel->waitResponse = pdTRUE;
+	else {
+		Account(panel, modbus_MasterReadStatus(&panel->master));
+		panel->failed = c;
+		LOG(logMODBUS, logWARN, "modbus err[%d] SEND querie", modbus_MasterReadStatus(&panel->master));
+	}
 
 	return;
 }
@@ -134,67 +158,137 @@ void modbus_SendCommand( tCommand c) {
 // c: Tipo de comando para ser enviado ao escravo
 // funcResponse: Ponteiro da função para processar a resposta da comunicação
 
-void init_control_tad(){
+void init_control_tad(tPanel* panel){
     int x; 
-	control.funcEx = funcPANEL_ELETRIC;		// Sinaliza que este MSIP vai gerenciar o experimento do painel elétrico
-	control.rhID = 1;						// Sinaliza que o endereço do RH no modbus é 1
-	control.getInfo = 1; 					// sinaliza para pegar as informações do RH
-	control.getRelays = 0;
-	control.getDouts = 0;
-	control.exit = 0;
-	control.douts = 0;
-	control.relays = 0;
-	control.relaysOld = control.doutsOld = 0;
-	control.nMultimetersGeren = nMULTIMETER_GEREN;
-	control.stsCom = 0;
-	memset(control.rhModel, '\0', __STRINGSIZE__);
-	memset(control.rhFirmware, '\0', __STRINGSIZE__);
+	panel->control.funcEx = funcPANEL_ELETRIC;		// Sinaliza que este MSIP vai gerenciar o experimento do painel elétrico
+	panel->control.rhID = panel->rhID;				// Endereço do RH no modbus, ver session_New
+	panel->control.getInfo = 1; 					// sinaliza para pegar as informações do RH
+	panel->control.getRelays = 0;
+	panel->control.getDouts = 0;
+	panel->control.exit = 0;
+	panel->control.douts = 0;
+	panel->control.relays = 0;
+	panel->control.relaysOld = panel->control.doutsOld = 0;
+	panel->control.nMultimetersGeren = panel->nMultimeters;
+	panel->control.stsCom = 0;
+	memset(panel->control.rhModel, '\0', __STRINGSIZE__);
+	memset(panel->control.rhFirmware, '\0', __STRINGSIZE__);
 	for(x=0;x<nMULTIMETER;x++) {
-		control.multimeter[x].stsCom = 0;
-		control.multimeter[x].sts = 0;
+		panel->control.multimeter[x].stsCom = 0;
+		panel->control.multimeter[x].sts = 0;
 	}
   return;
 	
 }
 
 
+// Decodifica o bloco de registradores lido a partir do 0x400 do RH, 4 registradores por multímetro:
+//	stsCom, func e sts, e o valor em 32 bits com a parte baixa primeiro
+void modbus_DecodeMultimeters(tMultimeter* multimeter, uint n, const u16* regs) {
+	uint x; for(x=0; x<n; x++) {
+		multimeter[x].stsCom = regs[4*x] & 0xff;
+		multimeter[x].func = (regs[(4*x)+1] & 0x10) >> 4;
+		multimeter[x].sts = regs[(4*x)+1] & 0xf;
+		multimeter[x].value = (regs[(4*x)+2]) | ( regs[(4*x)+3] << 16);
+		LOG(logSAMPLES, logDEBUG, "MULTIMETER[%d] stsCom 0x%x func %d sts 0x%x value %d",
+			x,
+			multimeter[x].stsCom,
+			multimeter[x].func,
+			multimeter[x].sts,
+			multimeter[x].value
+		);
+	}
+}
+
+// Publica a leitura dos multimetros recém concluída para os consumidores das amostras
+static void Publish(tPanel* panel) {
+	tSample* sample = &panel->sample;
+
+	sample->seq = ++panel->seq;
+	sample->time = now_us();
+	sample->stsCom = panel->control.stsCom;
+	sample->relays = panel->control.relaysOld;
+	sample->douts = panel->control.doutsOld;
+	sample->nMultimeters = panel->control.nMultimetersGeren;
+	memcpy(sample->multimeter, panel->control.multimeter, sizeof(sample->multimeter));
+
+	snapshot_Push(panel->snapshot, sample);
+	history_Push(panel->history, sample);
+	aggregate_Push(panel->aggregator, sample);
+	deadband_Push(panel->deadband, sample);
+	events_Publish(panel->events);		// os consumidores no JS só dependem das funções acima
+	recorder_Append(panel->recorder, sample);
+	archive_Append(panel->archive, sample);
+}
+
+// Dorme até chegar um byte da resposta ou no máximo MODBUS_POLL_PERIOD ms, em vez de consultar o mestre sem parar.
+// O mestre consome um byte por chamada, então não espera enquanto há bytes no buffer da UART. Após uma falha o
+// próximo comando também espera, assim uma porta com erro não é consultada sem pausa
+static void Wait(tPanel* panel) {
+	if (panel->waitResponse) {
+		if (panel->uart.rxcnt > 0) return;
+		struct pollfd p = { panel->uart.fd, POLLIN, 0 };
+		poll(&p, 1, MODBUS_POLL_PERIOD);
+	} else if (panel->failed != cmdNONE) usleep(MODBUS_POLL_PERIOD * 1000);
+}
+
 // processo do modbus.
 //	Neste processo gerencia os envios de comandos para o recurso de hardware e fica no aguardo de sua resposta
 //	Atualiza as variaveis do sistema de acordo com a resposta do recurso de hardware.
 
+// Retorna NULL quando a thread terminou limpa, ou (void *) 1 quando o frame em andamento ou a gravação
+// das saídas pendentes teve que ser cancelada após SESSION_STOP_TIMEOUT
 void * modbus_Process(void * params) {
-	int first = 0;
-	while (control.exit == 0){
-
-		if(first){
-			sleep(0.3);
-			
+	tPanel* panel = (tPanel*)params;
+	tTime stopTime = 0;
+	panel->doneAt = 0;
+	stats_Start(panel->stats);
+	outputs_Run(panel->outputs, &panel->control, pdTRUE);
+	while (1){
+		// sessão sem clientes por muito tempo, a UART já foi fechada
+		if (session_Expired(panel)) break;
+
+		// Pedido de parada: não enviamos mais leituras, somente terminamos o frame em andamento
+		// e gravamos as saídas que ainda não foram enviadas ao RH
+		if (panel->control.exit) {
+			if (!stopTime) stopTime = now();
+			if (!panel->waitResponse && panel->control.relaysOld == panel->control.relays && panel->control.doutsOld == panel->control.douts) break;
+			if ((now() - stopTime) >= SESSION_STOP_TIMEOUT) {
+				modbus_MasterAbort(&panel->master);
+				panel->waitResponse = pdFALSE;
+				outputs_Run(panel->outputs, &panel->control, pdFALSE);
+				return (void *) 1;
+			}
 		}
-	    first =1;
-        modbus_MasterProcess();
+
+		Wait(panel);
+        modbus_MasterProcess(&panel->master);
+		outputs_Expire(panel->outputs, &panel->control);
 
 		// Gerenciador de envio de comandos
 		// se nao estamos esperando a resposta do SendCommand vamos analisar o proximo comando a ser enviado
-		if (!waitResponse) {
+		if (!panel->waitResponse) {
+			// saídas pedidas pelo panel.apply
+			outputs_Next(panel->outputs, &panel->control);
 			// checa se é para pegar as informações do RH
-			if (control.getInfo) {
-				modbus_SendCommand(cmdGET_INFOS);
+			if (panel->control.getInfo && !panel->control.exit) {
+				modbus_SendCommand(panel, cmdGET_INFOS);
 			   // se o MSIP estiver configurado para gerenciar o painel elétrico
-			} else if (control.funcEx == funcPANEL_ELETRIC) {
+			} else if (panel->control.funcEx == funcPANEL_ELETRIC) {
 				// checa se houve mudanças nos estado dos reles
-				if (control.relaysOld != control.relays) modbus_SendCommand(cmdSET_RELAYS);
+				if (panel->control.relaysOld != panel->control.relays) modbus_SendCommand(panel, cmdSET_RELAYS);
 				// checa se houve mudanças nos estados das saídas digitais
-				else if (control.doutsOld != control.douts) modbus_SendCommand(cmdSET_DOUTS);
+				else if (panel->control.doutsOld != panel->control.douts) modbus_SendCommand(panel, cmdSET_DOUTS);
 				// checa se houve um pedido de leitura de estados dos reles // TODO quando fazer atualizar control.relay também para que não envio o comando de ajuste
 				// checa se houve um pedido de leitura dos estados saídas digitas// TODO quando fazer atualizar control.dout também para que não envio o comando de ajuste
 				// Envia o pedido da leitura dos multimetros
-				else modbus_SendCommand(cmdGET_MULTIMETERS);
+				else if (!panel->control.exit) modbus_SendCommand(panel, cmdGET_MULTIMETERS);
 			}
 			
 			continue;
 		}
 		
-		int ret = modbus_MasterReadStatus();
+		int ret = modbus_MasterReadStatus(&panel->master);
 		//	BUSY: Ficar na espera da resposta
 		//  ERROR: Notificar  o erro e tomar procedimento cabíveis
 		//  OK para escrita: Nada, pois os valores dos registradores foram salvos no escravo com sucesso
@@ -203,92 +297,75 @@ void * modbus_Process(void * params) {
 		// se ainda est ocupado, nao faz nada
 
 		if (ret == errMODBUS_BUSY) continue;
-		waitResponse = pdFALSE;
+		panel->waitResponse = pdFALSE;
+		// a resposta ainda está no buffer do mestre, é capturada com o status da decodificação
+		capture_Frame(panel->capture, captureRX, ret, panel->master.querie, panel->master.rxLen,
+			(panel->rxFirst) ? panel->rxFirst : now_us());
+		Account(panel, ret);
+		panel->failed = (ret < 0) ? panel->cmd : cmdNONE;
 		// se aconteceu algum erro
 		if (ret < 0) {
-			#if (LOG_MODBUS == pdON)
-			//fprintf(flog, "modbus err[%d] wait response "CMD_TERMINATOR, ret);
-			printf("modbus err[%d] WAIT response "CMD_TERMINATOR, ret);
-			#endif
-			control.stsCom = modbus_MasterReadException();
+			LOG(logMODBUS, logWARN, "modbus err[%d] WAIT response", ret);
+			panel->control.stsCom = modbus_MasterReadException(&panel->master);
 				// modbusILLEGAL_FUNCTION: O multimetro recebeu uma função que não foi implementada ou não foi habilitada.
 				// modbusILLEGAL_DATA_ADDRESS: O multimetro precisou acessar um endereço inexistente.
 				// modbusILLEGAL_DATA_VALUE: O valor contido no campo de dado não é permitido pelo multimetro. Isto indica uma falta de informações na estrutura do campo de dados.
 				// modbusSLAVE_DEVICE_FAILURE: Um irrecuperável erro ocorreu enquanto o multimetro estava tentando executar a ação solicitada.
+			outputs_Step(panel->outputs, &panel->control, panel->cmd, ret, NULL);
 			continue;
 		}
 
-		control.stsCom = 5; // sinaliza que a conexão foi feita com sucesso
+		panel->control.stsCom = 5; // sinaliza que a conexão foi feita com sucesso
 
 		// ATUALIZA VARS QUANDO A COMUNICAÇÃO FOI FEITA COM SUCESSO
 		// -----------------------------------------------------------------------------------------------------------------
 
 		// Comando para ler os registradores: modelo e versão firmware do RH
-		if (cmd == cmdGET_INFOS) {
-			#if (LOG_MODBUS == pdON)
-			printf("model %c%c%c%c"CMD_TERMINATOR, (regs[0] & 0xff), (regs[0] >> 8), (regs[1] & 0xff), (regs[1] >> 8));
-			printf("firware %c.%c"CMD_TERMINATOR, (regs[2] & 0xff), (regs[2] >> 8));
-			#endif
-			control.rhModel[0] = (regs[0] & 0xff);
-			control.rhModel[1] = (regs[0] >> 8);
-			control.rhModel[2] = (regs[1] & 0xff);
-			control.rhModel[3] = (regs[1] >> 8);
-			control.rhModel[4] = 0;
-			control.rhFirmware[0] = (regs[2] & 0xff);
-			control.rhFirmware[1] = (regs[2] >> 8);
-			control.rhFirmware[2] = 0;
-
-			control.getInfo = 0; // sinalizo para não pegar mais informações
+		if (panel->cmd == cmdGET_INFOS) {
+			LOG(logSESSION, logINFO, "model %c%c%c%c", (panel->regs[0] & 0xff), (panel->regs[0] >> 8), (panel->regs[1] & 0xff), (panel->regs[1] >> 8));
+			LOG(logSESSION, logINFO, "firware %c.%c", (panel->regs[2] & 0xff), (panel->regs[2] >> 8));
+			panel->control.rhModel[0] = (panel->regs[0] & 0xff);
+			panel->control.rhModel[1] = (panel->regs[0] >> 8);
+			panel->control.rhModel[2] = (panel->regs[1] & 0xff);
+			panel->control.rhModel[3] = (panel->regs[1] >> 8);
+			panel->control.rhModel[4] = 0;
+			panel->control.rhFirmware[0] = (panel->regs[2] & 0xff);
+			panel->control.rhFirmware[1] = (panel->regs[2] >> 8);
+			panel->control.rhFirmware[2] = 0;
+
+			panel->control.getInfo = 0; // sinalizo para não pegar mais informações
 
 		// comando para ajuste dos reles, vamos sinalizar para não enviar mais comandos
-		} else if (cmd == cmdSET_RELAYS) {
-			control.relaysOld = control.relays;
-			#if (LOG_MODBUS == pdON)
-			printf("RELAY set 0x%x"CMD_TERMINATOR, control.relaysOld);
-			#endif
+		} else if (panel->cmd == cmdSET_RELAYS) {
+			// o valor enviado, control.relays pode ter sido alterado pelo update durante a transação
+			panel->control.relaysOld = panel->written;
+			LOG(logMODBUS, logDEBUG, "RELAY set 0x%x", panel->control.relaysOld);
 		// comando para ajuste dos reles, vamos sinalizar para não enviar mais comandos
-		} else if (cmd == cmdSET_DOUTS) {
-			control.doutsOld = control.douts;
-			#if (LOG_MODBUS == pdON)
-			printf("DOUTS set 0x%x"CMD_TERMINATOR, control.doutsOld);
-			#endif
+		} else if (panel->cmd == cmdSET_DOUTS) {
+			panel->control.doutsOld = panel->written;
+			LOG(logMODBUS, logDEBUG, "DOUTS set 0x%x", panel->control.doutsOld);
 
 		// comando para ler os estados dos reles
-		} else if (cmd == cmdGET_RELAYS) {
-			control.relays = regs[0];
-			control.relaysOld = regs[0];
-			#if (LOG_MODBUS == pdON)
-			printf("RELAY get 0x%x"CMD_TERMINATOR, control.relaysOld);
-			#endif
+		} else if (panel->cmd == cmdGET_RELAYS) {
+			panel->control.relays = panel->regs[0];
+			panel->control.relaysOld = panel->regs[0];
+			LOG(logMODBUS, logDEBUG, "RELAY get 0x%x", panel->control.relaysOld);
 
 		// comando para ler os estados das saidas digitais
-		} else if (cmd == cmdGET_DOUTS) {
-			control.douts = regs[0];
-			control.doutsOld = regs[0];
-			#if (LOG_MODBUS == pdON)
-			printf("DOUTS get 0x%x"CMD_TERMINATOR, control.doutsOld);
-			#endif
+		} else if (panel->cmd == cmdGET_DOUTS) {
+			panel->control.douts = panel->regs[0];
+			panel->control.doutsOld = panel->regs[0];
+			LOG(logMODBUS, logDEBUG, "DOUTS get 0x%x", panel->control.doutsOld);
 		// Comando para ler os multimetros
-		} else if (cmd == cmdGET_MULTIMETERS) {
-			uint x; for(x=0; x<control.nMultimetersGeren; x++) {
-				control.multimeter[x].stsCom = regs[4*x] & 0xff;
-				control.multimeter[x].func = (regs[(4*x)+1] & 0x10) >> 4;
-				control.multimeter[x].sts = regs[(4*x)+1] & 0xf;
-				control.multimeter[x].value = (regs[(4*x)+2]) | ( regs[(4*x)+3] << 16);
-				#if (LOG_MODBUS == pdON)
-				printf("MULTIMETER[%d] stsCom 0x%x func %d sts 0x%x value %d"CMD_TERMINATOR,
-					x,
-					control.multimeter[x].stsCom,
-					control.multimeter[x].func,
-					control.multimeter[x].sts,
-					control.multimeter[x].value
-				);
-				#endif
-			}
+		} else if (panel->cmd == cmdGET_MULTIMETERS) {
+			modbus_DecodeMultimeters(panel->control.multimeter, panel->control.nMultimetersGeren, panel->regs);
+			Publish(panel);
 		}
+		outputs_Step(panel->outputs, &panel->control, panel->cmd, ret, &panel->sample);
 		
     }
   
+  outputs_Run(panel->outputs, &panel->control, pdFALSE);
   return NULL;
 }
 
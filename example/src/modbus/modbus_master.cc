@@ -32,51 +32,13 @@
 #endif
 #endif
 
-typedef struct {
-	int (*ps)(u8 *buffer, u16 count); // Ponteiro da funo para envio de bytes
-	int (*gc)(u8 *ch);				// Ponteiro da funo para recebimento de bytes
-	void(*flushRX)(void);				// Ponteiro da funo para limpar os buffers de recepo
-	tTime (*now)(void);					// Funo contadora de tempo decorrido
-	tTime timeout; 						// Tempo de espera pela resposta do escravo aps envio de um comando
-
-	// vars aux para comunicao atual
-	u8 querie[256];						// Buffer aux de transmisso e recepo de dados
-	int slaveID;						// Endereo do escravo alvo no barramento para troca de dados
-	int cmd;							// Comando (funo) solicitado
-	int waitResponse;					// Sinaliza para esperar uma resposta aps envio de um comando para o escravo
-	tTime tout;							// Conta o tempo na espera da resposta do escravo
-	u16* regs;							// Ponteiro dos registradores envolvido na troca de dados
-	int len;							// Tamanho do ponteiro
-	int addr;							// Endereo do registrador para ser gravado um valor
-	u16 value;							// Valor a ser gravado no registrador
-	int sts;							// Status da comunicao com o escravo
-											// pdPASS ou >1: Comunicao feita com sucesso
-											// errMODBUS_BUFFER_OVERFLOW: Estourou o tamanho do buffer modbus
-											// errMODBUS_LENPACKET: Tamanho errado do pacote de resposta do escravo
-											// errMODBUS_CRC: Houve erro de CRC na resposta do escravo
-											// errMODBUS_TIMEOUT: Passou o tenpo da espera pela resposta do escravo
-											// errMODBUS_BUSY: Sinaliza que o gerenciador est no processo de comunicao com o escravo
-											// errMODBUS_TX: Erro no envio de bytes ao escravo
-											// errMODBUS_ID: O ID do escravo na sua resposta do escravo no bate com o ID do escravo na solicitao
-											// errMODBUS_ADDR: O endereo do registrador a ser gravado no escravo  invlido
-											// errMODBUS_VALUE: Valor escrito no registrador do escravo no bate com o valor enviado
-											// errMODBUS_CMD: O comando (funo) do pacote de recebimento do escravo no bate com o comando enviado a ele
-											// errMODBUS_EXCEPTION: Sinaliza que o escravo enviou uma exceo, consultar status
-											// errMODBUS_LEN: O tamanho do pacote recebido do escravo no confere ao esperado
-	uint exception;						// Cdigo de exceo do modbus caso for emitido
-											// modbusNO_ERROR: Sem erro de exceo
-											// modbusILLEGAL_FUNCTION: 		O escravo recebeu uma funo que no foi implementada ou no foi habilitada.
-											// modbusILLEGAL_DATA_ADDRESS: O escravo precisou acessar um endereo inexistente.
-											// modbusILLEGAL_DATA_VALUE:  O valor contido no campo de dado no  permitido pelo escravo. Isto indica uma falta de informaes na estrutura do campo de dados.
-											// modbusSLAVE_DEVICE_FAILURE: Um irrecupervel erro ocorreu enquanto o escravo estava tentando executar a ao solicitada.
-} modbusMaster_t;
-
-static modbusMaster_t modbus;
-static int ValidatePacket(void);
-static int GetPacket (void);
-static int ProcessCmd3(void);
-static int ProcessCmd6(void);
-static int ProcessCmd16(void);
+// O estado de cada mestre fica em modbusMaster_t (ver modbus_master.h), assim o programa pode ter um mestre por porta
+
+static int ValidatePacket(modbusMaster_t* modbus);
+static int GetPacket(modbusMaster_t* modbus);
+static int ProcessCmd3(modbusMaster_t* modbus);
+static int ProcessCmd6(modbusMaster_t* modbus);
+static int ProcessCmd16(modbusMaster_t* modbus);
 
 // -------------------------------------------------------------------------------------------------------------------
 // FUNO:		modbus_MasterInit
@@ -97,23 +59,29 @@ static int ProcessCmd16(void);
 //			return ret;
 //		}
 void modbus_MasterInit(
-	int(*puts_func)(u8* buffer, u16 count),
-	int(*getc_func)(u8* ch),
-	void(*flushRX_func)(void)
+	modbusMaster_t* modbus,
+	void* port,
+	int(*puts_func)(void* port, u8* buffer, u16 count),
+	int(*getc_func)(void* port, u8* ch),
+	void(*flushRX_func)(void* port)
 ) {
-	modbus.ps = puts_func;
-	modbus.gc = getc_func;
-	modbus.flushRX = flushRX_func;
-
-	modbus.slaveID = 0;
-	modbus.cmd = 0;
-	modbus.sts = 0;
-	modbus.regs = (u16*)NULL;
-	modbus.len = 0;
-	modbus.waitResponse = pdFALSE;
-	modbus.exception = modbusNO_ERROR;
-	modbus.now = (tTime (*)())NULL;
-	modbus.tout = 0;
+	modbus->port = port;
+	modbus->ps = puts_func;
+	modbus->gc = getc_func;
+	modbus->flushRX = flushRX_func;
+
+	modbus->slaveID = 0;
+	modbus->cmd = 0;
+	modbus->sts = 0;
+	modbus->regs = (u16*)NULL;
+	modbus->len = 0;
+	modbus->waitResponse = pdFALSE;
+	modbus->exception = modbusNO_ERROR;
+	modbus->now = (tTime (*)())NULL;
+	modbus->tout = 0;
+	modbus->rxLen = 0;
+	modbus->firstByte = pdTRUE;
+	modbus->timeDataIn = 0;
     #if (MODBUSM_USE_DEBUG == pdON)
    	modbus_printf("modbusM: INIT"CMD_TERMINATOR);
 	#endif
@@ -128,10 +96,10 @@ void modbus_MasterInit(
 //				timeout:  Tempo de espera pela resposta do escravo aps envio de um comando
 // Retorna:		Nada
 // -------------------------------------------------------------------------------------------------------------------
-// Exemplo para readregs_func:	modbus_MasterAppendTime(now, 3000); timeout = 3000 = 3 segundos
-void modbus_MasterAppendTime(tTime(*now_func)(void), int timeout) {
-	modbus.now = now_func;
-	modbus.timeout = timeout;
+// Exemplo para readregs_func:	modbus_MasterAppendTime(&modbus, now, 3000); timeout = 3000 = 3 segundos
+void modbus_MasterAppendTime(modbusMaster_t* modbus, tTime(*now_func)(void), int timeout) {
+	modbus->now = now_func;
+	modbus->timeout = timeout;
 }
 
 // -------------------------------------------------------------------------------------------------------------------
@@ -149,8 +117,8 @@ void modbus_MasterAppendTime(tTime(*now_func)(void), int timeout) {
 //				errMODBUS_EXCEPTION: Sinaliza que o escravo enviou uma exceo, consultar status
 //				errMODBUS_LEN
 // -------------------------------------------------------------------------------------------------------------------
-int modbus_MasterReadStatus(void) {
-	return modbus.sts;
+int modbus_MasterReadStatus(modbusMaster_t* modbus) {
+	return modbus->sts;
 }
 
 // -------------------------------------------------------------------------------------------------------------------
@@ -162,8 +130,23 @@ int modbus_MasterReadStatus(void) {
 // 				modbusILLEGAL_DATA_VALUE: O valor contido no campo de dado no  permitido pelo escravo. Isto indica uma falta de informaes na estrutura do campo de dados.
 // 				modbusSLAVE_DEVICE_FAILURE: Um irrecupervel erro ocorreu enquanto o escravo estava tentando executar a ao solicitada.
 // -------------------------------------------------------------------------------------------------------------------
-int modbus_MasterReadException(void) {
-	return modbus.exception;
+int modbus_MasterReadException(modbusMaster_t* modbus) {
+	return modbus->exception;
+}
+
+// -------------------------------------------------------------------------------------------------------------------
+// FUNO:		modbus_MasterAbort
+// Descrio: 	Cancela a espera pela resposta do escravo do comando em andamento e descarta os bytes j recebidos.
+//				Usado quando o sistema precisa parar o barramento sem esperar o timeout do mestre
+// Retorna:		Nada. O status da comunicao passa a ser errMODBUS_TIMEOUT
+// -------------------------------------------------------------------------------------------------------------------
+void modbus_MasterAbort(modbusMaster_t* modbus) {
+	if (!modbus->waitResponse) return;
+
+	modbus->cmd = 0;
+	modbus->waitResponse = pdFALSE;
+	modbus->sts = errMODBUS_TIMEOUT;
+	modbus->flushRX(modbus->port);
 }
 
 // #####################################################################################################################
@@ -179,18 +162,18 @@ int modbus_MasterReadException(void) {
 //				errMODBUS_CMD: O comando (funo) do pacote de recebimento do escravo no bate com o comando enviado a ele
 //				errMODBUS_EXCEPTION: Sinaliza que o escravo enviou uma exceo, consultar status
 // -------------------------------------------------------------------------------------------------------------------
-static int ValidatePacket(void) {
+static int ValidatePacket(modbusMaster_t* modbus) {
     // checar se o ID do escravo  o mesmo enviado
-    if (modbus.querie[0] != modbus.slaveID)
+    if (modbus->querie[0] != modbus->slaveID)
 		return errMODBUS_ID;
 
 	 // checar se a funo  a mesma enviada
-    if ((modbus.querie[1] & 0x7f) != modbus.cmd)
+    if ((modbus->querie[1] & 0x7f) != modbus->cmd)
         return errMODBUS_CMD;
 
 	// checa se o escravo mandou algum erro de exceo
-	if ((modbus.querie[1] & 0x80) > 0) {
-        modbus.exception = modbus.querie[2];
+	if ((modbus->querie[1] & 0x80) > 0) {
+        modbus->exception = modbus->querie[2];
         return errMODBUS_EXCEPTION;
 	}
 
@@ -209,40 +192,36 @@ static int ValidatePacket(void) {
 //  			errMODBUS_CRC: Houve erro de CRC na resposta do escravo
 //  			errMODBUS_TIMEOUT: Passou o tenpo da espera pela resposta do escravo
 // -------------------------------------------------------------------------------------------------------------------
-static int GetPacket (void) {
-	static int len = 0;
-    static int firstByte = pdTRUE;
-	static tTime timeDataIn; // conta quanto tempo o dado  recebido do escravo. se o bus ficar em silencio mais que 10ms  porque o escravo terminou a sua transmisso
-
+static int GetPacket(modbusMaster_t* modbus) {
     u8 dat;
 
-	if (!modbus.waitResponse) {
-		len = 0;
-		firstByte = pdTRUE;
-		modbus.tout = modbus.now();
+	if (!modbus->waitResponse) {
+		modbus->rxLen = 0;
+		modbus->firstByte = pdTRUE;
+		modbus->tout = modbus->now();
 		return 0;
 	}
 
-    if (modbus.gc(&dat) == pdPASS) { 			// Checa se recebeu dados
+    if (modbus->gc(modbus->port, &dat) == pdPASS) { 			// Checa se recebeu dados
         #if (MODBUSM_USE_DEBUG == pdON)
-        modbus_printf("modbusM: getp dat 0x%x [%c] len %d"CMD_TERMINATOR, dat, dat, len);
+        modbus_printf("modbusM: getp dat 0x%x [%c] len %d"CMD_TERMINATOR, dat, dat, modbus->rxLen);
         #endif
 
-		firstByte = pdFALSE;                    // Sinaliza que no  o mais o primeiro byte
+		modbus->firstByte = pdFALSE;                    // Sinaliza que no  o mais o primeiro byte
 
-    	if (len >= 256) return errMODBUS_BUFFER_OVERFLOW;
-        modbus.querie[len++] = dat;			// Adiciona o dado no buffer e aponta para o prximo indice do buffer
-		timeDataIn = modbus.now();			// zera o tempo de espera de recebiemntos de dados do escravo
+    	if (modbus->rxLen >= 256) return errMODBUS_BUFFER_OVERFLOW;
+        modbus->querie[modbus->rxLen++] = dat;			// Adiciona o dado no buffer e aponta para o prximo indice do buffer
+		modbus->timeDataIn = modbus->now();			// zera o tempo de espera de recebiemntos de dados do escravo
 
  	// se no h mais bytes no buffer serial em um determinado tempo  porque  fim de transmisso
  		// valor 10 funciona bem entre 2400 a 115200 bps. Valor 5 funcionou bem com 57600 e 115200
         // para boudrate menores pode ser que devemos aumetar esse valor.
         // Recomendo fazer uma macro associado ao boudrate da serial
- 	} else if ( ( modbus.now() > timeDataIn + 10)) {
-        if (!firstByte) {
-        	if (len < 3) {
+ 	} else if ( ( modbus->now() > modbus->timeDataIn + 10)) {
+        if (!modbus->firstByte) {
+        	if (modbus->rxLen < 3) {
 		        #if (MODBUSM_USE_DEBUG == pdON)
-        		modbus_printf("modbusM: err len %d"CMD_TERMINATOR, len);
+        		modbus_printf("modbusM: err len %d"CMD_TERMINATOR, modbus->rxLen);
         		#endif
 
         		return errMODBUS_LENPACKET;
@@ -250,18 +229,18 @@ static int GetPacket (void) {
 
             // Vamos pegar o pacote deste buffer e calcular e verificar a legitimidade
             // Calcular CRC do pacote e comparar
-            u16 crc_calc = crc16_MODBUS(modbus.querie, len-2);
-            u16 crc = (modbus.querie[len-1] << 8 ) | modbus.querie[len-2];
+            u16 crc_calc = crc16_MODBUS(modbus->querie, modbus->rxLen-2);
+            u16 crc = (modbus->querie[modbus->rxLen-1] << 8 ) | modbus->querie[modbus->rxLen-2];
             if (crc != crc_calc) {
 		        #if (MODBUSM_USE_DEBUG == pdON)
-        		modbus_printf("modbusM: err crc 0x%x calc 0x%x len %d"CMD_TERMINATOR, crc, crc_calc, len);
+        		modbus_printf("modbusM: err crc 0x%x calc 0x%x len %d"CMD_TERMINATOR, crc, crc_calc, modbus->rxLen);
         		#endif
 
             	return errMODBUS_CRC;
             } else return pdPASS;
 
         // se ainda no recebemos o primeiro byte aps um tempo vamos cancelar
-        } else if ( ( modbus.now() > modbus.tout + modbus.timeout)) {
+        } else if ( ( modbus->now() > modbus->tout + modbus->timeout)) {
 			#if (MODBUSM_USE_DEBUG == pdON)
         	modbus_printf("modbusM: err timeout"CMD_TERMINATOR);
         	#endif
@@ -282,21 +261,21 @@ static int GetPacket (void) {
 //				errMODBUS_EXCEPTION: Sinaliza que o escravo enviou uma exceo, consultar status
 //				errMODBUS_LEN: O tamanho do pacote recebido do escravo no confere ao esperado
 // -------------------------------------------------------------------------------------------------------------------
-static int ProcessCmd3(void) {
+static int ProcessCmd3(modbusMaster_t* modbus) {
    	// Checa se este pacote  mesmo do escravo solicitado
-   	int ret = ValidatePacket(); // retorna pdPASS	errMODBUS_ID	errMODBUS_CMD errMODBUS_EXCEPTION
+   	int ret = ValidatePacket(modbus); // retorna pdPASS	errMODBUS_ID	errMODBUS_CMD errMODBUS_EXCEPTION
    	if (ret != pdPASS ) return ret;
 
    	// captura a quantidade de bytes recebidos
-   	int countBytes = modbus.querie[2];
-   	if (2*modbus.len != countBytes) return errMODBUS_LEN;
+   	int countBytes = modbus->querie[2];
+   	if (2*modbus->len != countBytes) return errMODBUS_LEN;
 
 	// Tirar os valores dos registradores do bufferin para o buffer da aplicao
-   	int x; for(x=0; x<modbus.len;x++)
-       	*modbus.regs++ = (modbus.querie[2*x+3] << 8) | (modbus.querie[2*x+4]);
+   	int x; for(x=0; x<modbus->len;x++)
+       	*modbus->regs++ = (modbus->querie[2*x+3] << 8) | (modbus->querie[2*x+4]);
 
-	modbus.cmd = 0; // sinaliza que no estamos mais operando nenhum comando
-  	modbus.waitResponse = pdFALSE; // sinaliza que no estamos esperando pela resposta do escravo
+	modbus->cmd = 0; // sinaliza que no estamos mais operando nenhum comando
+  	modbus->waitResponse = pdFALSE; // sinaliza que no estamos esperando pela resposta do escravo
   	return pdPASS;
 }
 
@@ -310,21 +289,21 @@ static int ProcessCmd3(void) {
 //				errMODBUS_EXCEPTION: Sinaliza que o escravo enviou uma exceo, consultar status
 //				errMODBUS_LEN: O tamanho do pacote recebido do escravo no confere ao esperado
 // -------------------------------------------------------------------------------------------------------------------
-static int ProcessCmd6(void) {
+static int ProcessCmd6(modbusMaster_t* modbus) {
    	// Checa se este pacote  mesmo do escravo solicitado
-   	int ret = ValidatePacket(); // retorna pdPASS	errMODBUS_ID	errMODBUS_CMD errMODBUS_EXCEPTION
+   	int ret = ValidatePacket(modbus); // retorna pdPASS	errMODBUS_ID	errMODBUS_CMD errMODBUS_EXCEPTION
    	if (ret != pdPASS ) return ret;
 
     // compara endereo do registrador
-    int addrComp = (modbus.querie[2] << 8) | (modbus.querie[3]);
-    if (modbus.addr != addrComp)  return errMODBUS_ADDR;
+    int addrComp = (modbus->querie[2] << 8) | (modbus->querie[3]);
+    if (modbus->addr != addrComp)  return errMODBUS_ADDR;
 
     // compara valor do registrador
-    u16 valueComp = (modbus.querie[4] << 8) | (modbus.querie[5]);
-    if (modbus.value != valueComp) return errMODBUS_VALUE;
+    u16 valueComp = (modbus->querie[4] << 8) | (modbus->querie[5]);
+    if (modbus->value != valueComp) return errMODBUS_VALUE;
 
-	modbus.cmd = 0; // sinaliza que no estamos mais operando nenhum comando
-  	modbus.waitResponse = pdFALSE; // sinaliza que no estamos esperando pela resposta do escravo
+	modbus->cmd = 0; // sinaliza que no estamos mais operando nenhum comando
+  	modbus->waitResponse = pdFALSE; // sinaliza que no estamos esperando pela resposta do escravo
   	return pdPASS;
 }
 
@@ -338,21 +317,21 @@ static int ProcessCmd6(void) {
 //				errMODBUS_EXCEPTION: Sinaliza que o escravo enviou uma exceo, consultar status
 //				errMODBUS_LEN: O tamanho do pacote recebido do escravo no confere ao esperado
 // -------------------------------------------------------------------------------------------------------------------
-static int ProcessCmd16(void) {
+static int ProcessCmd16(modbusMaster_t* modbus) {
    	// Checa se este pacote  mesmo do escravo solicitado
-   	int ret = ValidatePacket(); // retorna pdPASS	errMODBUS_ID	errMODBUS_CMD errMODBUS_EXCEPTION
+   	int ret = ValidatePacket(modbus); // retorna pdPASS	errMODBUS_ID	errMODBUS_CMD errMODBUS_EXCEPTION
    	if (ret != pdPASS ) return ret;
 
     // compara endereo do registrador
-    int cmp = (modbus.querie[2] << 8) | (modbus.querie[3]);
-    if (modbus.addr != cmp)  return errMODBUS_ADDR;
+    int cmp = (modbus->querie[2] << 8) | (modbus->querie[3]);
+    if (modbus->addr != cmp)  return errMODBUS_ADDR;
 
     // compara a quantidade
-    cmp = (modbus.querie[4] << 8) | (modbus.querie[5]);
-    if (modbus.len != cmp) return errMODBUS_VALUE;
+    cmp = (modbus->querie[4] << 8) | (modbus->querie[5]);
+    if (modbus->len != cmp) return errMODBUS_VALUE;
 
-	modbus.cmd = 0; // sinaliza que no estamos mais operando nenhum comando
-  	modbus.waitResponse = pdFALSE; // sinaliza que no estamos esperando pela resposta do escravo
+	modbus->cmd = 0; // sinaliza que no estamos mais operando nenhum comando
+  	modbus->waitResponse = pdFALSE; // sinaliza que no estamos esperando pela resposta do escravo
   	return pdPASS;
 }
 
@@ -370,40 +349,40 @@ static int ProcessCmd16(void) {
 //  				errMODBUS_XXXXX: Notificar ao sistema o tipo de erro e tomar procedimento cabveis
 //						sistema deve consultar com a funo modbus_MasterReadStatus()
 // -------------------------------------------------------------------------------------------------------------------
-int modbus_MasterReadRegisters(int addrSlave, int addrInit, int len, u16* regs) {
-	if (modbus.waitResponse) return pdFAIL;
+int modbus_MasterReadRegisters(modbusMaster_t* modbus, int addrSlave, int addrInit, int len, u16* regs) {
+	if (modbus->waitResponse) return pdFAIL;
 
-	modbus.slaveID = addrSlave;
-	modbus.cmd = 3;
-	modbus.len = len;
-	modbus.regs = regs;
-	modbus.sts = errMODBUS_BUSY;
+	modbus->slaveID = addrSlave;
+	modbus->cmd = 3;
+	modbus->len = len;
+	modbus->regs = regs;
+	modbus->sts = errMODBUS_BUSY;
 
-	modbus.flushRX(); // limpa os byffers RX da serial
+	modbus->flushRX(modbus->port); // limpa os byffers RX da serial
 
    	// preparar a query
-	modbus.querie[0] = modbus.slaveID;
-    modbus.querie[1] = modbus.cmd;
-    modbus.querie[2] = (addrInit >> 8) & 0xff;
-    modbus.querie[3] = addrInit & 0xff;
-    modbus.querie[4] = (len >> 8) & 0xff;
-    modbus.querie[5] = len & 0xff;
-    u16 crc = crc16_MODBUS(modbus.querie, 6);
-    modbus.querie[6] = crc & 0xff;
-    modbus.querie[7] = (crc >> 8) & 0xff;
+	modbus->querie[0] = modbus->slaveID;
+    modbus->querie[1] = modbus->cmd;
+    modbus->querie[2] = (addrInit >> 8) & 0xff;
+    modbus->querie[3] = addrInit & 0xff;
+    modbus->querie[4] = (len >> 8) & 0xff;
+    modbus->querie[5] = len & 0xff;
+    u16 crc = crc16_MODBUS(modbus->querie, 6);
+    modbus->querie[6] = crc & 0xff;
+    modbus->querie[7] = (crc >> 8) & 0xff;
 
     // enviar a query para o escravo
-    if (modbus.ps(modbus.querie, 8) < 0) {
-        modbus.sts = errMODBUS_TX;
+    if (modbus->ps(modbus->port, modbus->querie, 8) < 0) {
+        modbus->sts = errMODBUS_TX;
         return pdFAIL;
 	}
 
 	// sinalisa que vamos esperar a resposta do escravo
-	modbus.waitResponse = pdTRUE;
+	modbus->waitResponse = pdTRUE;
 
 	#if (MODBUSM_USE_DEBUG == pdON)
 	modbus_printf("modbusM: TX RR: ");
-	int x; for (x=0;x<8;x++) modbus_printf("0x%x ", modbus.querie[x]);
+	int x; for (x=0;x<8;x++) modbus_printf("0x%x ", modbus->querie[x]);
 	modbus_printf(CMD_TERMINATOR);
 	#endif
 
@@ -420,40 +399,40 @@ int modbus_MasterReadRegisters(int addrSlave, int addrInit, int len, u16* regs)
 //  				errMODBUS_XXXXX: Notificar ao sistema o tipo de erro e tomar procedimento cabveis.
 //						sistema deve consultar com a funo modbus_MasterReadStatus()
 // -------------------------------------------------------------------------------------------------------------------
-int modbus_MasterWriteRegister(int addrSlave, int addr, u16 value) {
-	if (modbus.waitResponse) return pdFAIL;
+int modbus_MasterWriteRegister(modbusMaster_t* modbus, int addrSlave, int addr, u16 value) {
+	if (modbus->waitResponse) return pdFAIL;
 
-	modbus.slaveID = addrSlave;
-	modbus.cmd = 6;
-	modbus.addr = addr;
-	modbus.value = value;
-	modbus.sts = errMODBUS_BUSY;
+	modbus->slaveID = addrSlave;
+	modbus->cmd = 6;
+	modbus->addr = addr;
+	modbus->value = value;
+	modbus->sts = errMODBUS_BUSY;
 
-	modbus.flushRX(); // limpa os byffers RX da serial
+	modbus->flushRX(modbus->port); // limpa os byffers RX da serial
 
     // preparar a query
-    modbus.querie[0] = modbus.slaveID;
-    modbus.querie[1] = modbus.cmd;
-    modbus.querie[2] = (addr >> 8) & 0xff;
-    modbus.querie[3] = addr & 0xff;
-    modbus.querie[4] = (value >> 8) & 0xff;
-    modbus.querie[5] = value & 0xff;
-    u16 crc = crc16_MODBUS(modbus.querie, 6);
-    modbus.querie[6] = crc & 0xff;
-    modbus.querie[7] = (crc >> 8) & 0xff;
+    modbus->querie[0] = modbus->slaveID;
+    modbus->querie[1] = modbus->cmd;
+    modbus->querie[2] = (addr >> 8) & 0xff;
+    modbus->querie[3] = addr & 0xff;
+    modbus->querie[4] = (value >> 8) & 0xff;
+    modbus->querie[5] = value & 0xff;
+    u16 crc = crc16_MODBUS(modbus->querie, 6);
+    modbus->querie[6] = crc & 0xff;
+    modbus->querie[7] = (crc >> 8) & 0xff;
 
 	// enviar a query para o escravo
-    if (modbus.ps(modbus.querie, 8) < 0) {
-        modbus.sts = errMODBUS_TX;
+    if (modbus->ps(modbus->port, modbus->querie, 8) < 0) {
+        modbus->sts = errMODBUS_TX;
         return pdFAIL;
 	}
 
 	// sinalisa que vamos esperar a resposta do escravo
-	modbus.waitResponse = pdTRUE;
+	modbus->waitResponse = pdTRUE;
 
 	#if (MODBUSM_USE_DEBUG == pdON)
 	modbus_printf("modbusM: TX WR: ");
-	int x; for (x=0;x<8;x++) modbus_printf("0x%x ", modbus.querie[x]);
+	int x; for (x=0;x<8;x++) modbus_printf("0x%x ", modbus->querie[x]);
 	modbus_printf(CMD_TERMINATOR);
 	#endif
 
@@ -470,49 +449,49 @@ int modbus_MasterWriteRegister(int addrSlave, int addr, u16 value) {
 //  				errMODBUS_XXXXX: Notificar ao sistema o tipo de erro e tomar procedimento cabveis.
 //						sistema deve consultar com a funo modbus_MasterReadStatus()
 // -------------------------------------------------------------------------------------------------------------------
-int modbus_MasterWriteRegisters(int addrSlave, int addrInit, int len, u16* regs) {
-	if (modbus.waitResponse) return pdFAIL;
+int modbus_MasterWriteRegisters(modbusMaster_t* modbus, int addrSlave, int addrInit, int len, u16* regs) {
+	if (modbus->waitResponse) return pdFAIL;
 
-	modbus.slaveID = addrSlave;
-	modbus.cmd = 16;
-	modbus.addr = addrInit;
-	modbus.len = len;
-	modbus.regs = regs;
-	modbus.sts = errMODBUS_BUSY;
+	modbus->slaveID = addrSlave;
+	modbus->cmd = 16;
+	modbus->addr = addrInit;
+	modbus->len = len;
+	modbus->regs = regs;
+	modbus->sts = errMODBUS_BUSY;
 
-	modbus.flushRX(); // limpa os byffers RX da serial
+	modbus->flushRX(modbus->port); // limpa os byffers RX da serial
 
     // preparar a query
-    modbus.querie[0] = modbus.slaveID;
-    modbus.querie[1] = modbus.cmd;
-    modbus.querie[2] = (addrInit >> 8) & 0xff;
-    modbus.querie[3] = addrInit & 0xff;
-    modbus.querie[4] = (len >> 8) & 0xff;
-    modbus.querie[5] = len & 0xff;
-    modbus.querie[6] = 2*len;
+    modbus->querie[0] = modbus->slaveID;
+    modbus->querie[1] = modbus->cmd;
+    modbus->querie[2] = (addrInit >> 8) & 0xff;
+    modbus->querie[3] = addrInit & 0xff;
+    modbus->querie[4] = (len >> 8) & 0xff;
+    modbus->querie[5] = len & 0xff;
+    modbus->querie[6] = 2*len;
 
     int x; for(x=0;x<len;x++) {
-        modbus.querie[7+2*x] = *regs >> 8;
-        modbus.querie[8+2*x] = *regs & 0xff;
+        modbus->querie[7+2*x] = *regs >> 8;
+        modbus->querie[8+2*x] = *regs & 0xff;
         regs++;
 	}
 
-    u16 crc = crc16_MODBUS(modbus.querie, 7+(2*len));
-    modbus.querie[7+2*len] = crc & 0xff;
-    modbus.querie[8+2*len] = (crc >> 8) & 0xff;
+    u16 crc = crc16_MODBUS(modbus->querie, 7+(2*len));
+    modbus->querie[7+2*len] = crc & 0xff;
+    modbus->querie[8+2*len] = (crc >> 8) & 0xff;
 
     // enviar a query para o escravo
-    if (modbus.ps(modbus.querie, 9+2*len) < 0) {
-        modbus.sts = errMODBUS_TX;
+    if (modbus->ps(modbus->port, modbus->querie, 9+2*len) < 0) {
+        modbus->sts = errMODBUS_TX;
         return pdFAIL;
 	}
 
    	// sinalisa que vamos esperar a resposta do escravo
-	modbus.waitResponse = pdTRUE;
+	modbus->waitResponse = pdTRUE;
 
 	#if (MODBUSM_USE_DEBUG == pdON)
 	modbus_printf("modbusM: TX WRs: ");
-	for (x=0;x<9+2*len;x++) modbus_printf("0x%x ", modbus.querie[x]);
+	for (x=0;x<9+2*len;x++) modbus_printf("0x%x ", modbus->querie[x]);
 	modbus_printf(CMD_TERMINATOR);
 	#endif
 
@@ -523,8 +502,8 @@ int modbus_MasterWriteRegisters(int addrSlave, int addrInit, int len, u16* regs)
 // FUNO:		modbus_MasterProcess
 // Descrio: 	Processa as respostas do escravo mediante as requisiies de comandos
 // -------------------------------------------------------------------------------------------------------------------
-void modbus_MasterProcess(void) {
-    int ret = GetPacket(); // retorna
+void modbus_MasterProcess(modbusMaster_t* modbus) {
+    int ret = GetPacket(modbus); // retorna
 		//		Quantidade de bytes recebidos com sucesso
 		//		0: No est esperando pela resposta do escravo
 		//		errMODBUS_BUFFER_OVERFLOW
@@ -534,11 +513,11 @@ void modbus_MasterProcess(void) {
 
 	if (ret == 0 ) return;
    	if (ret < 0 ) {
-   		modbus.sts = ret; 				// salva o erro
-   		modbus.waitResponse = pdFALSE; 	// sinaliza que no estamos esperando pela resposta do escravo
+   		modbus->sts = ret; 				// salva o erro
+   		modbus->waitResponse = pdFALSE; 	// sinaliza que no estamos esperando pela resposta do escravo
 	} else {
-		if (modbus.cmd == 3) 		modbus.sts = ProcessCmd3();	// retorna	pdPASS errMODBUS_ID	errMODBUS_CMD errMODBUS_EXCEPTION errMODBUS_LEN
-		else if (modbus.cmd == 6) 	modbus.sts = ProcessCmd6();	// retorna	pdPASS errMODBUS_ID	errMODBUS_CMD errMODBUS_EXCEPTION errMODBUS_ADDR errMODBUS_VALUE
-		else if (modbus.cmd == 16) 	modbus.sts = ProcessCmd16();// retorna	pdPASS errMODBUS_ID	errMODBUS_CMD errMODBUS_EXCEPTION errMODBUS_ADDR errMODBUS_VALUE
+		if (modbus->cmd == 3) 		modbus->sts = ProcessCmd3(modbus);	// retorna	pdPASS errMODBUS_ID	errMODBUS_CMD errMODBUS_EXCEPTION errMODBUS_LEN
+		else if (modbus->cmd == 6) 	modbus->sts = ProcessCmd6(modbus);	// retorna	pdPASS errMODBUS_ID	errMODBUS_CMD errMODBUS_EXCEPTION errMODBUS_ADDR errMODBUS_VALUE
+		else if (modbus->cmd == 16) 	modbus->sts = ProcessCmd16(modbus);// retorna	pdPASS errMODBUS_ID	errMODBUS_CMD errMODBUS_EXCEPTION errMODBUS_ADDR errMODBUS_VALUE
 	}
 }
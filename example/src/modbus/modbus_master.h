@@ -3,18 +3,64 @@
 
 #include "modbus.h"
 
+typedef struct {
+	void* port;							// Porta passada para as funes abaixo
+	int (*ps)(void* port, u8 *buffer, u16 count); // Ponteiro da funo para envio de bytes
+	int (*gc)(void* port, u8 *ch);			// Ponteiro da funo para recebimento de bytes
+	void(*flushRX)(void* port);			// Ponteiro da funo para limpar os buffers de recepo
+	tTime (*now)(void);					// Funo contadora de tempo decorrido
+	tTime timeout; 						// Tempo de espera pela resposta do escravo aps envio de um comando
 
-void modbus_MasterAppendTime(tTime(*now_func)(void), int timeout);
-int modbus_MasterReadStatus(void);
-int modbus_MasterReadException(void);
-int modbus_MasterReadRegisters(int addrSlave, int addrInit, int len, u16* regs);
-int modbus_MasterWriteRegister(int addrSlave, int addr, u16 value);
-int modbus_MasterWriteRegisters(int addrSlave, int addrInit, int len, u16* regs);
-void modbus_MasterProcess(void);
+	// vars aux para comunicao atual
+	u8 querie[256];						// Buffer aux de transmisso e recepo de dados
+	int slaveID;						// Endereo do escravo alvo no barramento para troca de dados
+	int cmd;							// Comando (funo) solicitado
+	int waitResponse;					// Sinaliza para esperar uma resposta aps envio de um comando para o escravo
+	int rxLen;							// Bytes j recebidos da resposta
+	int firstByte;						// Sinaliza que ainda no foi recebido nenhum byte da resposta
+	tTime timeDataIn;					// Instante do ltimo byte recebido, se o bus ficar em silencio mais que 10ms  porque o escravo terminou a sua transmisso
+	tTime tout;							// Conta o tempo na espera da resposta do escravo
+	u16* regs;							// Ponteiro dos registradores envolvido na troca de dados
+	int len;							// Tamanho do ponteiro
+	int addr;							// Endereo do registrador para ser gravado um valor
+	u16 value;							// Valor a ser gravado no registrador
+	int sts;							// Status da comunicao com o escravo
+											// pdPASS ou >1: Comunicao feita com sucesso
+											// errMODBUS_BUFFER_OVERFLOW: Estourou o tamanho do buffer modbus
+											// errMODBUS_LENPACKET: Tamanho errado do pacote de resposta do escravo
+											// errMODBUS_CRC: Houve erro de CRC na resposta do escravo
+											// errMODBUS_TIMEOUT: Passou o tenpo da espera pela resposta do escravo
+											// errMODBUS_BUSY: Sinaliza que o gerenciador est no processo de comunicao com o escravo
+											// errMODBUS_TX: Erro no envio de bytes ao escravo
+											// errMODBUS_ID: O ID do escravo na sua resposta do escravo no bate com o ID do escravo na solicitao
+											// errMODBUS_ADDR: O endereo do registrador a ser gravado no escravo  invlido
+											// errMODBUS_VALUE: Valor escrito no registrador do escravo no bate com o valor enviado
+											// errMODBUS_CMD: O comando (funo) do pacote de recebimento do escravo no bate com o comando enviado a ele
+											// errMODBUS_EXCEPTION: Sinaliza que o escravo enviou uma exceo, consultar status
+											// errMODBUS_LEN: O tamanho do pacote recebido do escravo no confere ao esperado
+	uint exception;						// Cdigo de exceo do modbus caso for emitido
+											// modbusNO_ERROR: Sem erro de exceo
+											// modbusILLEGAL_FUNCTION: 		O escravo recebeu uma funo que no foi implementada ou no foi habilitada.
+											// modbusILLEGAL_DATA_ADDRESS: O escravo precisou acessar um endereo inexistente.
+											// modbusILLEGAL_DATA_VALUE:  O valor contido no campo de dado no  permitido pelo escravo. Isto indica uma falta de informaes na estrutura do campo de dados.
+											// modbusSLAVE_DEVICE_FAILURE: Um irrecupervel erro ocorreu enquanto o escravo estava tentando executar a ao solicitada.
+} modbusMaster_t;
+
+
+void modbus_MasterAppendTime(modbusMaster_t* modbus, tTime(*now_func)(void), int timeout);
+int modbus_MasterReadStatus(modbusMaster_t* modbus);
+int modbus_MasterReadException(modbusMaster_t* modbus);
+int modbus_MasterReadRegisters(modbusMaster_t* modbus, int addrSlave, int addrInit, int len, u16* regs);
+int modbus_MasterWriteRegister(modbusMaster_t* modbus, int addrSlave, int addr, u16 value);
+int modbus_MasterWriteRegisters(modbusMaster_t* modbus, int addrSlave, int addrInit, int len, u16* regs);
+void modbus_MasterProcess(modbusMaster_t* modbus);
+void modbus_MasterAbort(modbusMaster_t* modbus);
 void modbus_MasterInit(
-	int(*puts_func)(u8* buffer, u16 count),
-	int(*getc_func)(u8* ch),
-	void(*flushRX_func)(void)
+	modbusMaster_t* modbus,
+	void* port,
+	int(*puts_func)(void* port, u8* buffer, u16 count),
+	int(*getc_func)(void* port, u8* ch),
+	void(*flushRX_func)(void* port)
 );
 
 #endif
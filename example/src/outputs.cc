@@ -0,0 +1,221 @@
+#include "timer/timer.h"
+#include "_config_cpu_.h"
+#include "app.h"
+#include "trace/trace.h"
+#include <pthread.h>
+#include <stdlib.h>
+
+// Gravação das saídas com confirmação do RH
+//	O outputs_Apply enfileira os estados pedidos para a thread modbus_Process, sem esperar. A thread copia
+//	reles e saídas digitais para control num único ponto do gerenciador de comandos (outputs_Next), assim as duas
+//	gravações são enviadas em sequência, sem uma leitura dos multímetros entre elas. A cada resposta do RH a thread
+//	chama outputs_Step, que conclui a transação quando as gravações foram confirmadas ou falharam, e avisa quem
+//	pediu pelo apply->done. Uma transação que não termina em OUTPUTS_TIMEOUT ms após o pedido falha.
+//	Com apply->sample a transação só termina com a resposta da primeira leitura dos multímetros enviada após a
+//	confirmação, assim quem grava as saídas recebe uma amostra que já reflete a alteração (read-your-writes).
+//	As transações de um painel são executadas uma por vez, na ordem de chegada (fila tOutputs.tx).
+
+typedef enum {
+	txQUEUED = 0,			// Aguardando a thread copiar os estados para control
+	txWRITE,				// Gravações enviadas, aguardando a confirmação do RH
+	txSAMPLE,				// Gravações confirmadas, aguardando a próxima leitura dos multímetros
+	txDONE
+} tStage;
+
+typedef struct tTransaction {
+	tApply* apply;
+	tStage stage;
+	u64 t0;					// Instante do pedido em us
+	tTrace* trace;
+	struct tTransaction* next;
+} tTransaction;
+
+struct tOutputs {
+	int running;			// Sinaliza que a thread modbus_Process está em execução, ver outputs_Run
+	tTransaction* tx;		// Fila das transações, a primeira é a transação em andamento
+	tTransaction** last;	// Fim da fila
+	pthread_mutex_t lock;
+};
+
+// A transação passa a ser a transação em andamento. Deve ser chamada com o lock adquirido
+static void Activate(tTransaction* tx) {
+	u64 t = now_us();
+	if (tx->apply->mask & outRELAYS) trace_Request(tx->trace, outRELAYS, tx->apply->relays, tx->apply->requested, t);
+	if (tx->apply->mask & outDOUTS) trace_Request(tx->trace, outDOUTS, tx->apply->douts, tx->apply->requested, t);
+}
+
+// Retira da fila a transação, que pode não ser a transação em andamento. Deve ser chamada com o lock adquirido
+static void Remove(tOutputs* outputs, tTransaction* tx) {
+	tTransaction** p = &outputs->tx;
+	while (*p != tx) p = &(*p)->next;
+	*p = tx->next;
+	if (!tx->next) outputs->last = p;
+	if (p == &outputs->tx && outputs->tx) Activate(outputs->tx);
+	free(tx);
+}
+
+// Conclui e retira da fila a transação. Deve ser chamada com o lock adquirido
+static void Done(tOutputs* outputs, tTransaction* tx, int status, const tControl* control) {
+	tApply* apply = tx->apply;
+	Remove(outputs, tx);
+	apply->status = status;
+	apply->relays = control->relaysOld;
+	apply->douts = control->doutsOld;
+	// após o done apply pode ser liberado por quem pediu a gravação
+	apply->done(apply);
+}
+
+// Avança a transação se as saídas pedidas já foram confirmadas pelo RH. Deve ser chamada com o lock adquirido
+static void Confirm(tOutputs* outputs, tTransaction* tx, const tControl* control) {
+	int mask = tx->apply->mask;
+	if ((!(mask & outRELAYS) || control->relaysOld == tx->apply->relays) &&
+		(!(mask & outDOUTS) || control->doutsOld == tx->apply->douts)) {
+		tx->apply->latency = now_us() - tx->t0;
+		tx->apply->status = pdPASS;
+		if (tx->apply->sample) tx->stage = txSAMPLE;
+		else Done(outputs, tx, pdPASS, control);
+	}
+}
+
+// -------------------------------------------------------------------------------------------------------------------
+// FUNÇÃO:		outputs_New
+// Retorna:		Transações das saídas de um painel, ou NULL se não há memória
+// -------------------------------------------------------------------------------------------------------------------
+tOutputs* outputs_New(void) {
+	tOutputs* outputs = (tOutputs*)calloc(1, sizeof(tOutputs));
+	if (outputs) {
+		pthread_mutex_init(&outputs->lock, NULL);
+		outputs->last = &outputs->tx;
+	}
+	return outputs;
+}
+
+// -------------------------------------------------------------------------------------------------------------------
+// FUNÇÃO:		outputs_Free
+// -------------------------------------------------------------------------------------------------------------------
+void outputs_Free(tOutputs* outputs) {
+	if (!outputs) return;
+	pthread_mutex_destroy(&outputs->lock);
+	free(outputs);
+}
+
+// -------------------------------------------------------------------------------------------------------------------
+// FUNÇÃO:		outputs_Apply
+// Descrição: 	Enfileira a gravação das saídas sem esperar a confirmação do RH. Ao concluir a transação a thread
+//				modbus_Process chama apply->done, com o resultado em apply
+// Parametros:	apply: mask, relays e douts com as saídas pedidas e done. Na conclusão status, relays e douts
+//				confirmados e latency. apply deve existir até a chamada do done
+// Retorna:		pdPASS se a transação foi enfileirada, pdFAIL se a thread não está em execução ou não há memória.
+//				Nesse caso done não é chamada e apply já tem o resultado.
+//				No done apply->status é pdPASS se o RH confirmou a gravação, pdFAIL se houve erro na gravação, se a
+//				confirmação não chegou em OUTPUTS_TIMEOUT ms ou se a thread terminou antes.
+//				Com apply->sample a leitura é retornada em apply->read, que fica com seq 0 se a leitura falhou
+// -------------------------------------------------------------------------------------------------------------------
+int outputs_Apply(tPanel* panel, tApply* apply) {
+	tOutputs* outputs = panel->outputs;
+	apply->status = pdFAIL;
+	apply->latency = 0;
+	apply->read.seq = 0;
+
+	pthread_mutex_lock(&outputs->lock);
+	tTransaction* tx = (outputs->running) ? (tTransaction*)calloc(1, sizeof(tTransaction)) : NULL;
+	if (!tx) {
+		apply->relays = panel->control.relaysOld;
+		apply->douts = panel->control.doutsOld;
+		pthread_mutex_unlock(&outputs->lock);
+		return pdFAIL;
+	}
+	tx->apply = apply;
+	tx->stage = txQUEUED;
+	tx->t0 = now_us();
+	tx->trace = panel->trace;
+	*outputs->last = tx;
+	outputs->last = &tx->next;
+	if (outputs->tx == tx) Activate(tx);
+	pthread_mutex_unlock(&outputs->lock);
+	return pdPASS;
+}
+
+// -------------------------------------------------------------------------------------------------------------------
+// FUNÇÃO:		outputs_Cancel
+// Descrição: 	Retira da fila a transação de apply sem concluí-la, usada quando quem pediu a gravação não pode mais
+//				receber o done (ex: ambiente do node encerrado). Os estados já copiados para control continuam sendo gravados
+// Retorna:		pdPASS se a transação foi retirada e done não será chamada, pdFAIL se ela já foi concluída
+// -------------------------------------------------------------------------------------------------------------------
+int outputs_Cancel(tOutputs* outputs, tApply* apply) {
+	pthread_mutex_lock(&outputs->lock);
+	tTransaction* tx = outputs->tx;
+	while (tx && tx->apply != apply) tx = tx->next;
+	if (tx) Remove(outputs, tx);
+	pthread_mutex_unlock(&outputs->lock);
+	return (tx) ? pdPASS : pdFAIL;
+}
+
+// -------------------------------------------------------------------------------------------------------------------
+// FUNÇÃO:		outputs_Run
+// Descrição: 	Chamada pela thread modbus_Process ao iniciar e ao terminar. Ao terminar as transações da fila falham,
+//				exceto a que já teve a gravação confirmada e esperava somente a leitura
+// -------------------------------------------------------------------------------------------------------------------
+void outputs_Run(tOutputs* outputs, const tControl* control, int running) {
+	pthread_mutex_lock(&outputs->lock);
+	outputs->running = running;
+	while (!running && outputs->tx) Done(outputs, outputs->tx, outputs->tx->apply->status, control);
+	pthread_mutex_unlock(&outputs->lock);
+}
+
+// -------------------------------------------------------------------------------------------------------------------
+// FUNÇÃO:		outputs_Next
+// Descrição: 	Chamada pela thread modbus_Process antes de escolher o próximo comando. Copia os estados pedidos
+//				pela transação em andamento para control, que então são gravados antes da próxima leitura
+// -------------------------------------------------------------------------------------------------------------------
+void outputs_Next(tOutputs* outputs, tControl* control) {
+	pthread_mutex_lock(&outputs->lock);
+	tTransaction* tx = outputs->tx;
+	if (tx && tx->stage == txQUEUED) {
+		if (tx->apply->mask & outRELAYS) control->relays = tx->apply->relays;
+		if (tx->apply->mask & outDOUTS) control->douts = tx->apply->douts;
+		tx->stage = txWRITE;
+		Confirm(outputs, tx, control); // sem alterações não há o que gravar
+	}
+	pthread_mutex_unlock(&outputs->lock);
+}
+
+// -------------------------------------------------------------------------------------------------------------------
+// FUNÇÃO:		outputs_Expire
+// Descrição: 	Chamada pela thread modbus_Process a cada ciclo, inclusive enquanto espera uma resposta.
+//				Conclui as transações pedidas há mais de OUTPUTS_TIMEOUT ms
+// -------------------------------------------------------------------------------------------------------------------
+void outputs_Expire(tOutputs* outputs, const tControl* control) {
+	pthread_mutex_lock(&outputs->lock);
+	u64 t = now_us();
+	tTransaction* tx = outputs->tx;
+	while (tx) {
+		tTransaction* next = tx->next;
+		if (t - tx->t0 >= OUTPUTS_TIMEOUT * 1000ull) Done(outputs, tx, tx->apply->status, control);
+		tx = next;
+	}
+	pthread_mutex_unlock(&outputs->lock);
+}
+
+// -------------------------------------------------------------------------------------------------------------------
+// FUNÇÃO:		outputs_Step
+// Descrição: 	Chamada pela thread modbus_Process a cada resposta do RH
+// Parametros:	cmd: Comando respondido
+//				ret: Status da resposta, negativo se houve erro
+//				sample: Amostra publicada pela resposta, somente quando cmd é cmdGET_MULTIMETERS e ret não é negativo
+// -------------------------------------------------------------------------------------------------------------------
+void outputs_Step(tOutputs* outputs, const tControl* control, tCommand cmd, int ret, const tSample* sample) {
+	pthread_mutex_lock(&outputs->lock);
+	tTransaction* tx = outputs->tx;
+	// a leitura que conclui a transação é testada antes das gravações, assim uma mesma resposta não avança as duas etapas
+	if (tx && tx->stage == txSAMPLE) {
+		if (cmd == cmdGET_MULTIMETERS) {
+			if (ret >= 0) tx->apply->read = *sample;
+			Done(outputs, tx, pdPASS, control);
+		}
+	} else if (tx && tx->stage == txWRITE) {
+		if ((cmd == cmdSET_RELAYS || cmd == cmdSET_DOUTS) && ret < 0) Done(outputs, tx, pdFAIL, control);
+		else Confirm(outputs, tx, control);
+	}
+	pthread_mutex_unlock(&outputs->lock);
+}
@@ -1,180 +1,1383 @@
-#include <nan.h>
+#include <node_api.h>
+#include "timer/timer.h"
 #include "uart/uart.h"
+#include "recorder/recorder.h"
+#include "colstore/colstore.h"
+#include "capture/capture.h"
+#include "trace/trace.h"
+#include "json/json.h"
 #include "_config_cpu_.h"
 #include "app.h"
 #include <unistd.h>
 #include <pthread.h>
 #include <stdio.h>
-#include <v8.h>
+#include <stdlib.h>
 #include <string.h>
 #include <errno.h>
 #include <time.h>
 
-using namespace v8;
 
-static  pthread_t id_thread;
+/* Implementao dos mtodos para o objeto que representa o experimento
 
-tControl control; // Varivel compartilhada entre dois processos
+	O addon usa somente a N-API (node_api.h), assim o binrio continua funcionando aps atualizaes do node.
+	Os mtodos que podem bloquear na porta serial, na parada da thread ou no disco retornam uma Promise e so
+	executados fora do loop de eventos (napi_async_work), para no travar o servidor http/socket.io.
 
-/* Implementao dos mtodos para o objeto que representa o experimento
+	Cada objeto Panel tem a sua porta, thread de aquisio, histrico e gravaes, ento um nico processo node
+	pode controlar vrias bancadas em adaptadores seriais diferentes. O prprio mdulo  um Panel na porta
+	COM_PORT, assim require('panel.node').setup() continua funcionando como antes.
+
+	O addon pode ser carregado em worker_threads: o estado do JS (caches, inscries e buffers de serializao) 
+	mantido por ambiente (napi_set_instance_data), enquanto os objetos Panel da mesma porta compartilham a mesma
+	sesso em todo o processo (session_Acquire). Assim um worker pode, por exemplo, exportar o histrico ou
+	calcular agregados da bancada controlada pela thread principal sem bloquear o servidor socket.io.
 
-@function int status Setup(void)
-	@description Configurao e inicializao do protocolo de comunicao Serial + modbus; 
-	@return Retorna 0 se houve algum erro na abertura da porta serial, ou 1 se a configurao foi realizada com sucesso;
+@class Panel(string port, int baud, int slave, int channels)
+	@description Cria um painel com os mesmos mtodos descritos abaixo. A porta s  aberta no Setup ou Attach. Objetos na
+		mesma porta, inclusive em worker_threads, compartilham a sesso e devem usar a mesma configurao; outro processo na
+		mesma porta falha no Setup. A thread  encerrada quando o ltimo objeto da porta  coletado pelo GC;
+	@params Todos opcionais: porta serial (COM_PORT), velocidade em bps (57600), ID do RH no modbus (1) e quantidade de
+		multmetros gerenciados pelo RH, de 1 at 16 (nMULTIMETER_GEREN)
+
+@function Promise<int> status Setup(void)
+	@description Configurao e inicializao do protocolo de comunicao Serial + modbus;
+	@return Resolve 0 se houve algum erro na abertura da porta serial, ou 1 se a configurao foi realizada com sucesso;
 	@params Nenhum
 
-@function int status Run(void) 
+@function int status Run(void)
 	@description Inicializao da thread responsvel pela comunicao com a placa de aquisio e controle;
-	@return Retorna 0 se houve 
+	@return Retorna 0 se houve algum erro na criao da thread ou se o Setup no foi concludo, ou 1 se a thread foi criada;
 	@params Nenhum
-	
-@function int status Update(int digitalOut) 
+
+@function int status Update(int digitalOut)
 	@description Setar sadas do experimento somente;
 	@return Retorna 1 se alteraes da sada foram realizadas com sucesso, -1 se as entradas esto fora da faixa de valores permitida ou 0 se houve algum erro na atribuio das sadas;
 	@params Inteiro representando as sadas digitais (representao binria)
 
-@function string jsonFormattedString GetValues(void): 
+@function Promise<object> report Apply(object outputs)
+	@description Grava reles e/ou sadas digitais numa nica transao: a thread envia as gravaes em sequncia, antes da
+		prxima leitura dos multmetros, e a Promise s  resolvida aps a confirmao do RH ou aps OUTPUTS_TIMEOUT ms.
+		A espera no ocupa o pool de threads do libuv: a thread de aquisio resolve a Promise ao concluir a transao;
+	@return Resolve {applied, relays, douts, ms}: applied  false se a thread no est em execuo, se houve erro na gravao
+		ou se a confirmao no chegou a tempo. relays e douts so os estados confirmados pelo RH e ms o tempo entre o pedido
+		e a confirmao;
+	@params {relays, douts}, ambos opcionais: inteiro com os bits das sadas ou array com um item por sada, o item i
+		verdadeiro liga o bit i
+
+@function Promise<object> report ApplySample(object outputs)
+	@description Igual ao Apply, porm a thread envia a leitura dos multmetros logo aps a confirmao da gravao e a
+		Promise s  resolvida com a resposta dessa leitura. Substitui o Update seguido de GetValues, que retorna valores
+		anteriores  alterao das sadas;
+	@return Resolve {applied, sampled, relays, douts, ms, seq, values}: os campos do Apply, sampled true se a leitura foi
+		recebida, a sequncia da amostra lida e values no formato do GetValues. Se a leitura falhou ou no chegou a tempo
+		sampled  false, seq 0 e values null, mesmo com applied true: as sadas foram gravadas, mas no h leitura
+		posterior a elas;
+	@params Igual ao Apply
+
+@function string jsonFormattedString GetValues(void):
 	@description Coletar Inicializao da thread responsvel pela comunicao com a placa de aquisio e controle;
 	@return Retorna string com dados formatados em json para ser entregue ao cliente seguindo API de definio de dados particular de cada  experimento;
 	@params Nenhum
 
-@function int status Exit(void)
-	@description Inicializao da thread responsvel pela comunicao com a placa de aquisio e controle;
-	@return Retorna 0 se houve algum problema 
+@function int id Subscribe(function callback [, int since])
+	@description Registra callback para ser chamado logo aps cada leitura publicada pela thread, sem polling. Leituras
+		publicadas antes do node executar o callback so agrupadas numa nica chamada com a ltima leitura, as anteriores
+		podem ser pedidas ao GetHistory.
+		Com since a inscrio mantm o seu prprio cursor no histrico e cada chamada recebe todas as leituras publicadas
+		desde a chamada anterior, assim cada inscrio consome no seu ritmo sem perder leituras. Se o callback atrasar mais que
+		o histrico, lost indica as leituras sobrescritas antes da entrega. A thread de aquisio nunca espera pelas inscries;
+	@return Retorna o id da inscrio, ou 0 se no h mais inscries disponveis;
+	@params Funo callback(json, seq), json no mesmo formato do GetValues e seq a sequncia da leitura.
+		Com since json tem o formato do GetHistory e seq  a sequncia da ltima leitura entregue.
+		since: Opcional, ltima sequncia j recebida, 0 para receber tambm todo o histrico disponvel
+
+@function int status Unsubscribe(int id)
+	@description Cancela a inscrio. Sem inscries o addon deixa de manter o loop de eventos do node ativo;
+	@return Retorna 1 se cancelada, ou 0 se o id no existe;
+	@params id retornado pelo Subscribe
+
+@function Int32Array values Values(void)
+	@description Alternativa ao GetValues sem serializao: retorna sempre o mesmo Int32Array sobre um buffer nativo, atualizado
+		no prprio buffer com a ltima amostra publicada a cada ciclo publicado pela thread, na thread do node entre as execues
+		do JS, e tambm a cada chamada. Quem guarda o array l sempre a ltima amostra enquanto o objeto Panel existir. Se os
+		avisos do painel j tm 16 ouvintes (objetos Panel inscritos na mesma porta) o array s  atualizado nas chamadas.
+		Disposio (ver tValuesHeader e tValuesChannel em app.h):
+			[0] seq, [1] quantidade de multmetros, [2] stsCom, [3] relays, [4] douts, [5] tempo ms (parte baixa), [6] tempo ms (parte alta), [7] reservado,
+			a partir de [8], 4 inteiros por multmetro: value, sts, func, stsCom.
+		seq, relays e douts so sem sinal e devem ser lidos com >>> 0. O contedo muda a cada amostra publicada, copiar os valores
+		que precisam ser mantidos;
+	@return Retorna o Int32Array com 8 + 4*16 inteiros. seq  0 enquanto nenhuma amostra foi publicada;
+	@params Nenhum
+
+@function string jsonFormattedString GetHistory([int since])
+	@description Coleta as amostras dos multmetros publicadas aps a sequncia since, da mais antiga para a mais recente;
+	@return Retorna string json {seq, lost, samples:[{seq, time, stsCom, amperemeter, voltmeter}]}. seq  a sequncia a ser
+		passada na prxima chamada, lost a quantidade de amostras aps since que j saram do histrico e time  em ms desde epoch;
+	@params Opcional, ltima sequncia j recebida. Sem parmetro retorna todo o histrico disponvel
+
+@function string jsonFormattedString GetAggregates(void)
+	@description Coleta mnimo, mximo, mdia e RMS de cada multmetro nas janelas mveis de 1s, 10s e 60s,
+		calculados pela thread de aquisio a cada amostra;
+	@return Retorna string json {seq, windows:[{ms, amperemeter:[{count, min, max, mean, rms}], voltmeter:[...]}]};
+	@params Nenhum
+
+@function Promise<object> report Exit(int relays)
+	@description Encerra a thread responsvel pela comunicao com a placa de aquisio e controle e fecha a porta serial.
+		A thread grava os reles passados, termina o frame em andamento (ou o cancela aps SESSION_STOP_TIMEOUT ms) e s ento a porta  fechada.
+		Os clientes anexados por este objeto so desanexados; se restam clientes de outros objetos na mesma porta, inclusive
+		em worker_threads, a thread e a porta continuam em execuo para eles e somente os reles so gravados;
+	@return Resolve {clean, ms}: clean  false se o frame em andamento teve que ser cancelado, ms  o tempo gasto na parada;
+	@params Inteiro representando os reles a serem gravados antes de sair, de 0 a 256. Fora da faixa lana RangeError
+
+@function Promise<object> report Stop([int relays])
+	@description Igual ao Exit, porm mantm a porta serial aberta. Um Run em seguida recria somente a thread,
+		mantendo as informaes do RH e os ltimos valores lidos;
+	@return Resolve {clean, ms} como no Exit;
+	@params Opcional, inteiro representando os reles a serem gravados antes de parar, de 0 a 256 como no Exit
+
+@function int status SetDeadband(int channel, number band[, bool relative])
+	@description Configura a banda morta do multmetro channel, ou de todos com channel -1. O multmetro s  reportado
+		no GetChanges quando o valor se afasta do ltimo valor reportado mais que band (em miliampers ou milivolts, ou em
+		porcentagem do ltimo valor reportado se relative), ou quando muda o status ou a funo. A banda 0 reporta qualquer alterao;
+	@return Retorna 1 se configurado, ou 0 se os parmetros so invlidos;
+	@params ndice do multmetro ou -1, banda morta e opcionalmente se a banda  relativa
+
+@function string json GetChanges([int since])
+	@description Retorna somente os multmetros que saram da banda morta aps a amostra since. Com since 0 retorna
+		todos os multmetros j lidos;
+	@return Retorna uma string json: {"seq":N,"channels":[{"channel":x,"seq":s,"func":f,"sts":t,"value":v}]}, onde seq  a
+		ltima amostra avaliada e deve ser passada como since na prxima chamada. value  0 quando sts  0, como no GetValues;
+	@params Opcional, sequncia da ltima amostra j recebida
+
+@function string json GetStats([bool reset])
+	@description Coleta as estatsticas das transaes modbus de cada escravo e funo desde o incio, ou desde o ltimo reset:
+		comandos enviados, retentativas, erros por tipo e percentis da latncia entre o envio do comando e a resposta validada.
+		Tambm coleta a ocupao do barramento: bytes e frames enviados e recebidos, turnaround mdio do escravo, tempo
+		mdio parado entre comandos e a frao da taxa terica da linha usada na velocidade configurada (utilization).
+		Leitura barata, pode ser chamada periodicamente para ajustar baud, timeouts e o plano de leituras;
+	@return Retorna uma string json: {"transactions":[{"slave":s,"function":f,"requests":n,"retries":r,"responses":v,
+		"errors":{"timeout":t,"crc":c,"exception":e,"lenPacket":l,"other":o},
+		"latency":{"min":a,"mean":m,"p50":x,"p90":y,"p99":z,"p999":w,"max":b}}],
+		"bus":{"baudrate":b,"seconds":s,"txBytes":t,"rxBytes":r,"txFrames":f,"rxFrames":g,"framesPerSecond":p,
+		"turnaround":u,"idle":i,"utilization":x}}, tempos em us e utilization de 0 a 1;
+	@params Opcional, true para zerar as estatsticas aps a leitura
+
+@function string text GetMetrics(void)
+	@description Coleta os contadores do painel no formato texto do Prometheus, para ser servido numa rota /metrics: transaes,
+		retentativas, erros e histograma das latncias por escravo e funo, estado de cada escravo, bytes e tempos do barramento,
+		amostras publicadas, status dos multmetros e tempo de CPU da thread de aquisio. Os contadores s crescem, no so
+		afetados pelo reset do GetStats. No usa lock, pode ser chamada a cada poucos segundos sem afetar a aquisio;
+	@return Retorna o texto no formato de exposio do Prometheus (text/plain; version=0.0.4);
+	@params Nenhum
+
+@function string json GetTrace([bool reset])
+	@description Exporta as ltimas gravaes das sadas (Update, Apply e Stop) com o tempo gasto em cada etapa, da chamada
+		no JS at a confirmao do RH: fila at a thread de aquisio, espera pelo comando em andamento no barramento,
+		transmisso, processamento no RH e recepo da resposta, ver trace/trace.cc;
+	@return Retorna uma string json no formato do Chrome trace, para abrir no chrome://tracing ou no ui.perfetto.dev;
+	@params Opcional, true para descartar as gravaes aps a exportao
+
+@function int status SetLogLevel(string level[, string category])
+	@description Altera o nvel do log da categoria (session, modbus ou samples), ou de todas se category  omitida.
+		O nvel vale para todo o processo, inclusive para os outros painis e worker_threads. As mensagens so escritas
+		no stdout por uma thread de fundo, o log em debug no altera os tempos da aquisio, ver log.cc;
+	@return Retorna 1 se alterado, ou 0 se o nvel ou a categoria no existem;
+	@params Nvel: off, error, warn, info (inicial), debug ou trace, e opcionalmente a categoria
+
+@function Promise<int> status Record(string dir)
+	@description Inicia a gravao de todas as amostras publicadas em segmentos binrios mapeados em memria no diretrio dir,
+		ver o formato em recorder/recorder.h;
+	@return Resolve 1 se a gravao foi iniciada, ou 0 se j est gravando ou no foi possvel criar o arquivo;
+	@params Diretrio onde os segmentos sero gravados
+
+@function Promise<int> dropped StopRecord(void)
+	@description Encerra a gravao e fecha os segmentos;
+	@return Resolve a quantidade de amostras que no puderam ser gravadas;
+	@params Nenhum
+
+@function Promise<int> status Archive(string path)
+	@description Inicia o arquivo comprimido de longa durao das amostras publicadas no arquivo path. As amostras so
+		gravadas em blocos colunares com delta do delta no tempo e diferena em varint nos valores, ver colstore/colstore.cc.
+		Se o arquivo j existe os blocos so acrescentados no fim;
+	@return Resolve 1 se o arquivo foi iniciado, ou 0 se j est arquivando ou no foi possvel abrir o arquivo;
+	@params Caminho do arquivo
+
+@function Promise<int> dropped StopArchive(void)
+	@description Grava o bloco em construo e fecha o arquivo;
+	@return Resolve a quantidade de amostras que no puderam ser gravadas;
+	@params Nenhum
+
+@function Promise<int> status Capture(string path)
+	@description Inicia a captura binria dos quadros RTU enviados e recebidos no barramento no arquivo pcap path,
+		com o instante, a direo e o status de cada quadro, ver o formato em capture/capture.cc;
+	@return Resolve 1 se a captura foi iniciada, ou 0 se j est capturando ou no foi possvel criar o arquivo;
+	@params Caminho do arquivo pcap
+
+@function Promise<int> dropped StopCapture(void)
+	@description Encerra a captura, grava os quadros pendentes e fecha o arquivo;
+	@return Resolve a quantidade de quadros que no puderam ser gravados;
+	@params Nenhum
+
+@function Promise<int> clients Attach(void)
+	@description Anexa um cliente a sesso de aquisio. A UART e a thread so abertas somente para o primeiro cliente,
+		os demais passam a usar os dados j coletados pela thread em execuo;
+	@return Resolve a quantidade de clientes anexados, ou 0 se houve algum erro na abertura da sesso;
+	@params Nenhum
+
+@function Promise<int> clients Detach(void)
+	@description Desanexa um cliente da sesso de aquisio anexado por este objeto, os clientes dos outros objetos no so
+		afetados. A sesso  encerrada aps SESSION_IDLE_GRACE ms sem clientes;
+	@return Resolve a quantidade de clientes que continuam anexados;
 	@params Nenhum
 
 */
 
+// #####################################################################################################################
+// AUX
+// #####################################################################################################################
+
+static napi_value Int(napi_env env, int value) {
+	napi_value result;
+	napi_create_int32(env, value, &result);
+	return result;
+}
+
+static napi_value Uint(napi_env env, uint value) {
+	napi_value result;
+	napi_create_uint32(env, value, &result);
+	return result;
+}
+
+static napi_value String(napi_env env, const char* s, size_t len) {
+	napi_value result;
+	napi_create_string_utf8(env, s, len, &result);
+	return result;
+}
+
+// L at n argumentos em argv, os que no foram passados ficam undefined
+// Retorna a quantidade de argumentos passados
+static size_t Args(napi_env env, napi_callback_info info, napi_value* argv, size_t n) {
+	size_t argc = n;
+	napi_get_cb_info(env, info, &argc, argv, NULL, NULL);
+	return argc;
+}
+
+static int IsType(napi_env env, napi_value value, napi_valuetype type) {
+	napi_valuetype t;
+	if (napi_typeof(env, value, &t) != napi_ok) return pdFALSE;
+	return t == type;
+}
+
+static double Number(napi_env env, napi_value value) {
+	double result = 0;
+	napi_get_value_double(env, value, &result);
+	return result;
+}
+
+static napi_value TypeError(napi_env env, const char* msg) {
+	napi_throw_type_error(env, NULL, msg);
+	return NULL;
+}
+
+static napi_value RangeError(napi_env env, const char* msg) {
+	napi_throw_range_error(env, NULL, msg);
+	return NULL;
+}
+
+// Escrevem um campo em json. name inclui as aspas, os dois pontos e a vrgula se necessria, ex: ",\"seq\":"
+static void JsonUint(tJson* json, const char* name, u64 value) {
+	json_Str(json, name);
+	json_Uint(json, value);
+}
+
+static void JsonInt(tJson* json, const char* name, s64 value) {
+	json_Str(json, name);
+	json_Int(json, value);
+}
+
+// format: formato do printf para o valor, ex: "%.1f"
+static void JsonDouble(tJson* json, const char* name, const char* format, double value) {
+	char text[32];
+	snprintf(text, sizeof(text), format, value);
+	json_Str(json, name);
+	json_Str(json, text);
+}
+
+// Estado de um objeto Panel no JS
+#define nSUBSCRIBERS 32
+typedef struct {
+	napi_ref callback;			// NULL se a posio est livre
+	int history;				// Inscrio com cursor, recebe as leituras no formato do GetHistory
+	uint since;					// Cursor: ltima sequncia entregue
+} tSubscriber;
+
+typedef struct tPanelObject {
+	tPanel* panel;				// NULL aps o EnvCleanup
+	struct tAddon* addon;
+	struct tPanelObject* next;	// Ver tAddon.objects
+	napi_ref wrapper;			// Referncia ao objeto JS, fraca enquanto no h operaes pendentes nem inscries
+	int finalized;				// O objeto JS foi coletado, resta somente finalizar published
+	uint attached;				// Clientes anexados  sesso por este objeto, ver Attach
+
+	napi_ref valuesCache;		// Ver LastValues
+	uint valuesSeq;
+
+	tSubscriber subscribers[nSUBSCRIBERS];	// Ver Published
+	napi_threadsafe_function published;
+	int listening;				// Registrado nos avisos do painel, ver Listen
+
+	int* values;				// Ver Values
+	napi_ref valuesArray;
+	uint valuesArraySeq;
+
+	struct tAsync* applies;		// Gravaes pendentes, ver QueueApply
+} tPanelObject;
 
-NAN_METHOD(Setup) {
-     NanScope();
-     
-     if (modbus_Init() == pdFAIL) {
-   		fprintf(flog, "Erro ao abrir a porta UART"CMD_TERMINATOR);
-		fprintf(flog, "Verifique se essa porta no esteja sendo usada por outro programa,"CMD_TERMINATOR);
-		fprintf(flog, "ou se o usurio tem permisso para usar essa porta: chmod a+rw %s"CMD_TERMINATOR, COM_PORT);
-		NanReturnValue(NanNew(0));
-     }
-      
-    NanReturnValue(NanNew(1)); // outra maneira NanNew<Numer>(1)
-}
-
-NAN_METHOD(Update) {
-	NanScope();
-	if (args.Length() <= 0 ){
-		NanThrowTypeError("Wrong number of arguments");
-		NanReturnUndefined();
-    }
-		
-    if(!args[0]->IsNumber()) {
-		printf("args[0] is not a number");
-		NanThrowTypeError("Wrong type of first argument");
-		NanReturnUndefined();
-    }
-	
-    int switches = args[0]->NumberValue(); 
+// Estado do addon em cada ambiente do node (thread principal e cada worker_thread), ver napi_set_instance_data.
+// Os buffers s so usados na thread do ambiente
+typedef struct tAddon {
+	tPanelObject* defaultPanel;	// Painel do prprio mdulo, usado tambm pelas chamadas sem objeto (ex: mtodos desestruturados)
+	tPanelObject* objects;		// Objetos Panel vivos neste ambiente
+	tJson json;					// Ver LastValues e GetHistory
+	tJson samplesJson;
+	tSample samples[64];
+} tAddon;
+
+static tAddon* Addon(napi_env env) {
+	void* addon = NULL;
+	napi_get_instance_data(env, &addon);
+	return (tAddon*)addon;
+}
+
+static tPanelObject* Self(napi_env env, napi_callback_info info) {
+	napi_value self;
+	void* obj = NULL;
+	napi_get_cb_info(env, info, NULL, NULL, &self, NULL);
+	if (self && napi_unwrap(env, self, &obj) == napi_ok && obj) return (tPanelObject*)obj;
+	return Addon(env)->defaultPanel;
+}
+
+// Operao bloqueante executada no pool de threads do libuv, resolvida numa Promise.
+// O Apply usa a mesma estrutura sem o pool, ver QueueApply
+typedef struct tAsync {
+	napi_async_work work;
+	tPanelObject* self;		// Mantido vivo at a operao terminar
+	napi_deferred deferred;
+	int (*execute)(struct tAsync* a);						// Executada fora da thread do node
+	napi_value (*complete)(napi_env env, struct tAsync* a);	// Valor da Promise, executada na thread do node
+	int status;
+	int relays;				// Reles a serem gravados antes da parada, -1 para manter
+	int closePort;
+	tTime elapsed;
+	uint count;
+	char path[256];
+	tApply apply;
+	napi_threadsafe_function applied;	// Ver QueueApply
+	int refs;
+	struct tAsync* next;	// Ver tPanelObject.applies
+} tAsync;
+
+// As operaes sobre um painel so serializadas pelo session_Lock entre todos os objetos Panel que o compartilham,
+// inclusive os de worker_threads: so raras (controle da sesso e gravao). Painis diferentes executam em paralelo
+static void AsyncExecute(napi_env env, void* data) {
+	tAsync* a = (tAsync*)data;
+	session_Lock(a->self->panel);
+	a->status = a->execute(a);
+	session_Unlock(a->self->panel);
+}
+
+static void AsyncComplete(napi_env env, napi_status status, void* data) {
+	tAsync* a = (tAsync*)data;
+	if (status == napi_ok) napi_resolve_deferred(env, a->deferred, a->complete(env, a));
+	else napi_reject_deferred(env, a->deferred, String(env, "cancelled", NAPI_AUTO_LENGTH));
+	napi_delete_async_work(env, a->work);
+	napi_reference_unref(env, a->self->wrapper, NULL);
+	free(a);
+}
 
+static tAsync* NewAsync(tPanelObject* self, int (*execute)(tAsync*), napi_value (*complete)(napi_env, tAsync*)) {
+	tAsync* a = (tAsync*)calloc(1, sizeof(tAsync));
+	if (a) {
+		a->self = self;
+		a->execute = execute;
+		a->complete = complete;
+	}
+	return a;
+}
+
+// Enfileira a operao e retorna a Promise
+static napi_value Queue(napi_env env, tAsync* a, const char* name) {
+	napi_value promise;
+	if (!a) {
+		napi_throw_error(env, NULL, "Out of memory");
+		return NULL;
+	}
+
+	// o objeto no pode ser coletado enquanto a thread do libuv usa o painel
+	napi_reference_ref(env, a->self->wrapper, NULL);
+	napi_create_promise(env, &a->deferred, &promise);
+	napi_create_async_work(env, NULL, String(env, name, NAPI_AUTO_LENGTH), AsyncExecute, AsyncComplete, a, &a->work);
+	napi_queue_async_work(env, a->work);
+	return promise;
+}
+
+static napi_value CompleteStatus(napi_env env, tAsync* a) {
+	return Int(env, a->status);
+}
+
+static napi_value CompleteCount(napi_env env, tAsync* a) {
+	return Uint(env, a->count);
+}
+
+// Relatrio da parada: {clean: true se o frame em andamento no foi cancelado, ms: tempo gasto na parada}
+static napi_value CompleteReport(napi_env env, tAsync* a) {
+	napi_value report, clean, ms;
+	napi_create_object(env, &report);
+	napi_get_boolean(env, a->status == pdPASS, &clean);
+	napi_create_double(env, a->elapsed, &ms);
+	napi_set_named_property(env, report, "clean", clean);
+	napi_set_named_property(env, report, "ms", ms);
+	return report;
+}
+
+// Resultado da gravao das sadas: {applied, relays, douts, ms}, mais {sampled, seq, values} da leitura seguinte se pedida
+static napi_value CompleteApply(napi_env env, tAsync* a) {
+	napi_value report, applied, sampled, ms, values;
+	napi_create_object(env, &report);
+	napi_get_boolean(env, a->apply.status == pdPASS, &applied);
+	napi_create_double(env, a->apply.latency / 1000.0, &ms);
+	napi_set_named_property(env, report, "applied", applied);
+	napi_set_named_property(env, report, "relays", Uint(env, a->apply.relays));
+	napi_set_named_property(env, report, "douts", Uint(env, a->apply.douts));
+	napi_set_named_property(env, report, "ms", ms);
+	if (!a->apply.sample) return report;
+
+	const tSample* read = &a->apply.read;
+	napi_get_boolean(env, read->seq != 0, &sampled);
+	napi_set_named_property(env, report, "sampled", sampled);
+	if (read->seq) {
+		tJson* json = &a->self->addon->json;
+		json_Reset(json);
+		json_Char(json, '{');
+		snapshot_Multimeters(json, read->multimeter, read->nMultimeters);
+		json_Char(json, '}');
+		values = String(env, json->buf, json->len);
+	} else napi_get_null(env, &values);
+	napi_set_named_property(env, report, "seq", Uint(env, read->seq));
+	napi_set_named_property(env, report, "values", values);
+	return report;
+}
+
+// L a propriedade name de object com os estados das sadas: inteiro com os bits ou array com um item por sada
+// Retorna 1 se lido em out, 0 se a propriedade no foi passada ou -1 se  invlida
+static int Outputs(napi_env env, napi_value object, const char* name, uint* out) {
+	napi_value value, item, flag;
+	bool isArray = false, on;
+	uint len, x;
+
+	if (napi_get_named_property(env, object, name, &value) != napi_ok || IsType(env, value, napi_undefined)) return 0;
+	if (IsType(env, value, napi_number)) {
+		double n = Number(env, value);
+		if (n < 0 || n > 0xffff) return -1;
+		*out = n;
+		return 1;
+	}
+
+	napi_is_array(env, value, &isArray);
+	if (!isArray || napi_get_array_length(env, value, &len) != napi_ok || len > 16) return -1;
+	*out = 0;
+	for (x=0; x<len; x++) {
+		on = false;
+		if (napi_get_element(env, value, x, &item) == napi_ok && napi_coerce_to_bool(env, item, &flag) == napi_ok)
+			napi_get_value_bool(env, flag, &on);
+		if (on) *out |= 1 << x;
+	}
+	return 1;
+}
+
+// #####################################################################################################################
+// FUNCTIONS
+// #####################################################################################################################
+
+static int ExecuteSetup(tAsync* a) {
+	return (session_Open(a->self->panel) == pdFAIL) ? 0 : 1;	// o erro da UART  logado pelo modbus_Init
+}
+
+static napi_value Setup(napi_env env, napi_callback_info info) {
+	return Queue(env, NewAsync(Self(env, info), ExecuteSetup, CompleteStatus), "panel.setup");
+}
+
+static napi_value Update(napi_env env, napi_callback_info info) {
+	u64 t = now_us();
+	napi_value argv[1];
+	if (Args(env, info, argv, 1) < 1) return TypeError(env, "Wrong number of arguments");
+	if (!IsType(env, argv[0], napi_number)) return TypeError(env, "Wrong type of first argument");
+
+	int switches = Number(env, argv[0]);
 	if(switches < 0 || switches > 256){
-		 NanReturnValue(NanNew(-1));
-	}
-	control.relays= switches;	
-    NanReturnValue(NanNew(1));	
-} 
-
-NAN_METHOD(GetValues) {
-	NanScope();
-	int i; 
-	std::string buffer = "{";
-	std::string buffer_amp = "", buffer_volt = "";
-	char value[10];
-	buffer_amp = std::string("\"amperemeter\":[");
-	buffer_volt = std::string("\"voltmeter\":[");
-	
-	for(i =0; i < nMULTIMETER_GEREN ; i++){
-		if(control.multimeter[i].sts)
-				sprintf( value, "%i", control.multimeter[i].value);
-		else	
-				sprintf( value, "%i", 0);
-			
-		
-		if(control.multimeter[i].func){
-			if(i == 0)
-				buffer_amp = buffer_amp + std::string(value) ;
-			else
-				buffer_amp = buffer_amp +  std::string(",") + std::string(value) ;
-			
-			
-		}else{
-			if(i == nMULTIMETER_GEREN-1)
-				buffer_volt = buffer_volt +  std::string(value) ;
-			else
-				buffer_volt = buffer_volt +  std::string(value) + std::string(",");
-			
-			
-		}				
-	}
-	buffer_amp = buffer_amp + std::string("]");
-    buffer_volt = buffer_volt + std::string("]");
-	
-    NanReturnValue(NanNew("{" + buffer_amp + "," + buffer_volt + "}"));	
-}
-
-
-NAN_METHOD(Run) {
-	NanScope();
-
-    init_control_tad();
-	
-        int rthr = pthread_create(&id_thread, NULL, modbus_Process, (void *) 0); // fica funcionando at que receba um comando via WEB para sair		
-		if(rthr){
-			printf("Unable to create thread void * modbus_Process");
-			NanReturnValue(NanNew(0));
+		 return Int(env, -1);
+	}
+	tPanel* panel = Self(env, info)->panel;
+	trace_Request(panel->trace, outRELAYS, switches, t, t); // antes da thread poder enviar a gravao
+	panel->control.relays= switches;
+	return Int(env, 1);
+}
+
+// a pode ser liberado quando a transao foi concluda e a funo applied finalizada, em qualquer ordem
+static void ApplyRelease(tAsync* a) {
+	if (__atomic_sub_fetch(&a->refs, 1, __ATOMIC_ACQ_REL) == 0) free(a);
+}
+
+// Chamada pela thread de aquisio ao concluir a transao, a Promise  resolvida no Applied
+static void ApplyDone(tApply* apply) {
+	tAsync* a = (tAsync*)apply->context;
+	napi_call_threadsafe_function(a->applied, NULL, napi_tsfn_nonblocking);
+	napi_release_threadsafe_function(a->applied, napi_tsfn_release);
+	ApplyRelease(a);
+}
+
+// Retira a gravao das pendentes do objeto
+static void Unlink(tAsync* a) {
+	tAsync** p = &a->self->applies;
+	while (*p && *p != a) p = &(*p)->next;
+	if (*p) *p = a->next;
+}
+
+// Cancela a gravao que ainda no foi concluda, assim a thread no chama mais a funo applied
+static void ApplyCancel(tAsync* a) {
+	if (a->self->panel && outputs_Cancel(a->self->panel->outputs, &a->apply) == pdPASS) ApplyRelease(a);
+}
+
+static void Applied(napi_env env, napi_value js_cb, void* context, void* data) {
+	tAsync* a = (tAsync*)context;
+	if (!env) return;
+	napi_resolve_deferred(env, a->deferred, a->complete(env, a));
+	if (!a->self) return;	// ambiente encerrado, ver Release
+	Unlink(a);
+	napi_reference_unref(env, a->self->wrapper, NULL);
+}
+
+// Aps a concluso, ou antes dela se o ambiente do node foi encerrado. No segundo caso a thread no pode mais chamar
+// a funo, ento a transao  cancelada
+static void AppliedFinalize(napi_env env, void* data, void* hint) {
+	tAsync* a = (tAsync*)data;
+	if (a->self) {
+		Unlink(a);
+		ApplyCancel(a);
+	}
+	ApplyRelease(a);
+}
+
+// L as sadas do primeiro argumento e enfileira a gravao.
+// A transao pode esperar o RH por at OUTPUTS_TIMEOUT ms, ento no ocupa o pool do libuv nem o session_Lock:
+// outputs_Apply j executa as transaes uma por vez e a thread de aquisio resolve a Promise pela funo applied
+static napi_value QueueApply(napi_env env, napi_callback_info info, int sample, const char* name) {
+	napi_value argv[1], promise;
+	if (Args(env, info, argv, 1) < 1) return TypeError(env, "Wrong number of arguments");
+	if (!IsType(env, argv[0], napi_object)) return TypeError(env, "Wrong type of first argument");
+
+	tAsync* a = NewAsync(Self(env, info), NULL, CompleteApply);
+	if (!a) return Queue(env, a, name);
+	a->apply.requested = now_us();
+	int relays = Outputs(env, argv[0], "relays", &a->apply.relays);
+	int douts = Outputs(env, argv[0], "douts", &a->apply.douts);
+	if (relays < 0 || douts < 0) {
+		free(a);
+		return RangeError(env, "Outputs must be an integer between 0 and 0xFFFF or an array of up to 16 items");
+	}
+	if (!relays && !douts) {
+		free(a);
+		return TypeError(env, "No outputs to apply, pass relays and/or douts");
+	}
+	if (relays) a->apply.mask |= outRELAYS;
+	if (douts) a->apply.mask |= outDOUTS;
+	a->apply.sample = sample;
+	a->apply.done = ApplyDone;
+	a->apply.context = a;
+
+	if (napi_create_threadsafe_function(env, NULL, NULL, String(env, name, NAPI_AUTO_LENGTH),
+			0, 1, a, AppliedFinalize, a, Applied, &a->applied) != napi_ok) {
+		free(a);
+		napi_throw_error(env, NULL, "Unable to create the completion function");
+		return NULL;
+	}
+	a->refs = 2;
+	// o objeto no pode ser coletado enquanto a transao usa o painel
+	napi_reference_ref(env, a->self->wrapper, NULL);
+	a->next = a->self->applies;
+	a->self->applies = a;
+	napi_create_promise(env, &a->deferred, &promise);
+	// a thread no est em execuo: o resultado j est em apply e a Promise  resolvida da mesma forma
+	if (outputs_Apply(a->self->panel, &a->apply) == pdFAIL) ApplyDone(&a->apply);
+	return promise;
+}
+
+static napi_value Apply(napi_env env, napi_callback_info info) {
+	return QueueApply(env, info, pdFALSE, "panel.apply");
+}
+
+static napi_value ApplySample(napi_env env, napi_callback_info info) {
+	return QueueApply(env, info, pdTRUE, "panel.applysample");
+}
+
+// A string da ltima amostra  mantida (na posio 0 de valuesCache) e reaproveitada por todas as chamadas at a
+// prxima amostra publicada, ento N clientes consultando na mesma amostra no serializam nem copiam o json novamente
+static napi_value LastValues(napi_env env, tPanelObject* self) {
+	uint len, seq;
+	napi_value cache, result;
+
+	const char* snapshot = snapshot_Acquire(self->panel->snapshot, &len, &seq);
+	if (!snapshot) {
+		// nenhuma leitura publicada ainda, somente os valores iniciais
+		tJson* json = &self->addon->json;
+		json_Reset(json);
+		json_Char(json, '{');
+		snapshot_Multimeters(json, self->panel->control.multimeter, self->panel->nMultimeters);
+		json_Char(json, '}');
+		return String(env, json->buf, json->len);
+	}
+
+	if (!self->valuesCache) {
+		napi_create_array_with_length(env, 1, &cache);
+		napi_create_reference(env, cache, 1, &self->valuesCache);
+		self->valuesSeq = 0;
+	} else napi_get_reference_value(env, self->valuesCache, &cache);
+
+	if (seq != self->valuesSeq) {
+		result = String(env, snapshot, len);
+		napi_set_element(env, cache, 0, result);
+		self->valuesSeq = seq;
+	} else napi_get_element(env, cache, 0, &result);
+	snapshot_Release(self->panel->snapshot);
+	return result;
+}
+
+static napi_value GetValues(napi_env env, napi_callback_info info) {
+	return LastValues(env, Self(env, info));
+}
+
+// Resposta do GetHistory com as amostras publicadas aps since
+// seq: Retorna a sequncia a ser passada na prxima leitura
+static napi_value History(napi_env env, tPanelObject* self, uint since, uint* seq) {
+	tHistory* history = self->panel->history;
+	tSample* samples = self->addon->samples;
+	tJson* json = &self->addon->json;
+	tJson* samplesJson = &self->addon->samplesJson;
+	uint lost = 0, more = 0;
+
+	// seq e lost s so conhecidos aps a leitura, ento as amostras so escritas antes em samplesJson
+	json_Reset(samplesJson);
+	uint last = history_Last(history);
+	int x, n = history_Read(history, since, samples, 64, &lost);
+	while (n > 0) {
+		for(x=0; x<n; x++) {
+			if (samplesJson->len > 0) json_Char(samplesJson, ',');
+			json_Str(samplesJson, "{\"seq\":");
+			json_Uint(samplesJson, samples[x].seq);
+			json_Str(samplesJson, ",\"time\":");
+			json_Uint(samplesJson, samples[x].time / 1000);
+			json_Str(samplesJson, ",\"stsCom\":");
+			json_Int(samplesJson, samples[x].stsCom);
+			json_Char(samplesJson, ',');
+			snapshot_Multimeters(samplesJson, samples[x].multimeter, samples[x].nMultimeters);
+			json_Char(samplesJson, '}');
 		}
-	
-	NanReturnValue(NanNew(1));
+		last = samples[n-1].seq;
+		// a thread de aquisio no espera a leitura, ento tambm pode sobrescrever amostras entre as chamadas
+		n = history_Read(history, last, samples, 64, &more);
+		lost += more;
+	}
+
+	json_Reset(json);
+	json_Str(json, "{\"seq\":");
+	json_Uint(json, last);
+	json_Str(json, ",\"lost\":");
+	json_Uint(json, lost);
+	json_Str(json, ",\"samples\":[");
+	json_Raw(json, samplesJson->buf, samplesJson->len);
+	json_Str(json, "]}");
+	*seq = last;
+	return String(env, json->buf, json->len);
+}
+
+// Callbacks registrados pelo Subscribe. A thread de aquisio acorda o loop do node pela napi_threadsafe_function
+// published, e os callbacks so chamados em Published na thread do node
+static void Notify(void* context) {
+	napi_call_threadsafe_function(((tPanelObject*)context)->published, NULL, napi_tsfn_nonblocking);
 }
 
+static void Published(napi_env env, napi_value js_cb, void* context, void* data) {
+	tPanelObject* self = (tPanelObject*)context;
+	if (!env || self->finalized || !self->panel) return;
+	events_Delivered(self->panel->events, self);
+	// o array do Values acompanha cada ciclo publicado, os callbacks j o recebem atualizado
+	if (self->valuesArray) self->valuesArraySeq = snapshot_Values(self->panel->snapshot, self->values, self->valuesArraySeq);
 
-NAN_METHOD(Exit) {
-	NanScope();
-    if (args.Length() <= 0 ){
-		NanThrowTypeError("Wrong number of arguments");
-		NanReturnUndefined();
-    }
-		
-    if(!args[0]->IsNumber()) {
-		NanThrowTypeError("Wrong type of first argument");
-		NanReturnUndefined();
-    }
-    
-	init_control_tad();
-    int switches = args[0]->NumberValue(); 
-	
-	printf("Relays: %i"CMD_TERMINATOR,switches);
+	napi_value last[2] = { NULL, NULL }, history[2] = { NULL, NULL }, global, callback;
+	uint since = 0, seq = 0;
+	napi_get_global(env, &global);
 
-    if(switches < 0 || switches > 256){
-		 NanReturnValue(NanNew("{'error':'invalid input'}"));
+	// o callback pode cancelar a sua prpria inscrio, ento cada posio  conferida na hora da chamada
+	int x; for (x=0; x<nSUBSCRIBERS; x++) {
+		tSubscriber* s = &self->subscribers[x];
+		if (!s->callback) continue;
+		napi_get_reference_value(env, s->callback, &callback);
+		if (!s->history) {
+			if (!last[0]) {
+				last[0] = LastValues(env, self);
+				last[1] = Uint(env, self->valuesSeq);
+			}
+			napi_call_function(env, global, callback, 2, last, NULL);
+			continue;
+		}
+		// as inscries em dia tm o mesmo cursor, ento normalmente o json  montado uma nica vez
+		if (!history[0] || s->since != since) {
+			since = s->since;
+			history[0] = History(env, self, since, &seq);
+			history[1] = Uint(env, seq);
+		}
+		if (seq == s->since) continue;
+		s->since = seq;
+		napi_call_function(env, global, callback, 2, history, NULL);
 	}
-	control.relays= switches;
-	printf("Relays: %i"CMD_TERMINATOR,switches);
-	sleep(0.5);
-	control.exit =1;
-       
-	printf("Fechando programa"CMD_TERMINATOR);
-	fclose(flog);
+}
 
-	uart_Close();
-	NanReturnValue(NanNew("1"));
+// O node finaliza a funo ao encerrar, ou aps o PanelFinalize. A thread de aquisio no pode mais cham-la
+static void PublishedFinalize(napi_env env, void* data, void* hint) {
+	tPanelObject* self = (tPanelObject*)data;
+	self->published = NULL;
+	if (self->finalized) free(self);
+	else if (self->panel) {
+		events_Stop(self->panel->events, self);
+		self->listening = pdFALSE;
+	}
+}
+
+// Registra o objeto nos avisos do painel, usados pelas inscries e pelo array do Values
+// Retorna pdPASS se o objeto recebe os avisos, pdFAIL se no foi possvel criar published ou o painel j tem
+// nEVENTS_LISTENERS ouvintes
+static int Listen(napi_env env, tPanelObject* self) {
+	if (!self->published) {
+		if (napi_create_threadsafe_function(env, NULL, NULL, String(env, "panel.published", NAPI_AUTO_LENGTH),
+				0, 1, self, PublishedFinalize, self, Published, &self->published) != napi_ok)
+			return pdFAIL;
+		// a funo nasce referenciada, ela s deve manter o loop do node vivo enquanto h inscries
+		napi_unref_threadsafe_function(env, self->published);
+	}
+	if (!self->listening && events_Start(self->panel->events, Notify, self) == pdFAIL) return pdFAIL;
+	self->listening = pdTRUE;
+	return pdPASS;
+}
+
+static napi_value Subscribe(napi_env env, napi_callback_info info) {
+	napi_value argv[2];
+	size_t argc = Args(env, info, argv, 2);
+	if (argc < 1) return TypeError(env, "Wrong number of arguments");
+	if (!IsType(env, argv[0], napi_function)) return TypeError(env, "Wrong type of first argument");
+	if (argc > 1 && !IsType(env, argv[1], napi_number)) return TypeError(env, "Wrong type of second argument");
+	tPanelObject* self = Self(env, info);
+
+	int x, n = 0;
+	for (x=0; x<nSUBSCRIBERS; x++)
+		if (self->subscribers[x].callback) n++;
+	for (x=0; x<nSUBSCRIBERS; x++)
+		if (!self->subscribers[x].callback) break;
+	if (x == nSUBSCRIBERS) return Int(env, 0);
+
+	if (Listen(env, self) == pdFAIL) return Int(env, 0);
+	if (n == 0) {
+		// com inscries o objeto continua vivo mesmo sem referncias no JS
+		napi_reference_ref(env, self->wrapper, NULL);
+		napi_ref_threadsafe_function(env, self->published);
+	}
+	napi_create_reference(env, argv[0], 1, &self->subscribers[x].callback);
+	self->subscribers[x].history = (argc > 1);
+	self->subscribers[x].since = (argc > 1) ? (uint)Number(env, argv[1]) : 0;
+	// leituras j publicadas aps since so entregues sem esperar a prxima
+	if (argc > 1 && self->subscribers[x].since != history_Last(self->panel->history)) Notify(self);
+	return Int(env, x + 1);
+}
+
+static napi_value Unsubscribe(napi_env env, napi_callback_info info) {
+	napi_value argv[1];
+	if (Args(env, info, argv, 1) < 1 || !IsType(env, argv[0], napi_number)) return TypeError(env, "Wrong type of first argument");
+	tPanelObject* self = Self(env, info);
+
+	int id = Number(env, argv[0]);
+	if (id < 1 || id > nSUBSCRIBERS || !self->subscribers[id-1].callback) return Int(env, 0);
+	napi_delete_reference(env, self->subscribers[id-1].callback);
+	self->subscribers[id-1].callback = NULL;
+
+	int x; for (x=0; x<nSUBSCRIBERS; x++)
+		if (self->subscribers[x].callback) break;
+	if (x == nSUBSCRIBERS) {
+		// o array do Values continua sendo atualizado pelos avisos
+		if (!self->valuesArray) {
+			events_Stop(self->panel->events, self);
+			self->listening = pdFALSE;
+		}
+		napi_unref_threadsafe_function(env, self->published);
+		napi_reference_unref(env, self->wrapper, NULL);
+	}
+	return Int(env, 1);
+}
+
+static void FreeBuffer(napi_env env, void* data, void* hint) {
+	free(data);
+}
+
+// Buffer nativo do Int32Array retornado pelo Values. O array  criado uma nica vez sobre o buffer, e o Published a cada
+// amostra publicada e cada chamada somente copiam a nova amostra no prprio buffer, sem criar objetos no heap do V8.
+// O buffer  liberado pelo GC junto com o array, que pode sobreviver ao objeto Panel
+static napi_value Values(napi_env env, napi_callback_info info) {
+	tPanelObject* self = Self(env, info);
+	napi_value array;
+
+	if (!self->valuesArray) {
+		napi_value buffer;
+		int* values = (int*)calloc(lenVALUES, sizeof(int));
+		if (!values) {
+			napi_throw_error(env, NULL, "Out of memory");
+			return NULL;
+		}
+		if (napi_create_external_arraybuffer(env, values, lenVALUES*sizeof(int), FreeBuffer, NULL, &buffer) != napi_ok) {
+			free(values);
+			napi_throw_error(env, NULL, "External buffers are not supported");
+			return NULL;
+		}
+		napi_create_typedarray(env, napi_int32_array, lenVALUES, buffer, 0, &array);
+		napi_create_reference(env, array, 1, &self->valuesArray);
+		self->values = values;
+		// sem posio livre nos avisos o array  atualizado somente nas chamadas
+		Listen(env, self);
+	} else napi_get_reference_value(env, self->valuesArray, &array);
+
+	self->valuesArraySeq = snapshot_Values(self->panel->snapshot, self->values, self->valuesArraySeq);
+	return array;
+}
+
+// Lista das estatsticas dos multimetros com a funo func
+// Mesma separao do GetValues: func 1 em amperemeter e 0 em voltmeter
+static void Aggregates(tJson* json, const tAggregate* aggregates, int n, int func) {
+	int x, first = pdTRUE;
+	json_Char(json, '[');
+	for (x=0; x<n; x++) {
+		if ((aggregates[x].func != 0) != func) continue;
+		if (!first) json_Char(json, ',');
+		first = pdFALSE;
+		JsonUint(json, "{\"count\":", aggregates[x].count);
+		JsonInt(json, ",\"min\":", aggregates[x].min);
+		JsonInt(json, ",\"max\":", aggregates[x].max);
+		JsonDouble(json, ",\"mean\":", "%.1f", aggregates[x].mean);
+		JsonDouble(json, ",\"rms\":", "%.1f", aggregates[x].rms);
+		json_Char(json, '}');
+	}
+	json_Char(json, ']');
+}
+
+static napi_value GetAggregates(napi_env env, napi_callback_info info) {
+	tAggregate aggregates[nMULTIMETER];
+	tPanelObject* self = Self(env, info);
+	tJson* json = &self->addon->json;
+	tJson* windows = &self->addon->samplesJson;
+	uint seq = 0;
+	int w;
+
+	// seq s  conhecido aps a leitura das janelas, ento elas so escritas antes em samplesJson
+	json_Reset(windows);
+	for (w=0; w<nAGGREGATE_WINDOWS; w++) {
+		int n = aggregate_Read(self->panel->aggregator, w, aggregates, &seq);
+		if (w > 0) json_Char(windows, ',');
+		JsonUint(windows, "{\"ms\":", aggregate_Window(w));
+		json_Str(windows, ",\"amperemeter\":");
+		Aggregates(windows, aggregates, n, 1);
+		json_Str(windows, ",\"voltmeter\":");
+		Aggregates(windows, aggregates, n, 0);
+		json_Char(windows, '}');
+	}
+
+	json_Reset(json);
+	JsonUint(json, "{\"seq\":", seq);
+	json_Str(json, ",\"windows\":[");
+	json_Raw(json, windows->buf, windows->len);
+	json_Str(json, "]}");
+	return String(env, json->buf, json->len);
+}
+
+static napi_value GetHistory(napi_env env, napi_callback_info info) {
+	uint since = 0;
+	napi_value argv[1];
+
+	if (Args(env, info, argv, 1) > 0) {
+		if(!IsType(env, argv[0], napi_number)) return TypeError(env, "Wrong type of first argument");
+		since = Number(env, argv[0]);
+	}
+	return History(env, Self(env, info), since, &since);
+}
+
+static napi_value SetDeadband(napi_env env, napi_callback_info info) {
+	napi_value argv[3];
+	size_t argc = Args(env, info, argv, 3);
+	if (argc < 2) return TypeError(env, "Wrong number of arguments");
+	if (!IsType(env, argv[0], napi_number) || !IsType(env, argv[1], napi_number)) return TypeError(env, "Wrong type of arguments");
+
+	bool relative = false;
+	napi_value flag;
+	if (argc > 2 && napi_coerce_to_bool(env, argv[2], &flag) == napi_ok) napi_get_value_bool(env, flag, &relative);
+	return Int(env, deadband_Set(Self(env, info)->panel->deadband, Number(env, argv[0]), relative ? deadbandRELATIVE : deadbandABSOLUTE, Number(env, argv[1])));
+}
+
+static napi_value GetChanges(napi_env env, napi_callback_info info) {
+	tChange changes[nMULTIMETER];
+	uint since = 0, last = 0;
+	napi_value argv[1];
+
+	if (Args(env, info, argv, 1) > 0) {
+		if(!IsType(env, argv[0], napi_number)) return TypeError(env, "Wrong type of first argument");
+		since = Number(env, argv[0]);
+	}
+
+	tPanelObject* self = Self(env, info);
+	tJson* json = &self->addon->json;
+	int x, n = deadband_Changes(self->panel->deadband, since, changes, &last);
+	json_Reset(json);
+	JsonUint(json, "{\"seq\":", last);
+	json_Str(json, ",\"channels\":[");
+	for (x=0; x<n; x++) {
+		const tMultimeter* m = &changes[x].multimeter;
+		if (x > 0) json_Char(json, ',');
+		JsonUint(json, "{\"channel\":", changes[x].channel);
+		JsonUint(json, ",\"seq\":", changes[x].seq);
+		JsonInt(json, ",\"func\":", m->func);
+		JsonInt(json, ",\"sts\":", m->sts);
+		JsonInt(json, ",\"value\":", m->sts ? m->value : 0);
+		json_Char(json, '}');
+	}
+	json_Str(json, "]}");
+	return String(env, json->buf, json->len);
+}
+
+static napi_value GetStats(napi_env env, napi_callback_info info) {
+	tStats stats[nSTATS];
+	tBus bus;
+	napi_value argv[1];
+
+	bool reset = false;
+	napi_value flag;
+	if (Args(env, info, argv, 1) > 0 && napi_coerce_to_bool(env, argv[0], &flag) == napi_ok) napi_get_value_bool(env, flag, &reset);
+
+	tPanelObject* self = Self(env, info);
+	tPanel* panel = self->panel;
+	tJson* json = &self->addon->json;
+	json_Reset(json);
+	json_Str(json, "{\"transactions\":[");
+	int x, n = stats_Read(panel->stats, stats, &bus, reset);
+	for (x=0; x<n; x++) {
+		const tStats* s = &stats[x];
+		if (x > 0) json_Char(json, ',');
+		JsonInt(json, "{\"slave\":", s->slave);
+		JsonInt(json, ",\"function\":", s->function);
+		JsonUint(json, ",\"requests\":", s->requests);
+		JsonUint(json, ",\"retries\":", s->retries);
+		JsonUint(json, ",\"responses\":", s->responses);
+		JsonUint(json, ",\"errors\":{\"timeout\":", s->timeouts);
+		JsonUint(json, ",\"crc\":", s->crcs);
+		JsonUint(json, ",\"exception\":", s->exceptions);
+		JsonUint(json, ",\"lenPacket\":", s->lenPackets);
+		JsonUint(json, ",\"other\":", s->others);
+		JsonUint(json, "},\"latency\":{\"min\":", s->min);
+		JsonUint(json, ",\"mean\":", s->mean);
+		JsonUint(json, ",\"p50\":", s->p50);
+		JsonUint(json, ",\"p90\":", s->p90);
+		JsonUint(json, ",\"p99\":", s->p99);
+		JsonUint(json, ",\"p999\":", s->p999);
+		JsonUint(json, ",\"max\":", s->max);
+		json_Str(json, "}}");
+	}
+
+	uint bps = uart_Bps(panel->baudrate);
+	double seconds = bus.elapsed / 1e6;
+	JsonUint(json, "],\"bus\":{\"baudrate\":", bps);
+	JsonDouble(json, ",\"seconds\":", "%.3f", seconds);
+	JsonUint(json, ",\"txBytes\":", bus.txBytes);
+	JsonUint(json, ",\"rxBytes\":", bus.rxBytes);
+	JsonUint(json, ",\"txFrames\":", bus.txFrames);
+	JsonUint(json, ",\"rxFrames\":", bus.rxFrames);
+	JsonDouble(json, ",\"framesPerSecond\":", "%.1f", seconds > 0 ? (bus.txFrames + bus.rxFrames) / seconds : 0);
+	JsonUint(json, ",\"turnaround\":", bus.turnaround);
+	JsonUint(json, ",\"idle\":", bus.idle);
+	JsonDouble(json, ",\"utilization\":", "%.4f", stats_Utilization(&bus, bps));
+	json_Str(json, "}}");
+	return String(env, json->buf, json->len);
+}
+
+static napi_value GetMetrics(napi_env env, napi_callback_info info) {
+	tPanelObject* self = Self(env, info);
+	tJson* text = &self->addon->json;
+	json_Reset(text);
+	stats_Metrics(self->panel, text);
+	return String(env, text->buf, text->len);
+}
+
+static napi_value GetTrace(napi_env env, napi_callback_info info) {
+	napi_value argv[1];
+	bool reset = false;
+	napi_value flag;
+	if (Args(env, info, argv, 1) > 0 && napi_coerce_to_bool(env, argv[0], &flag) == napi_ok) napi_get_value_bool(env, flag, &reset);
+
+	tPanelObject* self = Self(env, info);
+	tJson* json = &self->addon->json;
+	json_Reset(json);
+	trace_Json(self->panel->trace, json, self->panel->port, reset);
+	return String(env, json->buf, json->len);
+}
+
+static napi_value SetLogLevel(napi_env env, napi_callback_info info) {
+	napi_value argv[2];
+	char name[16];
+	size_t argc = Args(env, info, argv, 2);
+	if (argc < 1) return TypeError(env, "Wrong number of arguments");
+	if (!IsType(env, argv[0], napi_string)) return TypeError(env, "Wrong type of first argument");
+
+	napi_get_value_string_utf8(env, argv[0], name, sizeof(name), NULL);
+	int level = log_Level(name);
+	int category = -1;
+	if (argc > 1 && !IsType(env, argv[1], napi_undefined)) {
+		if (!IsType(env, argv[1], napi_string)) return TypeError(env, "Wrong type of second argument");
+		napi_get_value_string_utf8(env, argv[1], name, sizeof(name), NULL);
+		category = log_Category(name);
+		if (category < 0) return Int(env, 0);
+	}
+	if (level < 0) return Int(env, 0);
+
+	log_SetLevel(category, level);
+	return Int(env, 1);
+}
+
+static napi_value Run(napi_env env, napi_callback_info info) {
+	if (session_Start(Self(env, info)->panel) == pdFAIL) {
+		LOG(logSESSION, logERROR, "Unable to create thread void * modbus_Process");
+		return Int(env, 0);
+	}
+
+	return Int(env, 1);
+}
+
+static int ExecuteStop(tAsync* a) {
+	if (a->relays >= 0) a->self->panel->control.relays = a->relays; // gravado pela thread antes dela sair
+	// o Exit s encerra a sesso se no restaram clientes de outros objetos
+	if (a->closePort) for (; a->self->attached; a->self->attached--) session_Detach(a->self->panel);
+	return session_Stop(a->self->panel, a->closePort, &a->elapsed);
+}
+
+static napi_value Exit(napi_env env, napi_callback_info info) {
+	napi_value argv[1];
+	if (Args(env, info, argv, 1) < 1) return TypeError(env, "Wrong number of arguments");
+	if (!IsType(env, argv[0], napi_number)) return TypeError(env, "Wrong type of first argument");
+
+	int switches = Number(env, argv[0]);
+	if (switches < 0 || switches > 256) return RangeError(env, "Relays must be between 0 and 256");
+	LOG(logSESSION, logINFO, "Fechando programa, relays: %i", switches);
+	tAsync* a = NewAsync(Self(env, info), ExecuteStop, CompleteReport);
+	if (a) {
+		a->relays = switches;
+		a->closePort = pdTRUE;
+	}
+	return Queue(env, a, "panel.exit");
+}
+
+static napi_value Stop(napi_env env, napi_callback_info info) {
+	napi_value argv[1];
+	int switches = -1;
+
+	if (Args(env, info, argv, 1) > 0) {
+		if(!IsType(env, argv[0], napi_number)) return TypeError(env, "Wrong type of first argument");
+		switches = Number(env, argv[0]);
+		if (switches < 0 || switches > 256) return RangeError(env, "Relays must be between 0 and 256");
+	}
+
+	tAsync* a = NewAsync(Self(env, info), ExecuteStop, CompleteReport);
+	if (a) a->relays = switches;
+	return Queue(env, a, "panel.stop");
+}
+
+// L o primeiro argumento string em a->path
+static int PathArg(napi_env env, napi_callback_info info, tAsync* a) {
+	napi_value argv[1];
+	if (Args(env, info, argv, 1) < 1) {
+		TypeError(env, "Wrong number of arguments");
+		return pdFAIL;
+	}
+	if (!IsType(env, argv[0], napi_string)) {
+		TypeError(env, "Wrong type of first argument");
+		return pdFAIL;
+	}
+	if (a) napi_get_value_string_utf8(env, argv[0], a->path, sizeof(a->path), NULL);
+	return pdPASS;
+}
+
+static int ExecuteRecord(tAsync* a) {
+	return recorder_Start(a->self->panel->recorder, a->path);
+}
+
+static napi_value Record(napi_env env, napi_callback_info info) {
+	tAsync* a = NewAsync(Self(env, info), ExecuteRecord, CompleteStatus);
+	if (PathArg(env, info, a) == pdFAIL) {
+		free(a);
+		return NULL;
+	}
+	return Queue(env, a, "panel.record");
+}
+
+static int ExecuteStopRecord(tAsync* a) {
+	a->count = recorder_Dropped(a->self->panel->recorder);
+	recorder_Stop(a->self->panel->recorder);
+	return pdPASS;
+}
+
+static napi_value StopRecord(napi_env env, napi_callback_info info) {
+	return Queue(env, NewAsync(Self(env, info), ExecuteStopRecord, CompleteCount), "panel.stoprecord");
+}
+
+static int ExecuteArchive(tAsync* a) {
+	return archive_Start(a->self->panel->archive, a->path);
+}
+
+static napi_value Archive(napi_env env, napi_callback_info info) {
+	tAsync* a = NewAsync(Self(env, info), ExecuteArchive, CompleteStatus);
+	if (PathArg(env, info, a) == pdFAIL) {
+		free(a);
+		return NULL;
+	}
+	return Queue(env, a, "panel.archive");
+}
+
+static int ExecuteStopArchive(tAsync* a) {
+	archive_Stop(a->self->panel->archive);
+	a->count = archive_Dropped(a->self->panel->archive);
+	return pdPASS;
+}
+
+static napi_value StopArchive(napi_env env, napi_callback_info info) {
+	return Queue(env, NewAsync(Self(env, info), ExecuteStopArchive, CompleteCount), "panel.stoparchive");
+}
+
+static int ExecuteCapture(tAsync* a) {
+	return capture_Start(a->self->panel->capture, a->path);
 }
 
+static napi_value Capture(napi_env env, napi_callback_info info) {
+	tAsync* a = NewAsync(Self(env, info), ExecuteCapture, CompleteStatus);
+	if (PathArg(env, info, a) == pdFAIL) {
+		free(a);
+		return NULL;
+	}
+	return Queue(env, a, "panel.capture");
+}
 
-void Init(Handle<Object> exports) {
-	exports->Set(NanNew("run"), NanNew<FunctionTemplate>(Run)->GetFunction());
-	exports->Set(NanNew("setup"), NanNew<FunctionTemplate>(Setup)->GetFunction());
-	exports->Set(NanNew("update"), NanNew<FunctionTemplate>(Update)->GetFunction());
-	exports->Set(NanNew("exit"), NanNew<FunctionTemplate>(Exit)->GetFunction());
-	exports->Set(NanNew("getvalues"), NanNew<FunctionTemplate>(GetValues)->GetFunction());
+static int ExecuteStopCapture(tAsync* a) {
+	capture_Stop(a->self->panel->capture);
+	a->count = capture_Dropped(a->self->panel->capture);
+	return pdPASS;
 }
 
-NODE_MODULE(panel, Init)
+static napi_value StopCapture(napi_env env, napi_callback_info info) {
+	return Queue(env, NewAsync(Self(env, info), ExecuteStopCapture, CompleteCount), "panel.stopcapture");
+}
 
+static int ExecuteAttach(tAsync* a) {
+	a->count = session_Attach(a->self->panel);
+	if (a->count) a->self->attached++;
+	return a->count;
+}
+
+static napi_value Attach(napi_env env, napi_callback_info info) {
+	return Queue(env, NewAsync(Self(env, info), ExecuteAttach, CompleteCount), "panel.attach");
+}
+
+// O objeto s desanexa os clientes que ele mesmo anexou
+static int ExecuteDetach(tAsync* a) {
+	if (!a->self->attached) return a->count = session_Clients(a->self->panel);
+	a->self->attached--;
+	return a->count = session_Detach(a->self->panel);
+}
+
+static napi_value Detach(napi_env env, napi_callback_info info) {
+	return Queue(env, NewAsync(Self(env, info), ExecuteDetach, CompleteCount), "panel.detach");
+}
+
+// Desanexa o objeto do painel, que  liberado quando no houver mais objetos na mesma porta
+static void Release(tPanelObject* self) {
+	if (!self->panel) return;
+	// as gravaes pendentes no podem mais ser resolvidas
+	tAsync* a;
+	for (a = self->applies; a; a = a->next) {
+		ApplyCancel(a);
+		a->self = NULL;
+	}
+	self->applies = NULL;
+	events_Stop(self->panel->events, self);
+	self->listening = pdFALSE;
+	for (; self->attached; self->attached--) session_Detach(self->panel);
+	session_Release(self->panel);
+	self->panel = NULL;
+}
+
+// Coletado pelo GC: sem operaes pendentes nem inscries
+static void PanelFinalize(napi_env env, void* data, void* hint) {
+	tPanelObject* self = (tPanelObject*)data;
+	tAddon* addon = self->addon;
+	if (self == addon->defaultPanel) addon->defaultPanel = NULL;
+	tPanelObject** p = &addon->objects;
+	while (*p && *p != self) p = &(*p)->next;
+	if (*p) *p = self->next;
+
+	Release(self);
+	self->finalized = pdTRUE;
+
+	int x; for (x=0; x<nSUBSCRIBERS; x++)
+		if (self->subscribers[x].callback) napi_delete_reference(env, self->subscribers[x].callback);
+	if (self->valuesCache) napi_delete_reference(env, self->valuesCache);
+	if (self->valuesArray) napi_delete_reference(env, self->valuesArray);
+	napi_delete_reference(env, self->wrapper);
+
+	// published ainda pode ter chamadas enfileiradas, o objeto  liberado no PublishedFinalize
+	if (self->published) napi_release_threadsafe_function(self->published, napi_tsfn_abort);
+	else free(self);
+}
+
+// Associa o painel da porta ao objeto JS
+// Parametros:	check: pdTRUE para falhar se o painel da porta j existe com outra configurao
+// Retorna o objeto nativo, ou NULL com a exceo lanada
+static tPanelObject* Wrap(napi_env env, napi_value object, const char* port, uint baudrate, uint rhID, uint nMultimeters, int check) {
+	tPanelObject* self = (tPanelObject*)calloc(1, sizeof(tPanelObject));
+	if (self) self->panel = session_Acquire(port, baudrate, rhID, nMultimeters);
+	if (!self || !self->panel) {
+		free(self);
+		napi_throw_error(env, NULL, "Out of memory");
+		return NULL;
+	}
+	if (check && (self->panel->baudrate != baudrate || self->panel->rhID != rhID || self->panel->nMultimeters != nMultimeters)) {
+		session_Release(self->panel);
+		free(self);
+		napi_throw_error(env, NULL, "Port already in use with a different configuration");
+		return NULL;
+	}
+	if (napi_wrap(env, object, self, PanelFinalize, NULL, &self->wrapper) != napi_ok) {
+		session_Release(self->panel);
+		free(self);
+		napi_throw_error(env, NULL, "Unable to wrap the object");
+		return NULL;
+	}
+	self->addon = Addon(env);
+	self->next = self->addon->objects;
+	self->addon->objects = self;
+	return self;
+}
+
+// new Panel([port[, baud[, slave[, channels]]]]), argumentos undefined assumem o valor padro
+static napi_value New(napi_env env, napi_callback_info info) {
+	napi_value target, self, argv[4];
+	size_t argc = 4;
+	char port[64] = COM_PORT;
+	uint baudrate = MODBUS_BAUDRATE, rhID = 1, nMultimeters = nMULTIMETER_GEREN;
+
+	napi_get_new_target(env, info, &target);
+	if (!target) return TypeError(env, "Class constructor Panel cannot be invoked without 'new'");
+	napi_get_cb_info(env, info, &argc, argv, &self, NULL);
+
+	if (argc > 0 && !IsType(env, argv[0], napi_undefined)) {
+		if (!IsType(env, argv[0], napi_string)) return TypeError(env, "Wrong type of first argument");
+		napi_get_value_string_utf8(env, argv[0], port, sizeof(port), NULL);
+	}
+	if (argc > 1 && !IsType(env, argv[1], napi_undefined)) {
+		if (!IsType(env, argv[1], napi_number)) return TypeError(env, "Wrong type of second argument");
+		baudrate = uart_Speed(Number(env, argv[1]));
+		if (!baudrate) return RangeError(env, "Unsupported baud rate");
+	}
+	if (argc > 2 && !IsType(env, argv[2], napi_undefined)) {
+		if (!IsType(env, argv[2], napi_number)) return TypeError(env, "Wrong type of third argument");
+		double id = Number(env, argv[2]);
+		if (id < 1 || id > 247) return RangeError(env, "Slave ID must be between 1 and 247");
+		rhID = id;
+	}
+	if (argc > 3 && !IsType(env, argv[3], napi_undefined)) {
+		if (!IsType(env, argv[3], napi_number)) return TypeError(env, "Wrong type of fourth argument");
+		double n = Number(env, argv[3]);
+		if (n < 1 || n > nMULTIMETER) return RangeError(env, "Channel count must be between 1 and 16");
+		nMultimeters = n;
+	}
+
+	if (!Wrap(env, self, port, baudrate, rhID, nMultimeters, pdTRUE)) return NULL;
+	return self;
+}
+
+// enumerveis como os mtodos exportados pela verso NAN
+#define METHOD ((napi_property_attributes)(napi_writable | napi_enumerable | napi_configurable))
+
+// Encerramento do ambiente (fim do processo ou de uma worker_thread): os objetos deste ambiente deixam de receber
+// avisos e liberam os seus painis, os painis usados somente aqui tm a thread parada e a UART fechada
+static void EnvCleanup(void* data) {
+	tAddon* addon = (tAddon*)data;
+	tPanelObject* self;
+	for (self = addon->objects; self; self = self->next) Release(self);
+}
+
+static void AddonFinalize(napi_env env, void* data, void* hint) {
+	tAddon* addon = (tAddon*)data;
+	json_Free(&addon->json);
+	json_Free(&addon->samplesJson);
+	free(addon);
+}
+
+NAPI_MODULE_INIT() {
+	tAddon* addon = (tAddon*)calloc(1, sizeof(tAddon));
+	if (!addon || napi_set_instance_data(env, addon, AddonFinalize, NULL) != napi_ok) {
+		free(addon);
+		napi_throw_error(env, NULL, "Out of memory");
+		return NULL;
+	}
+	napi_add_env_cleanup_hook(env, EnvCleanup, addon);
+	log_Start();
+
+	napi_property_descriptor methods[] = {
+		{ "run", NULL, Run, NULL, NULL, NULL, METHOD, NULL },
+		{ "setup", NULL, Setup, NULL, NULL, NULL, METHOD, NULL },
+		{ "update", NULL, Update, NULL, NULL, NULL, METHOD, NULL },
+		{ "apply", NULL, Apply, NULL, NULL, NULL, METHOD, NULL },
+		{ "applysample", NULL, ApplySample, NULL, NULL, NULL, METHOD, NULL },
+		{ "exit", NULL, Exit, NULL, NULL, NULL, METHOD, NULL },
+		{ "stop", NULL, Stop, NULL, NULL, NULL, METHOD, NULL },
+		{ "getvalues", NULL, GetValues, NULL, NULL, NULL, METHOD, NULL },
+		{ "subscribe", NULL, Subscribe, NULL, NULL, NULL, METHOD, NULL },
+		{ "unsubscribe", NULL, Unsubscribe, NULL, NULL, NULL, METHOD, NULL },
+		{ "values", NULL, Values, NULL, NULL, NULL, METHOD, NULL },
+		{ "gethistory", NULL, GetHistory, NULL, NULL, NULL, METHOD, NULL },
+		{ "getaggregates", NULL, GetAggregates, NULL, NULL, NULL, METHOD, NULL },
+		{ "setdeadband", NULL, SetDeadband, NULL, NULL, NULL, METHOD, NULL },
+		{ "getchanges", NULL, GetChanges, NULL, NULL, NULL, METHOD, NULL },
+		{ "getstats", NULL, GetStats, NULL, NULL, NULL, METHOD, NULL },
+		{ "getmetrics", NULL, GetMetrics, NULL, NULL, NULL, METHOD, NULL },
+		{ "gettrace", NULL, GetTrace, NULL, NULL, NULL, METHOD, NULL },
+		{ "setloglevel", NULL, SetLogLevel, NULL, NULL, NULL, METHOD, NULL },
+		{ "record", NULL, Record, NULL, NULL, NULL, METHOD, NULL },
+		{ "stoprecord", NULL, StopRecord, NULL, NULL, NULL, METHOD, NULL },
+		{ "archive", NULL, Archive, NULL, NULL, NULL, METHOD, NULL },
+		{ "stoparchive", NULL, StopArchive, NULL, NULL, NULL, METHOD, NULL },
+		{ "capture", NULL, Capture, NULL, NULL, NULL, METHOD, NULL },
+		{ "stopcapture", NULL, StopCapture, NULL, NULL, NULL, METHOD, NULL },
+		{ "attach", NULL, Attach, NULL, NULL, NULL, METHOD, NULL },
+		{ "detach", NULL, Detach, NULL, NULL, NULL, METHOD, NULL },
+	};
+	size_t n = sizeof(methods) / sizeof(methods[0]);
+	napi_value cls;
+
+	napi_define_class(env, "Panel", NAPI_AUTO_LENGTH, New, NULL, n, methods, &cls);
+	napi_define_properties(env, exports, n, methods);
+	napi_set_named_property(env, exports, "Panel", cls);
+
+	// o prprio mdulo  o painel padro, com a configurao que o painel de COM_PORT j tiver
+	addon->defaultPanel = Wrap(env, exports, COM_PORT, MODBUS_BAUDRATE, 1, nMULTIMETER_GEREN, pdFALSE);
+	if (!addon->defaultPanel) return NULL;
+	return exports;
+}
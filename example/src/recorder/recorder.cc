@@ -0,0 +1,385 @@
+/* Gravação das sessões de aquisição
+ *
+ * Cada amostra publicada pela thread modbus_Process é gravada como um registro de tamanho fixo (tRecord)
+ * em arquivos segmentados mapeados em memória. Cada segmento tem um cabeçalho de 4KB (tRecorderHeader)
+ * seguido de RECORDER_CAPACITY registros.
+ *
+ * A thread de aquisição somente copia o registro na memória mapeada e depois incrementa o contador de registros
+ * confirmados do cabeçalho, ou seja, nenhuma chamada de sistema é feita por amostra.
+ * Uma thread de fundo prepara o próximo segmento antes do atual encher, grava no disco os segmentos a cada
+ * RECORDER_SYNC_PERIOD ms e fecha os segmentos cheios.
+ *
+ * Após uma queda do programa somente os registros confirmados são válidos, e cada registro tem o seu CRC para
+ * detectar páginas que não chegaram ao disco numa queda de energia.
+ *
+ * O cabeçalho guarda o tempo de um a cada RECORDER_INDEX_STRIDE registros, usado para localizar um instante
+ * no segmento sem percorrer todos os registros (recorder_Seek).
+ *
+ * Os arquivos são nomeados <dir>/<inicio da gravação em segundos desde epoch>-<número do segmento>.rec
+ * */
+
+#include "recorder.h"
+#include "../crc/crc.h"
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define lenSEGMENT (RECORDER_HEADER_SIZE + RECORDER_CAPACITY*sizeof(tRecord))
+
+typedef struct {
+	char path[300];
+	int fd;
+	u8* map;
+	tRecorderHeader* header;
+	tRecord* records;
+} tSegment;
+
+struct tRecorder {
+	char dir[256];
+	uint session;			// Início da gravação em segundos desde epoch, usado nos nomes dos arquivos
+	uint nSegment;			// Número do próximo segmento a ser criado
+	tSegment pool[3];		// Segmentos atual, próximo e cheio aguardando ser fechado
+	tSegment* current;		// Segmento onde a thread de aquisição grava os registros
+	tSegment* next;			// Segmento já preparado pela thread de fundo
+	tSegment* retired;		// Segmento cheio aguardando a thread de fundo fechá-lo
+	volatile int active;
+	int stop;				// Sinaliza para a thread de fundo terminar
+	uint dropped;			// Registros descartados por não haver segmento preparado
+	pthread_t thread;
+	pthread_mutex_t lock;
+	pthread_cond_t wake;
+};
+
+// #####################################################################################################################
+// AUX
+// #####################################################################################################################
+
+// Cria e mapeia um novo segmento. O arquivo é alocado no tamanho total e as páginas são carregadas (MAP_POPULATE)
+// para que a thread de aquisição não sofra falta de página ou SIGBUS por falta de espaço ao gravar
+static int CreateSegment(tRecorder* recorder, tSegment* s) {
+	snprintf(s->path, sizeof(s->path), "%s/%u-%04u.rec", recorder->dir, recorder->session, recorder->nSegment++);
+	s->fd = open(s->path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+	if (s->fd == -1) return pdFAIL;
+
+	if (posix_fallocate(s->fd, 0, lenSEGMENT) != 0) {
+		close(s->fd);
+		unlink(s->path);
+		s->fd = -1;
+		return pdFAIL;
+	}
+
+	void* map = mmap(NULL, lenSEGMENT, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, s->fd, 0);
+	if (map == MAP_FAILED) {
+		close(s->fd);
+		unlink(s->path);
+		s->fd = -1;
+		return pdFAIL;
+	}
+
+	s->map = (u8*)map;
+	s->header = (tRecorderHeader*)map;
+	s->records = (tRecord*)(s->map + RECORDER_HEADER_SIZE);
+	s->header->h.magic = RECORDER_MAGIC;
+	s->header->h.version = RECORDER_VERSION;
+	s->header->h.recordSize = sizeof(tRecord);
+	s->header->h.capacity = RECORDER_CAPACITY;
+	s->header->h.stride = RECORDER_INDEX_STRIDE;
+	s->header->h.committed = 0;
+	return pdPASS;
+}
+
+// Grava no disco, desmapeia e fecha o segmento. O arquivo é truncado no último registro confirmado,
+// e removido se nenhum registro foi gravado
+static void ReleaseSegment(tSegment* s) {
+	if (s->fd == -1) return;
+
+	uint committed = s->header->h.committed;
+	msync(s->map, lenSEGMENT, MS_SYNC);
+	munmap(s->map, lenSEGMENT);
+	if (committed == 0) unlink(s->path);
+	else if (ftruncate(s->fd, RECORDER_HEADER_SIZE + committed*sizeof(tRecord)) != 0) { /* mantém o tamanho alocado */ }
+	close(s->fd);
+	s->fd = -1;
+	s->map = (u8*)NULL;
+}
+
+static tSegment* FreeSegment(tRecorder* recorder) {
+	int x; for (x=0; x<3; x++)
+		if (recorder->pool[x].fd == -1) return &recorder->pool[x];
+	return (tSegment*)NULL;
+}
+
+// Thread de fundo: prepara o próximo segmento, fecha os segmentos cheios e grava periodicamente o segmento atual no disco
+static void* Process(void* params) {
+	tRecorder* recorder = (tRecorder*)params;
+
+	pthread_mutex_lock(&recorder->lock);
+	while (!recorder->stop) {
+		if (recorder->retired) {
+			tSegment* s = recorder->retired;
+			recorder->retired = (tSegment*)NULL;
+			pthread_mutex_unlock(&recorder->lock);
+			ReleaseSegment(s);
+			pthread_mutex_lock(&recorder->lock);
+		}
+
+		if (!recorder->next) {
+			tSegment* s = FreeSegment(recorder);
+			pthread_mutex_unlock(&recorder->lock);
+			int ret = (s) ? CreateSegment(recorder, s) : pdFAIL;
+			pthread_mutex_lock(&recorder->lock);
+			if (ret == pdPASS) recorder->next = s;
+		}
+
+		// somente esta thread fecha segmentos, então o atual continua mapeado durante o msync
+		tSegment* s = recorder->current;
+		pthread_mutex_unlock(&recorder->lock);
+		msync(s->map, lenSEGMENT, MS_SYNC);
+		pthread_mutex_lock(&recorder->lock);
+
+		struct timespec ts;
+		clock_gettime(CLOCK_REALTIME, &ts);
+		ts.tv_sec += RECORDER_SYNC_PERIOD / 1000;
+		ts.tv_nsec += (RECORDER_SYNC_PERIOD % 1000) * 1000000L;
+		if (ts.tv_nsec >= 1000000000L) { ts.tv_sec++; ts.tv_nsec -= 1000000000L; }
+		if (!recorder->stop) pthread_cond_timedwait(&recorder->wake, &recorder->lock, &ts);
+	}
+	pthread_mutex_unlock(&recorder->lock);
+	return NULL;
+}
+
+// #####################################################################################################################
+// FUNCTIONS
+// #####################################################################################################################
+
+// -------------------------------------------------------------------------------------------------------------------
+// FUNÇÃO:		recorder_New
+// Retorna:		Gravador de um painel, parado até o recorder_Start, ou NULL se não há memória
+// -------------------------------------------------------------------------------------------------------------------
+tRecorder* recorder_New(void) {
+	tRecorder* recorder = (tRecorder*)calloc(1, sizeof(tRecorder));
+	if (recorder) {
+		pthread_mutex_init(&recorder->lock, NULL);
+		pthread_cond_init(&recorder->wake, NULL);
+	}
+	return recorder;
+}
+
+// -------------------------------------------------------------------------------------------------------------------
+// FUNÇÃO:		recorder_Free
+// Descrição: 	Encerra a gravação, se estiver em andamento, e libera o gravador
+// -------------------------------------------------------------------------------------------------------------------
+void recorder_Free(tRecorder* recorder) {
+	if (!recorder) return;
+	recorder_Stop(recorder);
+	pthread_cond_destroy(&recorder->wake);
+	pthread_mutex_destroy(&recorder->lock);
+	free(recorder);
+}
+
+// -------------------------------------------------------------------------------------------------------------------
+// FUNÇÃO:		recorder_Start
+// Descrição: 	Inicia a gravação das amostras publicadas no diretório dir
+// Retorna:		pdPASS se a gravação foi iniciada, pdFAIL se já está gravando ou se não foi possível criar o primeiro segmento
+// -------------------------------------------------------------------------------------------------------------------
+int recorder_Start(tRecorder* recorder, const char* dir) {
+	if (recorder->active) return pdFAIL;
+
+	int x; for (x=0; x<3; x++) recorder->pool[x].fd = -1;
+	snprintf(recorder->dir, sizeof(recorder->dir), "%s", dir);
+	recorder->session = (uint)time(NULL);
+	recorder->nSegment = 0;
+	recorder->next = recorder->retired = (tSegment*)NULL;
+	recorder->current = &recorder->pool[0];
+	recorder->dropped = 0;
+	recorder->stop = pdFALSE;
+	if (CreateSegment(recorder, recorder->current) == pdFAIL) return pdFAIL;
+
+	if (pthread_create(&recorder->thread, NULL, Process, (void *) recorder)) {
+		ReleaseSegment(recorder->current);
+		return pdFAIL;
+	}
+
+	recorder->active = pdTRUE;
+	return pdPASS;
+}
+
+// -------------------------------------------------------------------------------------------------------------------
+// FUNÇÃO:		recorder_Stop
+// Descrição: 	Encerra a gravação, grava no disco e fecha todos os segmentos
+// -------------------------------------------------------------------------------------------------------------------
+void recorder_Stop(tRecorder* recorder) {
+	if (!recorder->active) return;
+
+	pthread_mutex_lock(&recorder->lock);
+	recorder->active = pdFALSE;
+	recorder->stop = pdTRUE;
+	pthread_cond_signal(&recorder->wake);
+	pthread_mutex_unlock(&recorder->lock);
+	pthread_join(recorder->thread, NULL);
+
+	int x; for (x=0; x<3; x++) ReleaseSegment(&recorder->pool[x]);
+}
+
+// -------------------------------------------------------------------------------------------------------------------
+// FUNÇÃO:		recorder_Active
+// Retorna:		pdTRUE se a gravação está em andamento
+// -------------------------------------------------------------------------------------------------------------------
+int recorder_Active(tRecorder* recorder) {
+	return recorder->active;
+}
+
+// -------------------------------------------------------------------------------------------------------------------
+// FUNÇÃO:		recorder_Dropped
+// Retorna:		Quantidade de registros descartados na gravação atual por não haver segmento preparado
+// -------------------------------------------------------------------------------------------------------------------
+uint recorder_Dropped(tRecorder* recorder) {
+	return recorder->dropped;
+}
+
+// -------------------------------------------------------------------------------------------------------------------
+// FUNÇÃO:		recorder_Append
+// Descrição: 	Chamada pela thread de aquisição a cada amostra publicada. Copia a amostra no segmento atual
+//				e a confirma no cabeçalho. Não faz chamadas de sistema, o lock só é disputado no início e fim
+//				da gravação e por instantes com a thread de fundo
+// -------------------------------------------------------------------------------------------------------------------
+void recorder_Append(tRecorder* recorder, const tSample* sample) {
+	if (!recorder->active) return;
+
+	pthread_mutex_lock(&recorder->lock);
+	if (!recorder->active) {
+		pthread_mutex_unlock(&recorder->lock);
+		return;
+	}
+
+	tSegment* s = recorder->current;
+	if (s->header->h.committed >= RECORDER_CAPACITY) {
+		// a thread de fundo ainda não preparou o próximo segmento ou não fechou o anterior
+		if (!recorder->next || recorder->retired) {
+			recorder->dropped++;
+			pthread_mutex_unlock(&recorder->lock);
+			return;
+		}
+		recorder->retired = s;
+		s = recorder->current = recorder->next;
+		recorder->next = (tSegment*)NULL;
+	}
+
+	uint n = s->header->h.committed;
+	tRecord* r = &s->records[n];
+	r->time = sample->time;
+	r->seq = sample->seq;
+	r->stsCom = sample->stsCom;
+	r->relays = sample->relays;
+	r->douts = sample->douts;
+	r->nMultimeters = sample->nMultimeters;
+	uint x; for (x=0; x<nMULTIMETER; x++) {
+		r->channel[x].value = sample->multimeter[x].value;
+		r->channel[x].sts = sample->multimeter[x].sts;
+		r->channel[x].func = sample->multimeter[x].func;
+		r->channel[x].stsCom = sample->multimeter[x].stsCom;
+		r->channel[x].reserved = 0;
+	}
+	r->reserved = 0;
+	r->crc = crc16_MODBUS(r, offsetof(tRecord, crc));
+
+	if (n % RECORDER_INDEX_STRIDE == 0) s->header->h.index[n / RECORDER_INDEX_STRIDE] = r->time;
+	if (n == 0) s->header->h.firstTime = r->time;
+	s->header->h.lastTime = r->time;
+
+	__sync_synchronize(); // o registro deve estar completo na memória antes de ser confirmado
+	s->header->h.committed = n + 1;
+	pthread_mutex_unlock(&recorder->lock);
+}
+
+// -------------------------------------------------------------------------------------------------------------------
+// FUNÇÃO:		recorder_OpenSegment
+// Descrição: 	Abre um segmento gravado para leitura. Os registros são lidos diretamente da memória mapeada, sem cópia
+// Parametros:	path: Caminho do arquivo do segmento
+//				r: Retorna o segmento aberto
+// Retorna:		pdPASS se o segmento foi aberto, pdFAIL se o arquivo não existe ou não é um segmento válido
+// -------------------------------------------------------------------------------------------------------------------
+int recorder_OpenSegment(const char* path, tRecording* r) {
+	struct stat st;
+
+	r->fd = open(path, O_RDONLY);
+	if (r->fd == -1) return pdFAIL;
+	if (fstat(r->fd, &st) != 0 || (size_t)st.st_size < RECORDER_HEADER_SIZE) {
+		close(r->fd);
+		return pdFAIL;
+	}
+
+	r->len = st.st_size;
+	void* map = mmap(NULL, r->len, PROT_READ, MAP_SHARED, r->fd, 0);
+	if (map == MAP_FAILED) {
+		close(r->fd);
+		return pdFAIL;
+	}
+
+	r->map = (u8*)map;
+	r->header = (tRecorderHeader*)map;
+	r->records = (const tRecord*)(r->map + RECORDER_HEADER_SIZE);
+	if (r->header->h.magic != RECORDER_MAGIC || r->header->h.version != RECORDER_VERSION || r->header->h.recordSize != sizeof(tRecord)) {
+		recorder_CloseSegment(r);
+		return pdFAIL;
+	}
+
+	// o arquivo pode ter sido truncado após uma queda, vale o menor entre o confirmado e o que existe no arquivo
+	r->count = r->header->h.committed;
+	if (r->count > (r->len - RECORDER_HEADER_SIZE) / sizeof(tRecord))
+		r->count = (r->len - RECORDER_HEADER_SIZE) / sizeof(tRecord);
+	return pdPASS;
+}
+
+// -------------------------------------------------------------------------------------------------------------------
+// FUNÇÃO:		recorder_CloseSegment
+// -------------------------------------------------------------------------------------------------------------------
+void recorder_CloseSegment(tRecording* r) {
+	munmap(r->map, r->len);
+	close(r->fd);
+	r->fd = -1;
+}
+
+// -------------------------------------------------------------------------------------------------------------------
+// FUNÇÃO:		recorder_Seek
+// Descrição: 	Localiza o primeiro registro do segmento com tempo maior ou igual a time.
+//				Usa o índice do cabeçalho para achar o bloco de RECORDER_INDEX_STRIDE registros e faz busca binária nele
+// Retorna:		Índice do registro, ou r->count se todos os registros são anteriores a time
+// -------------------------------------------------------------------------------------------------------------------
+int recorder_Seek(const tRecording* r, u64 time) {
+	if (r->count == 0 || time <= r->records[0].time) return 0;
+
+	// último bloco que começa antes de time
+	uint blocks = (r->count + RECORDER_INDEX_STRIDE - 1) / RECORDER_INDEX_STRIDE;
+	uint lo = 0, hi = blocks;
+	while (hi - lo > 1) {
+		uint mid = (lo + hi) / 2;
+		if (r->header->h.index[mid] < time) lo = mid;
+		else hi = mid;
+	}
+
+	lo = lo * RECORDER_INDEX_STRIDE;
+	hi = lo + RECORDER_INDEX_STRIDE;
+	if (hi > r->count) hi = r->count;
+	while (lo < hi) {
+		uint mid = (lo + hi) / 2;
+		if (r->records[mid].time < time) lo = mid + 1;
+		else hi = mid;
+	}
+	return lo;
+}
+
+// -------------------------------------------------------------------------------------------------------------------
+// FUNÇÃO:		recorder_Valid
+// Retorna:		pdTRUE se o CRC do registro confere
+// -------------------------------------------------------------------------------------------------------------------
+int recorder_Valid(const tRecord* record) {
+	return crc16_MODBUS((void*)record, offsetof(tRecord, crc)) == record->crc;
+}
@@ -0,0 +1,77 @@
+#ifndef RECORDER_H
+#define RECORDER_H
+
+#include "../_config_cpu_.h"
+#include "../app.h"
+#include <stddef.h>
+
+// Formato dos arquivos de gravação, ver recorder.cc
+#define RECORDER_MAGIC			0x524c5852	// "RXLR"
+#define RECORDER_VERSION		1
+#define RECORDER_CAPACITY		32768		// Quantidade de registros por segmento, ~5MB e ~16 minutos a cada ~30ms
+#define RECORDER_INDEX_STRIDE	128			// A cada quantos registros o tempo é salvo no índice do cabeçalho
+#define RECORDER_INDEX_SIZE		(RECORDER_CAPACITY/RECORDER_INDEX_STRIDE)
+#define RECORDER_HEADER_SIZE	4096
+#define RECORDER_SYNC_PERIOD	1000		// Período em ms que os segmentos mapeados são gravados no disco
+
+typedef struct {
+	int value;				// valores em miliampers ou milivolts
+	u8 sts;
+	u8 func;
+	u8 stsCom;
+	u8 reserved;
+} tRecordChannel;
+
+// Registro de tamanho fixo, mesma disposição em 32 e 64 bits
+typedef struct {
+	u64 time;				// Instante da leitura em us desde epoch
+	uint seq;				// Sequência da amostra
+	int stsCom;				// Status de comunicação com RH
+	uint relays;
+	uint douts;
+	uint nMultimeters;
+	tRecordChannel channel[nMULTIMETER];
+	u16 reserved;
+	u16 crc;				// crc16_MODBUS dos bytes anteriores do registro
+} tRecord;
+
+typedef union {
+	struct {
+		uint magic;
+		uint version;
+		uint recordSize;
+		uint capacity;
+		volatile uint committed;	// Quantidade de registros completos, só é incrementado após o registro ser todo escrito
+		uint stride;
+		u64 firstTime;				// Tempo do primeiro e do último registro confirmado
+		u64 lastTime;
+		u64 index[RECORDER_INDEX_SIZE]; // index[i] = tempo do registro i*RECORDER_INDEX_STRIDE
+	} h;
+	u8 page[RECORDER_HEADER_SIZE];
+} tRecorderHeader;
+
+// Segmento aberto para leitura, os registros são acessados diretamente na memória mapeada
+typedef struct {
+	int fd;
+	u8* map;
+	size_t len;
+	tRecorderHeader* header;
+	const tRecord* records;
+	uint count;				// Quantidade de registros confirmados no segmento
+} tRecording;
+
+// Gravador de um painel, os campos ficam em recorder.cc
+tRecorder* recorder_New(void);
+void recorder_Free(tRecorder* recorder);
+int recorder_Start(tRecorder* recorder, const char* dir);
+void recorder_Stop(tRecorder* recorder);
+int recorder_Active(tRecorder* recorder);
+void recorder_Append(tRecorder* recorder, const tSample* sample);
+uint recorder_Dropped(tRecorder* recorder);
+
+int recorder_OpenSegment(const char* path, tRecording* r);
+void recorder_CloseSegment(tRecording* r);
+int recorder_Seek(const tRecording* r, u64 time);
+int recorder_Valid(const tRecord* record);
+
+#endif
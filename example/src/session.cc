@@ -0,0 +1,354 @@
+#include "timer/timer.h"
+#include "_config_cpu_.h"
+#include "uart/uart.h"
+#include "recorder/recorder.h"
+#include "colstore/colstore.h"
+#include "capture/capture.h"
+#include "trace/trace.h"
+#include "app.h"
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Gerenciador da sessão de aquisição
+//	A porta UART e a thread modbus_Process são compartilhadas por todos os clientes conectados.
+//	Cada cliente se anexa (session_Attach) e se desanexa (session_Detach) da sessão, que conta as referências.
+//	Quando o último cliente sai a sessão continua viva por SESSION_IDLE_GRACE ms, assim um cliente que
+//	recarrega a página não paga novamente a abertura da UART e a leitura das informações do RH.
+//	Cada painel (session_New) tem a sua própria sessão, porta e thread, então vários painéis podem ser
+//	controlados pelo mesmo processo.
+
+struct tSession {
+	pthread_t thread;		// Thread modbus_Process
+	int opened;				// Sinaliza que a UART está aberta e o mestre modbus inicializado
+	int running;			// Sinaliza que a thread modbus_Process está em execução
+	int primed;				// Sinaliza que control já foi inicializado para a UART aberta, um novo Start somente retoma a thread
+	int joinPending;		// Sinaliza que a thread terminou e ainda precisa ser recolhida com pthread_join
+	int attached;			// Sinaliza que a sessão foi aberta via session_Attach e está sujeita ao tempo de ociosidade
+	int refs;				// Quantidade de clientes anexados
+	tTime idleSince;		// Instante em que o último cliente se desanexou
+	pthread_mutex_t lock;	// Serializa Setup/Run/Exit/Attach/Detach entre si e com a thread
+	pthread_mutex_t opsLock;// Serializa as operações dos objetos Panel do painel, ver session_Lock
+};
+
+// Painéis compartilhados pelos ambientes do node (thread principal e worker_threads), ver session_Acquire
+static tPanel* panels;
+static pthread_mutex_t panelsLock = PTHREAD_MUTEX_INITIALIZER;
+
+// -------------------------------------------------------------------------------------------------------------------
+// AUX: todas as funções abaixo devem ser chamadas com o lock adquirido
+// -------------------------------------------------------------------------------------------------------------------
+
+// Recolhe a thread que já terminou, antes de criar uma nova
+static void Reap(tSession* session) {
+	if (!session->joinPending) return;
+	pthread_join(session->thread, NULL);
+	session->joinPending = pdFALSE;
+}
+
+static int Open(tPanel* panel) {
+	tSession* session = panel->session;
+	if (session->opened) return pdPASS;
+	if (modbus_Init(panel) == pdFAIL) return pdFAIL;
+	session->opened = pdTRUE;
+	session->primed = pdFALSE;
+	return pdPASS;
+}
+
+// Na primeira execução com a UART aberta inicializa control, o que força a leitura das informações do RH.
+// Numa reinicialização após session_Stop mantemos a porta, as informações do RH, os estados das saídas
+// e os últimos valores dos multimetros, somente a thread é recriada
+static int Start(tPanel* panel) {
+	tSession* session = panel->session;
+	Reap(session);
+	if (session->running) return pdPASS;
+	if (!session->opened) return pdFAIL; // Setup ainda não concluído, a thread não pode usar a UART fechada
+
+	if (!session->primed) init_control_tad(panel);
+	panel->control.exit = 0;
+	if (pthread_create(&session->thread, NULL, modbus_Process, (void *) panel)) return pdFAIL; // fica funcionando até que receba um comando via WEB para sair
+	session->running = pdTRUE;
+	session->primed = pdTRUE;
+	return pdPASS;
+}
+
+// Pede a thread para terminar e espera ela sair.
+// Retorna pdFAIL se a thread teve que cancelar o frame em andamento
+static int Stop(tPanel* panel) {
+	tSession* session = panel->session;
+	void* aborted = NULL;
+
+	Reap(session);
+	if (!session->running) return pdPASS;
+
+	panel->control.exit = 1;
+	pthread_join(session->thread, &aborted);
+	session->running = pdFALSE;
+	return (aborted == NULL) ? pdPASS : pdFAIL;
+}
+
+static void Close(tPanel* panel) {
+	tSession* session = panel->session;
+	if (session->opened) {
+		uart_Close(&panel->uart);
+		session->opened = pdFALSE;
+	}
+
+	session->primed = pdFALSE;
+	session->attached = pdFALSE;
+}
+
+// #####################################################################################################################
+// FUNCTIONS
+// #####################################################################################################################
+
+// -------------------------------------------------------------------------------------------------------------------
+// FUNÇÃO:		session_New
+// Descrição: 	Cria um painel com a sua sessão, o mestre modbus e os buffers das amostras. A UART só é aberta no session_Open
+// Parametros:	port: Porta UART do RH, ex: "/dev/ttyUSB0"
+//				baudrate: Constante do termios, ver uart_Speed
+//				rhID: ID do RH no barramento modbus
+//				nMultimeters: Quantidade de multímetros que o RH deve gerenciar, de 1 até nMULTIMETER
+// Retorna:		O painel, ou NULL se não há memória
+// -------------------------------------------------------------------------------------------------------------------
+tPanel* session_New(const char* port, uint baudrate, uint rhID, uint nMultimeters) {
+	tPanel* panel = (tPanel*)calloc(1, sizeof(tPanel));
+	if (!panel) return NULL;
+
+	strncpy(panel->port, port, sizeof(panel->port)-1);
+	panel->baudrate = baudrate;
+	panel->rhID = rhID;
+	panel->nMultimeters = nMultimeters;
+
+	panel->session = (tSession*)calloc(1, sizeof(tSession));
+	if (panel->session) {
+		pthread_mutex_init(&panel->session->lock, NULL);
+		pthread_mutex_init(&panel->session->opsLock, NULL);
+	}
+	panel->history = history_New();
+	panel->aggregator = aggregate_New();
+	panel->deadband = deadband_New();
+	panel->snapshot = snapshot_New();
+	panel->events = events_New();
+	panel->outputs = outputs_New();
+	panel->stats = stats_New();
+	panel->recorder = recorder_New();
+	panel->archive = archive_New();
+	panel->capture = capture_New();
+	panel->trace = trace_New();
+
+	if (!panel->session || !panel->history || !panel->aggregator || !panel->deadband || !panel->snapshot ||
+		!panel->events || !panel->outputs || !panel->stats || !panel->recorder || !panel->archive ||
+		!panel->capture || !panel->trace) {
+		session_Free(panel);
+		return NULL;
+	}
+	return panel;
+}
+
+// -------------------------------------------------------------------------------------------------------------------
+// FUNÇÃO:		session_Free
+// Descrição: 	Para a thread, fecha a UART e libera o painel. Os avisos (events_Stop) devem ser encerrados antes
+// -------------------------------------------------------------------------------------------------------------------
+void session_Free(tPanel* panel) {
+	if (!panel) return;
+	if (panel->session) {
+		// última referência ao painel, a sessão é encerrada mesmo com clientes que não se desanexaram
+		pthread_mutex_lock(&panel->session->lock);
+		Stop(panel);
+		Close(panel);
+		pthread_mutex_unlock(&panel->session->lock);
+		pthread_mutex_destroy(&panel->session->lock);
+		pthread_mutex_destroy(&panel->session->opsLock);
+		free(panel->session);
+	}
+	recorder_Free(panel->recorder);
+	archive_Free(panel->archive);
+	capture_Free(panel->capture);
+	trace_Free(panel->trace);
+	history_Free(panel->history);
+	aggregate_Free(panel->aggregator);
+	deadband_Free(panel->deadband);
+	snapshot_Free(panel->snapshot);
+	events_Free(panel->events);
+	outputs_Free(panel->outputs);
+	stats_Free(panel->stats);
+	free(panel);
+}
+
+// -------------------------------------------------------------------------------------------------------------------
+// FUNÇÃO:		session_Acquire
+// Descrição: 	Retorna o painel da porta port, criado na primeira chamada. Os demais parâmetros só são usados na criação,
+//				quem chama deve conferir se a configuração do painel retornado é a esperada.
+//				Deve ser seguida de session_Release quando o painel não for mais usado
+// Parametros:	Ver session_New
+// Retorna:		O painel, ou NULL se não há memória
+// -------------------------------------------------------------------------------------------------------------------
+tPanel* session_Acquire(const char* port, uint baudrate, uint rhID, uint nMultimeters) {
+	tPanel* panel;
+
+	pthread_mutex_lock(&panelsLock);
+	for (panel = panels; panel; panel = panel->next)
+		if (strncmp(panel->port, port, sizeof(panel->port)-1) == 0) break;
+	if (!panel && (panel = session_New(port, baudrate, rhID, nMultimeters))) {
+		panel->next = panels;
+		panels = panel;
+	}
+	if (panel) panel->refs++;
+	pthread_mutex_unlock(&panelsLock);
+	return panel;
+}
+
+// -------------------------------------------------------------------------------------------------------------------
+// FUNÇÃO:		session_Release
+// Descrição: 	Libera o painel obtido com session_Acquire. Com a última referência a thread é parada e a UART fechada
+// -------------------------------------------------------------------------------------------------------------------
+void session_Release(tPanel* panel) {
+	pthread_mutex_lock(&panelsLock);
+	if (--panel->refs == 0) {
+		tPanel** p = &panels;
+		while (*p != panel) p = &(*p)->next;
+		*p = panel->next;
+		// ainda com o lock, assim um novo painel da mesma porta só é criado depois da UART ser fechada aqui
+		session_Free(panel);
+	}
+	pthread_mutex_unlock(&panelsLock);
+}
+
+// -------------------------------------------------------------------------------------------------------------------
+// FUNÇÃO:		session_Open
+// Descrição: 	Abre a UART e inicializa o mestre modbus, caso ainda não estejam abertos
+// Retorna:		pdPASS se a porta está aberta, pdFAIL se houve erro na abertura da porta
+// -------------------------------------------------------------------------------------------------------------------
+int session_Open(tPanel* panel) {
+	pthread_mutex_lock(&panel->session->lock);
+	int ret = Open(panel);
+	pthread_mutex_unlock(&panel->session->lock);
+	return ret;
+}
+
+// -------------------------------------------------------------------------------------------------------------------
+// FUNÇÃO:		session_Start
+// Descrição: 	Cria a thread modbus_Process caso ela ainda não esteja em execução
+// Retorna:		pdPASS se a thread está em execução, pdFAIL se a UART não está aberta ou não foi possível criar a thread
+// -------------------------------------------------------------------------------------------------------------------
+int session_Start(tPanel* panel) {
+	pthread_mutex_lock(&panel->session->lock);
+	int ret = Start(panel);
+	pthread_mutex_unlock(&panel->session->lock);
+	return ret;
+}
+
+// -------------------------------------------------------------------------------------------------------------------
+// FUNÇÃO:		session_Stop
+// Descrição: 	Para a thread. Sem closePort a thread é parada independente da quantidade de clientes anexados.
+//				Com closePort a sessão só é encerrada se não há clientes anexados, quem chama deve antes desanexar
+//				as suas próprias referências com session_Detach. Com clientes anexados a sessão continua em execução.
+//				A thread termina o frame em andamento e grava as saídas pendentes (control.relays e control.douts)
+//				antes de sair, ou cancela o frame após SESSION_STOP_TIMEOUT ms. Só então a UART é fechada.
+// Parametros:	closePort: pdTRUE para fechar a UART, pdFALSE para manter a porta aberta para uma reinicialização rápida com session_Start
+//				elapsed: Retorna o tempo em ms gasto para parar a sessão, pode ser NULL
+// Retorna:		pdPASS se a thread terminou limpa ou continua em execução para os outros clientes,
+//				pdFAIL se o frame em andamento foi cancelado
+// -------------------------------------------------------------------------------------------------------------------
+int session_Stop(tPanel* panel, int closePort, tTime* elapsed) {
+	tTime t0 = now();
+	int ret = pdPASS;
+
+	pthread_mutex_lock(&panel->session->lock);
+	if (!closePort || panel->session->refs == 0) {
+		ret = Stop(panel);
+		if (closePort) Close(panel);
+	}
+	pthread_mutex_unlock(&panel->session->lock);
+
+	if (elapsed) *elapsed = now() - t0;
+	return ret;
+}
+
+// -------------------------------------------------------------------------------------------------------------------
+// FUNÇÃO:		session_Attach
+// Descrição: 	Anexa um cliente a sessão. Se a sessão não estiver ativa a UART é aberta e a thread criada,
+//				senão o cliente passa a usar os dados já coletados pela thread em execução.
+// Retorna:		Quantidade de clientes anexados, ou 0 se não foi possível abrir a sessão
+// -------------------------------------------------------------------------------------------------------------------
+int session_Attach(tPanel* panel) {
+	tSession* session = panel->session;
+	pthread_mutex_lock(&session->lock);
+	if (Open(panel) == pdFAIL || Start(panel) == pdFAIL) {
+		pthread_mutex_unlock(&session->lock);
+		return 0;
+	}
+
+	session->attached = pdTRUE;
+	int refs = ++session->refs;
+	pthread_mutex_unlock(&session->lock);
+	return refs;
+}
+
+// -------------------------------------------------------------------------------------------------------------------
+// FUNÇÃO:		session_Detach
+// Descrição: 	Desanexa um cliente da sessão. Quando não houver mais clientes a contagem do tempo de ociosidade é iniciada
+// Retorna:		Quantidade de clientes que continuam anexados
+// -------------------------------------------------------------------------------------------------------------------
+int session_Detach(tPanel* panel) {
+	tSession* session = panel->session;
+	pthread_mutex_lock(&session->lock);
+	if (session->refs > 0 && --session->refs == 0) session->idleSince = now();
+	int refs = session->refs;
+	pthread_mutex_unlock(&session->lock);
+	return refs;
+}
+
+// -------------------------------------------------------------------------------------------------------------------
+// FUNÇÃO:		session_Clients
+// Retorna:		Quantidade de clientes anexados
+// -------------------------------------------------------------------------------------------------------------------
+int session_Clients(tPanel* panel) {
+	pthread_mutex_lock(&panel->session->lock);
+	int refs = panel->session->refs;
+	pthread_mutex_unlock(&panel->session->lock);
+	return refs;
+}
+
+// -------------------------------------------------------------------------------------------------------------------
+// FUNÇÃO:		session_Lock
+// Descrição: 	Serializa as operações feitas sobre o painel pelos objetos Panel que o compartilham, inclusive os de
+//				worker_threads. Assim nunca concorrem, por exemplo, um Record com um StopRecord de outro objeto.
+//				Não deve ser chamada com o lock da sessão adquirido
+// -------------------------------------------------------------------------------------------------------------------
+void session_Lock(tPanel* panel) {
+	pthread_mutex_lock(&panel->session->opsLock);
+}
+
+// -------------------------------------------------------------------------------------------------------------------
+// FUNÇÃO:		session_Unlock
+// Descrição: 	Libera o painel adquirido com session_Lock
+// -------------------------------------------------------------------------------------------------------------------
+void session_Unlock(tPanel* panel) {
+	pthread_mutex_unlock(&panel->session->opsLock);
+}
+
+// -------------------------------------------------------------------------------------------------------------------
+// FUNÇÃO:		session_Expired
+// Descrição: 	Chamada pela thread modbus_Process a cada ciclo. Se a sessão ficou sem clientes por mais de SESSION_IDLE_GRACE ms
+//				a UART é fechada e a thread deve terminar.
+//				Usa trylock para que a thread nunca fique bloqueada esperando uma chamada vinda do JS.
+// Retorna:		pdTRUE se a thread deve terminar
+// -------------------------------------------------------------------------------------------------------------------
+int session_Expired(tPanel* panel) {
+	tSession* session = panel->session;
+	if (pthread_mutex_trylock(&session->lock) != 0) return pdFALSE;
+
+	int expired = session->attached && session->running && session->refs == 0 &&
+		(now() - session->idleSince) >= SESSION_IDLE_GRACE;
+	if (expired) {
+		// a própria thread está fechando a sessão, ela será recolhida no próximo Start
+		session->running = pdFALSE;
+		session->joinPending = pdTRUE;
+		Close(panel);
+	}
+
+	pthread_mutex_unlock(&session->lock);
+	return expired;
+}
@@ -0,0 +1,146 @@
+#include "_config_cpu_.h"
+#include "app.h"
+#include <pthread.h>
+#include <stdlib.h>
+
+// Resposta do GetValues serializada uma única vez por amostra
+//	A thread modbus_Process escreve o json de cada amostra publicada no buffer livre e depois troca os buffers,
+//	o lock só é mantido durante a troca. Os clientes leem sempre o buffer da última amostra, então o custo
+//	da serialização não depende da quantidade de clientes nem da frequência das consultas.
+//	A amostra de cada buffer também é mantida para o snapshot_Values, que a copia já na disposição do Int32Array do panel.values().
+
+struct tSnapshot {
+	tJson buffers[2];
+	tSample samples[2];		// Amostra de cada buffer, usada pelo snapshot_Values
+	int front;				// Buffer com a última amostra publicada
+	uint seq;				// Sequência da amostra em buffers[front], 0 se nenhuma amostra foi publicada
+	pthread_mutex_t lock;
+};
+
+// -------------------------------------------------------------------------------------------------------------------
+// FUNÇÃO:		snapshot_Multimeters
+// Descrição: 	Escreve os valores dos multímetros separados por função: func 1 em amperemeter e 0 em voltmeter,
+//				cada lista na ordem dos multímetros. O valor é 0 enquanto o multímetro não tem leitura (sts 0)
+// -------------------------------------------------------------------------------------------------------------------
+void snapshot_Multimeters(tJson* json, const tMultimeter* multimeter, uint n) {
+	uint i;
+	int func, first;
+
+	for (func=1; func>=0; func--) {
+		json_Str(json, (func) ? "\"amperemeter\":[" : ",\"voltmeter\":[");
+		first = pdTRUE;
+		for(i =0; i < n ; i++){
+			if ((multimeter[i].func != 0) != func) continue;
+			if (!first) json_Char(json, ',');
+			json_Int(json, (multimeter[i].sts) ? multimeter[i].value : 0);
+			first = pdFALSE;
+		}
+		json_Char(json, ']');
+	}
+}
+
+// -------------------------------------------------------------------------------------------------------------------
+// FUNÇÃO:		snapshot_New
+// Retorna:		Buffers de um painel sem nenhuma amostra publicada, ou NULL se não há memória
+// -------------------------------------------------------------------------------------------------------------------
+tSnapshot* snapshot_New(void) {
+	tSnapshot* snapshot = (tSnapshot*)calloc(1, sizeof(tSnapshot));
+	if (snapshot) pthread_mutex_init(&snapshot->lock, NULL);
+	return snapshot;
+}
+
+// -------------------------------------------------------------------------------------------------------------------
+// FUNÇÃO:		snapshot_Free
+// -------------------------------------------------------------------------------------------------------------------
+void snapshot_Free(tSnapshot* snapshot) {
+	if (!snapshot) return;
+	json_Free(&snapshot->buffers[0]);
+	json_Free(&snapshot->buffers[1]);
+	pthread_mutex_destroy(&snapshot->lock);
+	free(snapshot);
+}
+
+// -------------------------------------------------------------------------------------------------------------------
+// FUNÇÃO:		snapshot_Push
+// Descrição: 	Serializa a resposta do GetValues de uma amostra publicada. Chamada somente pela thread modbus_Process
+// -------------------------------------------------------------------------------------------------------------------
+void snapshot_Push(tSnapshot* snapshot, const tSample* sample) {
+	// somente esta thread troca os buffers, então o buffer livre pode ser escrito sem o lock
+	tJson* json = &snapshot->buffers[!snapshot->front];
+	json_Reset(json);
+	json_Char(json, '{');
+	snapshot_Multimeters(json, sample->multimeter, sample->nMultimeters);
+	json_Char(json, '}');
+	if (json->overflow) return;
+	snapshot->samples[!snapshot->front] = *sample;
+
+	pthread_mutex_lock(&snapshot->lock);
+	snapshot->front = !snapshot->front;
+	snapshot->seq = sample->seq;
+	pthread_mutex_unlock(&snapshot->lock);
+}
+
+// -------------------------------------------------------------------------------------------------------------------
+// FUNÇÃO:		snapshot_Acquire
+// Descrição: 	Bloqueia o buffer da última amostra publicada para leitura. Deve ser seguido de snapshot_Release
+// Parametros:	len: Retorna o tamanho do json
+//				seq: Retorna a sequência da amostra
+// Retorna:		json da última amostra, ou NULL se nenhuma amostra foi publicada (neste caso não é necessário o snapshot_Release)
+// -------------------------------------------------------------------------------------------------------------------
+const char* snapshot_Acquire(tSnapshot* snapshot, uint* len, uint* seq) {
+	pthread_mutex_lock(&snapshot->lock);
+	if (snapshot->seq == 0) {
+		pthread_mutex_unlock(&snapshot->lock);
+		return (const char*)NULL;
+	}
+	*len = snapshot->buffers[snapshot->front].len;
+	*seq = snapshot->seq;
+	return snapshot->buffers[snapshot->front].buf;
+}
+
+// -------------------------------------------------------------------------------------------------------------------
+// FUNÇÃO:		snapshot_Release
+// -------------------------------------------------------------------------------------------------------------------
+void snapshot_Release(tSnapshot* snapshot) {
+	pthread_mutex_unlock(&snapshot->lock);
+}
+
+// -------------------------------------------------------------------------------------------------------------------
+// FUNÇÃO:		snapshot_Values
+// Descrição: 	Copia a última amostra publicada em values na disposição tValuesHeader/tValuesChannel
+// Parametros:	values: Buffer com lenVALUES inteiros
+//				seq: Sequência da amostra que já está em values, a cópia só é feita se uma nova amostra foi publicada
+// Retorna:		Sequência da amostra em values
+// -------------------------------------------------------------------------------------------------------------------
+uint snapshot_Values(tSnapshot* snapshot, int* values, uint seq) {
+	pthread_mutex_lock(&snapshot->lock);
+	if (snapshot->seq == 0 || snapshot->seq == seq) {
+		pthread_mutex_unlock(&snapshot->lock);
+		return seq;
+	}
+
+	const tSample* sample = &snapshot->samples[snapshot->front];
+	u64 ms = sample->time / 1000;
+	values[valSEQ] = sample->seq;
+	values[valN_MULTIMETERS] = sample->nMultimeters;
+	values[valSTS_COM] = sample->stsCom;
+	values[valRELAYS] = sample->relays;
+	values[valDOUTS] = sample->douts;
+	values[valTIME_LOW] = (int)(ms & 0xffffffff);
+	values[valTIME_HIGH] = (int)(ms >> 32);
+	values[valRESERVED] = 0;
+
+	uint x; for (x=0; x<nMULTIMETER; x++) {
+		int* ch = &values[valHEADER + x*valCHANNEL];
+		const tMultimeter* m = &sample->multimeter[x];
+		int valid = x < sample->nMultimeters;
+		ch[valVALUE] = (valid && m->sts) ? m->value : 0;
+		ch[valSTS] = valid ? m->sts : 0;
+		ch[valFUNC] = valid ? m->func : 0;
+		ch[valMULTIMETER_STS_COM] = valid ? m->stsCom : 0;
+	}
+	seq = snapshot->seq;
+	pthread_mutex_unlock(&snapshot->lock);
+
+	return seq;
+}
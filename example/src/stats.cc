@@ -0,0 +1,493 @@
+#include "timer/timer.h"
+#include "_config_cpu_.h"
+#include "app.h"
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Estatísticas das transações modbus
+//	A thread modbus_Process registra cada comando enviado (stats_Request) e cada resposta (stats_Response), separados por
+//	escravo e função modbus. As latências entre o envio e a resposta validada são acumuladas num histograma log-linear
+//	(como o HdrHistogram): valores até 2^statsSUB_BITS us ficam em fatias de 1us e cada potência de 2 acima é dividida
+//	em 2^statsSUB_BITS fatias, assim o erro dos percentis fica abaixo de 1/2^statsSUB_BITS (~3%) do valor.
+//	O registro é O(1) e a leitura percorre o histograma de cada par escravo/função, o custo não depende da quantidade de transações.
+//	A ocupação do barramento (stats_Bus) é medida pelos contadores de bytes da UART.
+//	Os contadores só crescem e não usam lock: somente a thread modbus_Process escreve, com escritas atômicas, e os leitores
+//	leem com leituras atômicas, assim a leitura nunca bloqueia a aquisição. O reset do stats_Read não zera os contadores,
+//	somente guarda uma cópia como base da próxima leitura, então o stats_Metrics continua vendo os totais.
+
+#define statsSUB_BITS		5
+#define statsSUB			(1 << statsSUB_BITS)
+#define statsMAX_BITS		32		// Latências a partir de 2^32 us (~71 minutos) ficam na última fatia
+#define nSTATS_BUCKETS		((statsMAX_BITS - statsSUB_BITS + 1) * statsSUB)
+
+// Somente a thread modbus_Process altera os contadores, então o incremento não precisa ser atômico, somente a escrita
+#define Inc(var, v)			__atomic_store_n(&(var), (var) + (v), __ATOMIC_RELAXED)
+#define Set(var, v)			__atomic_store_n(&(var), (v), __ATOMIC_RELAXED)
+#define Get(var)			__atomic_load_n(&(var), __ATOMIC_RELAXED)
+
+typedef struct {
+	int slave;
+	int function;			// 0 se a posição está livre. Escrito por último no registro do par, ver Find
+	uint requests, retries, responses;
+	uint timeouts, crcs, exceptions, lenPackets, others;
+	int up;					// A última transação teve resposta validada
+	uint failures;			// Falhas consecutivas desde a última resposta validada
+	u64 sum;				// Soma das latências em us
+	uint buckets[nSTATS_BUCKETS];
+} tEntry;
+
+typedef struct {
+	u64 txBytes, rxBytes;	// Contadores da UART no último stats_Bus
+	u64 turnaround, idle;	// Somas em us
+	uint turnarounds, idles;
+} tBusCounters;
+
+struct tStatistics {
+	// escritos somente pela thread modbus_Process
+	tEntry entries[nSTATS];
+	tBusCounters bus;
+	u64 cpuDone;			// Tempo de CPU em us das threads modbus_Process já encerradas
+	u64 cpuThread;			// Tempo de CPU em us da thread em execução
+
+	// base da próxima leitura do stats_Read, usada somente pelos leitores
+	tEntry base[nSTATS];
+	tBusCounters busBase;
+	u64 since;				// Início da contagem em us
+	pthread_mutex_t lock;	// Serializa os leitores do stats_Read entre si, a thread modbus_Process não o usa
+};
+
+// Fatia do histograma da latência v em us
+static int Bucket(u64 v) {
+	if (v < statsSUB) return (int)v;
+	int e = 63 - __builtin_clzll(v);	// posição do bit mais significativo, >= statsSUB_BITS
+	if (e >= statsMAX_BITS) return nSTATS_BUCKETS - 1;
+	return (e - statsSUB_BITS + 1) * statsSUB + (int)((v >> (e - statsSUB_BITS)) & (statsSUB - 1));
+}
+
+// Menor latência em us que cai na fatia b
+static u64 BucketLow(int b) {
+	if (b < statsSUB) return b;
+	int e = b / statsSUB + statsSUB_BITS - 1;
+	return (u64)(statsSUB + b % statsSUB) << (e - statsSUB_BITS);
+}
+
+// Maior latência em us que cai na fatia b
+static u64 BucketValue(int b) {
+	if (b < statsSUB) return b;
+	return BucketLow(b) + (1ull << (b / statsSUB - 1)) - 1;
+}
+
+// Par escravo/função, registrado no primeiro uso. Retorna NULL se não há mais posições. Somente na thread modbus_Process
+static tEntry* Find(tStatistics* stats, int slave, int function) {
+	int x; for (x=0; x<nSTATS; x++) {
+		tEntry* e = &stats->entries[x];
+		if (e->function == 0) {
+			e->slave = slave;
+			__atomic_store_n(&e->function, function, __ATOMIC_RELEASE); // o leitor que vê a função também vê o escravo
+			return e;
+		}
+		if (e->slave == slave && e->function == function) return e;
+	}
+	return NULL;
+}
+
+// Quantidade de pares registrados
+static int Entries(tStatistics* stats) {
+	int n; for (n=0; n<nSTATS; n++)
+		if (!__atomic_load_n(&stats->entries[n].function, __ATOMIC_ACQUIRE)) break;
+	return n;
+}
+
+// Copia os contadores do par x, menos os da base se base não é NULL
+static void Snapshot(tStatistics* stats, int x, const tEntry* base, tEntry* out) {
+	static const tEntry zero = {};
+	const tEntry* e = &stats->entries[x];
+	if (!base) base = &zero;
+
+	out->slave = e->slave;
+	out->function = e->function;
+	out->requests = Get(e->requests) - base->requests;
+	out->retries = Get(e->retries) - base->retries;
+	out->responses = Get(e->responses) - base->responses;
+	out->timeouts = Get(e->timeouts) - base->timeouts;
+	out->crcs = Get(e->crcs) - base->crcs;
+	out->exceptions = Get(e->exceptions) - base->exceptions;
+	out->lenPackets = Get(e->lenPackets) - base->lenPackets;
+	out->others = Get(e->others) - base->others;
+	out->up = Get(e->up);
+	out->failures = Get(e->failures);
+	out->sum = Get(e->sum) - base->sum;
+	int b; for (b=0; b<nSTATS_BUCKETS; b++)
+		out->buckets[b] = Get(e->buckets[b]) - base->buckets[b];
+}
+
+static void SnapshotBus(tStatistics* stats, const tBusCounters* base, tBusCounters* out) {
+	static const tBusCounters zero = {};
+	if (!base) base = &zero;
+	out->txBytes = Get(stats->bus.txBytes) - base->txBytes;
+	out->rxBytes = Get(stats->bus.rxBytes) - base->rxBytes;
+	out->turnaround = Get(stats->bus.turnaround) - base->turnaround;
+	out->idle = Get(stats->bus.idle) - base->idle;
+	out->turnarounds = Get(stats->bus.turnarounds) - base->turnarounds;
+	out->idles = Get(stats->bus.idles) - base->idles;
+}
+
+// Latência do percentil p (0 a 100) das respostas validadas do histograma
+static uint Percentile(const tEntry* e, uint responses, double p) {
+	u64 rank = (u64)(p * responses / 100.0 + 0.5);
+	u64 count = 0;
+	if (rank < 1) rank = 1;
+	int b; for (b=0; b<nSTATS_BUCKETS; b++) {
+		count += e->buckets[b];
+		if (count >= rank) return (uint)BucketValue(b);
+	}
+	return 0;
+}
+
+// -------------------------------------------------------------------------------------------------------------------
+// FUNÇÃO:		stats_New
+// Retorna:		Estatísticas vazias de um painel, ou NULL se não há memória
+// -------------------------------------------------------------------------------------------------------------------
+tStatistics* stats_New(void) {
+	tStatistics* stats = (tStatistics*)calloc(1, sizeof(tStatistics));
+	if (stats) {
+		pthread_mutex_init(&stats->lock, NULL);
+		stats->since = now_us();
+	}
+	return stats;
+}
+
+// -------------------------------------------------------------------------------------------------------------------
+// FUNÇÃO:		stats_Free
+// -------------------------------------------------------------------------------------------------------------------
+void stats_Free(tStatistics* stats) {
+	if (!stats) return;
+	pthread_mutex_destroy(&stats->lock);
+	free(stats);
+}
+
+// -------------------------------------------------------------------------------------------------------------------
+// FUNÇÃO:		stats_Start
+// Descrição: 	Chamada pela thread modbus_Process ao iniciar, acumula o tempo de CPU da thread anterior
+// -------------------------------------------------------------------------------------------------------------------
+void stats_Start(tStatistics* stats) {
+	Inc(stats->cpuDone, stats->cpuThread);
+	Set(stats->cpuThread, 0);
+}
+
+// -------------------------------------------------------------------------------------------------------------------
+// FUNÇÃO:		stats_Cpu
+// Descrição: 	Atualiza o tempo de CPU da thread modbus_Process. Chamada pela própria thread
+// Parametros:	cpu: Tempo de CPU em us da thread desde o seu início, ver CLOCK_THREAD_CPUTIME_ID
+// -------------------------------------------------------------------------------------------------------------------
+void stats_Cpu(tStatistics* stats, u64 cpu) {
+	Set(stats->cpuThread, cpu);
+}
+
+// -------------------------------------------------------------------------------------------------------------------
+// FUNÇÃO:		stats_Request
+// Descrição: 	Conta um comando enviado ao escravo. Chamada pela thread modbus_Process
+// Parametros:	function: Código da função modbus
+//				retry: pdTRUE se o comando é o reenvio de um comando que falhou
+// -------------------------------------------------------------------------------------------------------------------
+void stats_Request(tStatistics* stats, int slave, int function, int retry) {
+	tEntry* e = Find(stats, slave, function);
+	if (!e) return;
+	Inc(e->requests, 1);
+	if (retry) Inc(e->retries, 1);
+}
+
+// -------------------------------------------------------------------------------------------------------------------
+// FUNÇÃO:		stats_Response
+// Descrição: 	Conta o resultado de um comando. Chamada pela thread modbus_Process
+// Parametros:	ret: Status da comunicação, ver modbus_MasterReadStatus. Negativo se houve erro, inclusive no envio
+//				latency: Tempo em us entre o envio do comando e a resposta, usado somente quando ret não é negativo
+// -------------------------------------------------------------------------------------------------------------------
+void stats_Response(tStatistics* stats, int slave, int function, int ret, u64 latency) {
+	tEntry* e = Find(stats, slave, function);
+	if (!e) return;
+
+	Set(e->up, ret >= 0);
+	Set(e->failures, (ret >= 0) ? 0 : e->failures + 1);
+	if (ret >= 0) {
+		Inc(e->buckets[Bucket(latency)], 1);
+		Inc(e->sum, latency);
+		Inc(e->responses, 1);
+	} else if (ret == errMODBUS_TIMEOUT) Inc(e->timeouts, 1);
+	else if (ret == errMODBUS_CRC) Inc(e->crcs, 1);
+	else if (ret == errMODBUS_EXCEPTION) Inc(e->exceptions, 1);
+	else if (ret == errMODBUS_LENPACKET) Inc(e->lenPackets, 1);
+	else Inc(e->others, 1);
+}
+
+// -------------------------------------------------------------------------------------------------------------------
+// FUNÇÃO:		stats_Bus
+// Descrição: 	Contabiliza a ocupação do barramento na conclusão de cada comando. Chamada pela thread modbus_Process
+// Parametros:	txBytes, rxBytes: Contadores de bytes da UART, ver tUart
+//				turnaround: Tempo em us entre o fim da transmissão do comando e o primeiro byte da resposta, negativo se não houve resposta
+//				idle: Tempo em us entre a conclusão do comando anterior e o envio deste, negativo se é o primeiro comando da thread
+// -------------------------------------------------------------------------------------------------------------------
+void stats_Bus(tStatistics* stats, u64 txBytes, u64 rxBytes, s64 turnaround, s64 idle) {
+	Set(stats->bus.txBytes, txBytes);
+	Set(stats->bus.rxBytes, rxBytes);
+	if (turnaround >= 0) {
+		Inc(stats->bus.turnaround, (u64)turnaround);
+		Inc(stats->bus.turnarounds, 1);
+	}
+	if (idle >= 0) {
+		Inc(stats->bus.idle, (u64)idle);
+		Inc(stats->bus.idles, 1);
+	}
+}
+
+// -------------------------------------------------------------------------------------------------------------------
+// FUNÇÃO:		stats_Read
+// Descrição: 	Copia as estatísticas de cada par escravo/função, na ordem do primeiro uso, e a ocupação do barramento
+//				desde o início ou desde o último reset
+// Parametros:	out: Buffer para nSTATS estatísticas
+//				bus: Retorna a ocupação do barramento, pode ser NULL
+//				reset: pdTRUE para iniciar uma nova contagem após a cópia, assim a próxima leitura cobre somente o intervalo seguinte
+// Retorna:		Quantidade de estatísticas em out
+// -------------------------------------------------------------------------------------------------------------------
+int stats_Read(tStatistics* stats, tStats* out, tBus* bus, int reset) {
+	tEntry e;
+	uint txFrames = 0, rxFrames = 0;
+	u64 t = now_us();
+	int x, b;
+
+	pthread_mutex_lock(&stats->lock);
+	int n = Entries(stats);
+	for (x=0; x<n; x++) {
+		tStats* s = &out[x];
+		Snapshot(stats, x, &stats->base[x], &e);
+		// as respostas são contadas pelo histograma, que pode estar à frente do contador responses lido antes
+		uint responses = 0;
+		int first = -1, last = -1;
+		for (b=0; b<nSTATS_BUCKETS; b++) {
+			if (!e.buckets[b]) continue;
+			responses += e.buckets[b];
+			if (first < 0) first = b;
+			last = b;
+		}
+
+		s->slave = e.slave;
+		s->function = e.function;
+		s->requests = e.requests;
+		s->retries = e.retries;
+		s->responses = e.responses;
+		s->timeouts = e.timeouts;
+		s->crcs = e.crcs;
+		s->exceptions = e.exceptions;
+		s->lenPackets = e.lenPackets;
+		s->others = e.others;
+		s->min = (first >= 0) ? (uint)BucketLow(first) : 0;
+		s->max = (last >= 0) ? (uint)BucketValue(last) : 0;
+		s->mean = e.responses ? (uint)(e.sum / e.responses) : 0;
+		s->p50 = responses ? Percentile(&e, responses, 50) : 0;
+		s->p90 = responses ? Percentile(&e, responses, 90) : 0;
+		s->p99 = responses ? Percentile(&e, responses, 99) : 0;
+		s->p999 = responses ? Percentile(&e, responses, 99.9) : 0;
+		txFrames += e.requests;
+		rxFrames += e.responses;
+		if (reset) Snapshot(stats, x, NULL, &stats->base[x]);
+	}
+
+	if (bus) {
+		tBusCounters c;
+		SnapshotBus(stats, &stats->busBase, &c);
+		bus->elapsed = t - stats->since;
+		bus->txBytes = c.txBytes;
+		bus->rxBytes = c.rxBytes;
+		bus->txFrames = txFrames;
+		bus->rxFrames = rxFrames;
+		bus->turnaround = c.turnarounds ? (uint)(c.turnaround / c.turnarounds) : 0;
+		bus->idle = c.idles ? (uint)(c.idle / c.idles) : 0;
+	}
+
+	if (reset) {
+		SnapshotBus(stats, NULL, &stats->busBase);
+		stats->since = t;
+	}
+	pthread_mutex_unlock(&stats->lock);
+
+	return n;
+}
+
+// -------------------------------------------------------------------------------------------------------------------
+// FUNÇÃO:		stats_Utilization
+// Descrição: 	Fração da taxa teórica da linha ocupada pelos bytes enviados e recebidos. Cada byte ocupa 10 bits no
+//				barramento (start, 8 bits de dados e stop), e o RS-485 é half-duplex, então envio e recepção somam
+// Parametros:	bps: Velocidade da UART em bits por segundo, ver uart_Bps
+// Retorna:		De 0 a 1, ou 0 se a velocidade não é conhecida
+// -------------------------------------------------------------------------------------------------------------------
+double stats_Utilization(const tBus* bus, uint bps) {
+	if (!bps || !bus->elapsed) return 0;
+	return (double)(bus->txBytes + bus->rxBytes) * 10 * 1000000 / ((double)bps * bus->elapsed);
+}
+
+// #####################################################################################################################
+// PROMETHEUS
+// #####################################################################################################################
+
+// Limites das fatias do panel_modbus_latency_seconds em us
+static const u64 latencyBounds[] = { 1000, 2000, 5000, 10000, 20000, 50000, 100000, 200000, 500000, 1000000, 2000000, 5000000 };
+
+static void Family(tJson* text, const char* name, const char* type, const char* help) {
+	json_Str(text, "# HELP ");
+	json_Str(text, name);
+	json_Char(text, ' ');
+	json_Str(text, help);
+	json_Str(text, "\n# TYPE ");
+	json_Str(text, name);
+	json_Char(text, ' ');
+	json_Str(text, type);
+	json_Char(text, '\n');
+}
+
+static void Metric(tJson* text, const char* name, const char* labels, u64 value) {
+	json_Str(text, name);
+	json_Char(text, '{');
+	json_Str(text, labels);
+	json_Str(text, "} ");
+	json_Uint(text, value);
+	json_Char(text, '\n');
+}
+
+// Tempo em us escrito em segundos
+static void MetricSeconds(tJson* text, const char* name, const char* labels, u64 us) {
+	char value[32];
+	snprintf(value, sizeof(value), "%llu.%06llu", (unsigned long long)(us / 1000000), (unsigned long long)(us % 1000000));
+	json_Str(text, name);
+	json_Char(text, '{');
+	json_Str(text, labels);
+	json_Str(text, "} ");
+	json_Str(text, value);
+	json_Char(text, '\n');
+}
+
+// -------------------------------------------------------------------------------------------------------------------
+// FUNÇÃO:		stats_Metrics
+// Descrição: 	Escreve os contadores do painel no formato texto do Prometheus (versão 0.0.4): transações, erros e latências
+//				por escravo e função, estado de cada par escravo/função, ocupação do barramento, amostras publicadas,
+//				status dos multímetros na última amostra e tempo de CPU da thread modbus_Process.
+//				Não usa lock, os contadores são lidos com leituras atômicas e a última amostra vem do histórico
+// Parametros:	text: Buffer onde o texto é escrito, após o conteúdo que já está nele
+// -------------------------------------------------------------------------------------------------------------------
+void stats_Metrics(tPanel* panel, tJson* text) {
+	tStatistics* stats = panel->stats;
+	char port[160], labels[240], name[64];
+	tEntry entries[nSTATS];
+	tBusCounters bus;
+	tSample sample;
+	int x, b, k;
+	uint i;
+
+	// o rótulo port segue o escape do formato: \, " e quebra de linha
+	char* p = port;
+	p += sprintf(p, "port=\"");
+	for (i=0; panel->port[i] && p < port + sizeof(port) - 4; i++) {
+		if (panel->port[i] == '\\' || panel->port[i] == '"') *p++ = '\\';
+		if (panel->port[i] == '\n') { *p++ = '\\'; *p++ = 'n'; }
+		else *p++ = panel->port[i];
+	}
+	*p++ = '"';
+	*p = 0;
+
+	int n = Entries(stats);
+	for (x=0; x<n; x++) Snapshot(stats, x, NULL, &entries[x]);
+	SnapshotBus(stats, NULL, &bus);
+
+	uint last = history_Last(panel->history);
+	int hasSample = last && history_Read(panel->history, last - 1, &sample, 1, NULL) == 1;
+
+	Family(text, "panel_samples_total", "counter", "Multimeter readings published by the acquisition thread.");
+	Metric(text, "panel_samples_total", port, last);
+	if (hasSample) {
+		Family(text, "panel_sample_timestamp_seconds", "gauge", "Time of the last published reading.");
+		MetricSeconds(text, "panel_sample_timestamp_seconds", port, sample.time);
+		Family(text, "panel_multimeter_status", "gauge", "Multimeter status (sts) in the last published reading.");
+		for (i=0; i<sample.nMultimeters; i++) {
+			snprintf(labels, sizeof(labels), "%s,channel=\"%u\"", port, i);
+			Metric(text, "panel_multimeter_status", labels, sample.multimeter[i].sts);
+		}
+		Family(text, "panel_multimeter_comm_status", "gauge", "Communication status between the RH and each multimeter in the last published reading.");
+		for (i=0; i<sample.nMultimeters; i++) {
+			snprintf(labels, sizeof(labels), "%s,channel=\"%u\"", port, i);
+			Metric(text, "panel_multimeter_comm_status", labels, sample.multimeter[i].stsCom);
+		}
+	}
+
+	Family(text, "panel_acquisition_cpu_seconds_total", "counter", "CPU time used by the acquisition threads.");
+	MetricSeconds(text, "panel_acquisition_cpu_seconds_total", port, Get(stats->cpuDone) + Get(stats->cpuThread));
+
+	// contadores por escravo e função, uma família por vez
+	static const struct { const char* name; const char* type; const char* help; } families[] = {
+		{ "panel_modbus_requests_total", "counter", "Modbus commands sent." },
+		{ "panel_modbus_retries_total", "counter", "Modbus commands resent after the same command failed." },
+		{ "panel_modbus_responses_total", "counter", "Modbus responses validated." },
+		{ "panel_modbus_errors_total", "counter", "Modbus commands failed, by error." },
+		{ "panel_modbus_up", "gauge", "1 if the last command to the slave had a validated response." },
+		{ "panel_modbus_consecutive_failures", "gauge", "Commands failed since the last validated response." },
+	};
+	static const char* errors[] = { "timeout", "crc", "exception", "lenpacket", "other" };
+	for (k=0; k<(int)(sizeof(families)/sizeof(families[0])); k++) {
+		if (!n) break;
+		Family(text, families[k].name, families[k].type, families[k].help);
+		for (x=0; x<n; x++) {
+			tEntry* e = &entries[x];
+			snprintf(labels, sizeof(labels), "%s,slave=\"%i\",function=\"%i\"", port, e->slave, e->function);
+			if (k == 0) Metric(text, families[k].name, labels, e->requests);
+			else if (k == 1) Metric(text, families[k].name, labels, e->retries);
+			else if (k == 2) Metric(text, families[k].name, labels, e->responses);
+			else if (k == 4) Metric(text, families[k].name, labels, e->up);
+			else if (k == 5) Metric(text, families[k].name, labels, e->failures);
+			else {
+				uint counts[] = { e->timeouts, e->crcs, e->exceptions, e->lenPackets, e->others };
+				uint j; for (j=0; j<sizeof(errors)/sizeof(errors[0]); j++) {
+					snprintf(labels, sizeof(labels), "%s,slave=\"%i\",function=\"%i\",error=\"%s\"", port, e->slave, e->function, errors[j]);
+					Metric(text, families[k].name, labels, counts[j]);
+				}
+			}
+		}
+	}
+
+	// histograma acumulado nas fatias do Prometheus: cada fatia do histograma entra no primeiro limite que contém o seu maior valor
+	if (n) Family(text, "panel_modbus_latency_seconds", "histogram", "Time from sending a modbus command to its validated response.");
+	for (x=0; x<n; x++) {
+		tEntry* e = &entries[x];
+		u64 count = 0;
+		b = 0;
+		for (k=0; k<(int)(sizeof(latencyBounds)/sizeof(latencyBounds[0])); k++) {
+			for (; b<nSTATS_BUCKETS && BucketValue(b) <= latencyBounds[k]; b++) count += e->buckets[b];
+			snprintf(labels, sizeof(labels), "%s,slave=\"%i\",function=\"%i\",le=\"%g\"", port, e->slave, e->function, latencyBounds[k] / 1e6);
+			Metric(text, "panel_modbus_latency_seconds_bucket", labels, count);
+		}
+		for (; b<nSTATS_BUCKETS; b++) count += e->buckets[b];
+		snprintf(labels, sizeof(labels), "%s,slave=\"%i\",function=\"%i\",le=\"+Inf\"", port, e->slave, e->function);
+		Metric(text, "panel_modbus_latency_seconds_bucket", labels, count);
+		snprintf(labels, sizeof(labels), "%s,slave=\"%i\",function=\"%i\"", port, e->slave, e->function);
+		MetricSeconds(text, "panel_modbus_latency_seconds_sum", labels, e->sum);
+		Metric(text, "panel_modbus_latency_seconds_count", labels, count);
+	}
+
+	Family(text, "panel_bus_baudrate", "gauge", "Configured UART speed in bits per second.");
+	Metric(text, "panel_bus_baudrate", port, uart_Bps(panel->baudrate));
+	Family(text, "panel_bus_tx_bytes_total", "counter", "Bytes sent on the bus.");
+	Metric(text, "panel_bus_tx_bytes_total", port, bus.txBytes);
+	Family(text, "panel_bus_rx_bytes_total", "counter", "Bytes received from the bus.");
+	Metric(text, "panel_bus_rx_bytes_total", port, bus.rxBytes);
+
+	static const char* summaries[][2] = {
+		{ "panel_bus_turnaround_seconds", "Time from the end of a command transmission to the first byte of the response." },
+		{ "panel_bus_idle_seconds", "Time the bus stays idle between a command completion and the next command." },
+	};
+	for (k=0; k<2; k++) {
+		Family(text, summaries[k][0], "summary", summaries[k][1]);
+		snprintf(name, sizeof(name), "%s_sum", summaries[k][0]);
+		MetricSeconds(text, name, port, k ? bus.idle : bus.turnaround);
+		snprintf(name, sizeof(name), "%s_count", summaries[k][0]);
+		Metric(text, name, port, k ? bus.idles : bus.turnarounds);
+	}
+}
@@ -4,6 +4,13 @@
 // retorna a funo em milisegundos
 tTime now(void) {
    struct timeval tv;
-   if(gettimeofday(&tv, (__timezone_ptr_t)NULL) != 0) return 0;
+   if(gettimeofday(&tv, NULL) != 0) return 0;
    return (tTime)((tv.tv_sec * 1000ul) + (tv.tv_usec / 1000ul));
 }
+
+// retorna o tempo desde epoch em microsegundos. Em 64 bits para no estourar em processadores de 32 bits como o raspberry
+u64 now_us(void) {
+   struct timeval tv;
+   if(gettimeofday(&tv, NULL) != 0) return 0;
+   return ((u64)tv.tv_sec * 1000000ull) + (u64)tv.tv_usec;
+}
@@ -5,5 +5,6 @@
 #include <sys/time.h>
 
 tTime now(void);
+u64 now_us(void);
 
 #endif
@@ -0,0 +1,241 @@
+/* Trace da latência das gravações das saídas, do update/apply no JS até a confirmação do RH
+ *
+ * Cada gravação de reles ou saídas digitais é marcada em seis instantes: a chamada no JS, a entrega do pedido à thread
+ * de aquisição, o envio do comando, o fim estimado da transmissão, o primeiro byte da resposta e a resposta validada.
+ * Os intervalos entre eles separam o tempo gasto em cada etapa:
+ * 	queue		do JS até a thread de aquisição: fila do pool do libuv e transações anteriores do apply
+ * 	bus wait	a thread espera a conclusão do comando em andamento, normalmente a leitura dos multímetros
+ * 	tx			transmissão do comando na velocidade da UART
+ * 	device		do fim da transmissão até o primeiro byte da resposta, o processamento no RH
+ * 	rx			recepção da resposta, o silêncio de fim de quadro e a validação pelo mestre
+ *
+ * O JS, ou a thread do libuv no apply, registra o pedido com trace_Request. A thread de aquisição associa o pedido ao
+ * comando que grava o mesmo valor (trace_Send) e conclui a gravação na resposta (trace_Ack), que vai para um buffer
+ * circular com as últimas TRACE_RING gravações. Pedidos feitos antes do envio são agrupados no comando que grava o
+ * último valor pedido, com os instantes desse último pedido.
+ * A thread de aquisição só usa o lock nas gravações das saídas, as leituras dos multímetros não passam pelo trace.
+ *
+ * O trace_Json exporta no formato JSON do Chrome trace (chrome://tracing, ui.perfetto.dev), uma linha por saída com
+ * a gravação e as etapas aninhadas. Os instantes são em us desde epoch, os mesmos da captura dos quadros.
+ * */
+
+#include "trace.h"
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+typedef struct {
+	int valid;
+	uint value;
+	u64 js, queued;
+} tPending;
+
+struct tTrace {
+	tPending pending[2];	// Último pedido ainda não enviado de cada saída, ver Index
+	tTraceSpan inflight;	// Gravação aguardando a resposta, somente a thread de aquisição usa
+	int active;				// pdTRUE se inflight está em andamento
+	tTraceSpan ring[TRACE_RING];
+	uint count;				// Gravações concluídas desde o início ou desde o último reset
+	pthread_mutex_t lock;
+};
+
+// #####################################################################################################################
+// AUX
+// #####################################################################################################################
+
+static int Index(int output) {
+	return (output == outDOUTS) ? 1 : 0;
+}
+
+// Escreve a string s com o escape do json: \\, " e os caracteres de controle
+static void Escaped(tJson* json, const char* s) {
+	char hex[8];
+	for (; *s; s++) {
+		if (*s == '\\' || *s == '"') {
+			json_Char(json, '\\');
+			json_Char(json, *s);
+		} else if ((u8)*s < 0x20) {
+			sprintf(hex, "\\u%04x", (u8)*s);
+			json_Str(json, hex);
+		} else json_Char(json, *s);
+	}
+}
+
+// Evento completo ("ph":"X") de begin até end na linha da saída
+static void Event(tJson* json, const char* name, int output, u64 begin, u64 end) {
+	json_Str(json, ",\n{\"name\":\"");
+	json_Str(json, name);
+	json_Str(json, "\",\"cat\":\"actuation\",\"ph\":\"X\",\"pid\":1,\"tid\":");
+	json_Int(json, Index(output) + 1);
+	json_Str(json, ",\"ts\":");
+	json_Uint(json, begin);
+	json_Str(json, ",\"dur\":");
+	json_Uint(json, end - begin);
+}
+
+// Gravação com as etapas aninhadas. Os instantes são ordenados, o fim da transmissão é estimado e pode passar
+// do primeiro byte da resposta
+static void Span(tJson* json, const tTraceSpan* s) {
+	static const char* stages[] = { "queue", "bus wait", "tx", "device", "rx" };
+	u64 t[6];
+	char name[32];
+	int x;
+
+	t[0] = (s->js) ? s->js : s->txStart;
+	t[1] = (s->queued) ? s->queued : s->txStart;
+	t[2] = s->txStart;
+	t[3] = s->txEnd;
+	t[4] = (s->rxFirst) ? s->rxFirst : s->ack;
+	t[5] = s->ack;
+	for (x=1; x<6; x++) if (t[x] < t[x-1]) t[x] = t[x-1];
+
+	sprintf(name, "%s 0x%04x", (s->output == outDOUTS) ? "douts" : "relays", s->value);
+	Event(json, name, s->output, t[0], t[5]);
+	json_Str(json, ",\"args\":{\"value\":");
+	json_Uint(json, s->value);
+	json_Str(json, ",\"status\":");
+	json_Int(json, s->status);
+	json_Str(json, ",\"js\":");
+	json_Str(json, (s->js) ? "true" : "false");
+	json_Str(json, "}}");
+
+	for (x=0; x<5; x++) {
+		if (t[x+1] == t[x]) continue;
+		// sem nenhum byte de resposta o intervalo após a transmissão é o timeout do mestre
+		Event(json, (x == 3 && !s->rxFirst) ? "timeout" : stages[x], s->output, t[x], t[x+1]);
+		json_Char(json, '}');
+	}
+}
+
+// #####################################################################################################################
+// FUNCTIONS
+// #####################################################################################################################
+
+// -------------------------------------------------------------------------------------------------------------------
+// FUNÇÃO:		trace_New
+// Retorna:		Trace vazio de um painel, ou NULL se não há memória
+// -------------------------------------------------------------------------------------------------------------------
+tTrace* trace_New(void) {
+	tTrace* trace = (tTrace*)calloc(1, sizeof(tTrace));
+	if (trace) pthread_mutex_init(&trace->lock, NULL);
+	return trace;
+}
+
+// -------------------------------------------------------------------------------------------------------------------
+// FUNÇÃO:		trace_Free
+// -------------------------------------------------------------------------------------------------------------------
+void trace_Free(tTrace* trace) {
+	if (!trace) return;
+	pthread_mutex_destroy(&trace->lock);
+	free(trace);
+}
+
+// -------------------------------------------------------------------------------------------------------------------
+// FUNÇÃO:		trace_Request
+// Descrição: 	Registra o pedido de gravação de uma saída, chamada pelo update no JS ou pelo outputs_Apply.
+//				Substitui o pedido anterior da mesma saída que ainda não foi enviado
+// Parametros:	output: outRELAYS ou outDOUTS
+//				value: Estados pedidos
+//				js: Instante em us da chamada no JS, 0 se não é conhecido
+//				queued: Instante em us da entrega do pedido à thread de aquisição
+// -------------------------------------------------------------------------------------------------------------------
+void trace_Request(tTrace* trace, int output, uint value, u64 js, u64 queued) {
+	tPending* p = &trace->pending[Index(output)];
+	pthread_mutex_lock(&trace->lock);
+	p->valid = pdTRUE;
+	p->value = value;
+	p->js = (js) ? js : queued;
+	p->queued = queued;
+	pthread_mutex_unlock(&trace->lock);
+}
+
+// -------------------------------------------------------------------------------------------------------------------
+// FUNÇÃO:		trace_Send
+// Descrição: 	Chamada pela thread de aquisição ao enviar a gravação de uma saída. Associa o pedido da saída se ele
+//				pediu o mesmo valor, senão a gravação fica sem os instantes do JS
+// Parametros:	output: outRELAYS ou outDOUTS
+//				value: Estados enviados ao RH
+//				time: Instante em us do envio
+// -------------------------------------------------------------------------------------------------------------------
+void trace_Send(tTrace* trace, int output, uint value, u64 time) {
+	tTraceSpan* s = &trace->inflight;
+	tPending* p = &trace->pending[Index(output)];
+
+	memset(s, 0, sizeof(*s));
+	s->output = output;
+	s->value = value;
+	s->txStart = time;
+	pthread_mutex_lock(&trace->lock);
+	if (p->valid && p->value == value) {
+		s->js = p->js;
+		s->queued = p->queued;
+		p->valid = pdFALSE;
+	}
+	pthread_mutex_unlock(&trace->lock);
+	trace->active = pdTRUE;
+}
+
+// -------------------------------------------------------------------------------------------------------------------
+// FUNÇÃO:		trace_Ack
+// Descrição: 	Chamada pela thread de aquisição na conclusão de cada comando. Conclui a gravação enviada pelo
+//				trace_Send, nos demais comandos retorna sem fazer nada
+// Parametros:	status: pdPASS ou o erro errMODBUS_xxx da resposta
+//				txEnd: Instante em us estimado do fim da transmissão
+//				rxFirst: Instante em us do primeiro byte da resposta, 0 se nenhum byte chegou
+//				time: Instante em us da conclusão
+// -------------------------------------------------------------------------------------------------------------------
+void trace_Ack(tTrace* trace, int status, u64 txEnd, u64 rxFirst, u64 time) {
+	if (!trace->active) return;
+	trace->active = pdFALSE;
+
+	tTraceSpan* s = &trace->inflight;
+	s->status = status;
+	s->txEnd = txEnd;
+	s->rxFirst = rxFirst;
+	s->ack = time;
+	pthread_mutex_lock(&trace->lock);
+	trace->ring[trace->count % TRACE_RING] = *s;
+	trace->count++;
+	pthread_mutex_unlock(&trace->lock);
+}
+
+// -------------------------------------------------------------------------------------------------------------------
+// FUNÇÃO:		trace_Read
+// Descrição: 	Copia as últimas gravações concluídas, da mais antiga para a mais recente
+// Parametros:	spans: Buffer onde as gravações serão copiadas
+//				max: Quantidade máxima de gravações a serem copiadas
+//				reset: pdTRUE para descartar as gravações após a cópia
+// Retorna:		Quantidade de gravações copiadas
+// -------------------------------------------------------------------------------------------------------------------
+int trace_Read(tTrace* trace, tTraceSpan* spans, int max, int reset) {
+	pthread_mutex_lock(&trace->lock);
+	uint n = (trace->count < TRACE_RING) ? trace->count : TRACE_RING;
+	if (n > (uint)max) n = max;
+	uint x; for (x=0; x<n; x++) spans[x] = trace->ring[(trace->count - n + x) % TRACE_RING];
+	if (reset) trace->count = 0;
+	pthread_mutex_unlock(&trace->lock);
+	return n;
+}
+
+// -------------------------------------------------------------------------------------------------------------------
+// FUNÇÃO:		trace_Json
+// Descrição: 	Escreve as últimas gravações no formato JSON do Chrome trace, para abrir no chrome://tracing ou no
+//				ui.perfetto.dev
+// Parametros:	json: Buffer onde o trace é escrito
+//				port: Porta do painel, nome do processo no trace
+//				reset: pdTRUE para descartar as gravações após a exportação
+// -------------------------------------------------------------------------------------------------------------------
+void trace_Json(tTrace* trace, tJson* json, const char* port, int reset) {
+	tTraceSpan* spans = (tTraceSpan*)malloc(TRACE_RING * sizeof(tTraceSpan));
+	int x, n = (spans) ? trace_Read(trace, spans, TRACE_RING, reset) : 0;
+
+	json_Str(json, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n");
+	json_Str(json, "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":1,\"args\":{\"name\":\"");
+	Escaped(json, port);
+	json_Str(json, "\"}},\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":1,\"args\":{\"name\":\"relays\"}},");
+	json_Str(json, "\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":2,\"args\":{\"name\":\"douts\"}}");
+	for (x=0; x<n; x++) Span(json, &spans[x]);
+	json_Str(json, "\n]}");
+	free(spans);
+}
@@ -0,0 +1,31 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+#include "../_config_cpu_.h"
+#include "../app.h"
+
+#define TRACE_RING				256			// Gravações das saídas mantidas no histórico do trace
+
+// Instantes em us desde epoch de uma gravação das saídas, do pedido no JS até a resposta do RH
+typedef struct {
+	u64 js;					// Chamada do update ou do apply no JS, 0 se a gravação não foi pedida pelo JS (ex: stop)
+	u64 queued;				// Pedido entregue à thread de aquisição. No update é o mesmo instante da chamada
+	u64 txStart;			// Envio do comando pela thread de aquisição
+	u64 txEnd;				// Fim estimado da transmissão do comando
+	u64 rxFirst;			// Primeiro byte da resposta, 0 se nenhum byte chegou
+	u64 ack;				// Resposta validada pelo mestre, ou a falha do comando
+	int output;				// outRELAYS ou outDOUTS
+	int status;				// pdPASS ou o erro errMODBUS_xxx da resposta
+	uint value;				// Estados gravados
+} tTraceSpan;
+
+// Trace das gravações das saídas de um painel, os campos ficam em trace.cc
+tTrace* trace_New(void);
+void trace_Free(tTrace* trace);
+void trace_Request(tTrace* trace, int output, uint value, u64 js, u64 queued);
+void trace_Send(tTrace* trace, int output, uint value, u64 time);
+void trace_Ack(tTrace* trace, int status, u64 txEnd, u64 rxFirst, u64 time);
+int trace_Read(tTrace* trace, tTraceSpan* spans, int max, int reset);
+void trace_Json(tTrace* trace, tJson* json, const char* port, int reset);
+
+#endif
@@ -3,6 +3,7 @@
 #include <fcntl.h>
 #include <string.h>
 #include <sys/ioctl.h>
+#include <sys/file.h>
 
 // Criado em 2015/04/27
 // Atualizado em 2015/04/29
@@ -10,11 +11,7 @@
 //	http://www.cmrr.umn.edu/~strupp/serial.html
 //	http://man7.org/linux/man-pages/man4/tty_ioctl.4.html
 
-static int uartFD;									// Id da porta UART
-static struct termios uartAttrOld, uartAttr;       	// Vars para atributos da porta UART
-#define lenBUFFER 8*1024
-static u8 rxbuf[lenBUFFER];
-static int rxcnt,rxpos;
+// O estado de cada porta fica em tUart (ver uart.h), assim o programa pode abrir vrias portas ao mesmo tempo
 
 // -------------------------------------------------------------------------------------------------------------------
 // Descrio: 	Abre a porta UART e salva as configuraes atuais antes de ser usada por essa lib
@@ -28,7 +25,7 @@ static int rxcnt,rxpos;
 //					- O usurio no tem permisso para usa essa porta: chmod a+rw /dev/ttyS1
 //					- No existe este n de porta UART
 // -------------------------------------------------------------------------------------------------------------------
-int uart_Init(const char* port, uint baudrate) {
+int uart_Init(tUart* uart, const char* port, uint baudrate) {
 	// AJUSTAR A PORTA
 	
 	// OPEN THE UART
@@ -44,8 +41,13 @@ int uart_Init(const char* port, uint baudrate) {
 	//
 	//	O_NOCTTY - When set and path identifies a terminal device, open() shall not cause the terminal device to become the controlling terminal for the process.
 
-	uartFD = open(port, O_RDWR | O_NOCTTY | O_NDELAY);		//Open in non blocking read/write mode
-	if (uartFD == -1) return pdFAIL;
+	uart->fd = open(port, O_RDWR | O_NOCTTY | O_NDELAY);		//Open in non blocking read/write mode
+	if (uart->fd == -1) return pdFAIL;
+	// a porta  exclusiva: outro painel ou programa que use esta lib falha ao abrir a mesma porta
+	if (flock(uart->fd, LOCK_EX | LOCK_NB) == -1) {
+		close(uart->fd);
+		return pdFAIL;
+	}
 
 	// CONFIGURE THE UART
 	//The flags (defined in /usr/include/termios.h - see http://pubs.opengroup.org/onlinepubs/007908799/xsh/termios.h.html):
@@ -58,34 +60,63 @@ int uart_Init(const char* port, uint baudrate) {
 	//	PARENB - Parity enable
 	//	PARODD - Odd parity (else even)
 
-	tcgetattr(uartFD, &uartAttrOld); // save current port settings
-	tcgetattr(uartFD, &uartAttr); 	// capturar atributos da uart para nossas configuraes
+	tcgetattr(uart->fd, &uart->attrOld); // save current port settings
+	tcgetattr(uart->fd, &uart->attr); 	// capturar atributos da uart para nossas configuraes
 
-	//uartAttr.c_cflag = baudrate | CS8 | CLOCAL | CREAD;
-	uartAttr.c_cflag = CS8 | CLOCAL | CREAD;
-	cfsetospeed(&uartAttr, baudrate);
-    cfsetispeed(&uartAttr, baudrate);
+	//uart->attr.c_cflag = baudrate | CS8 | CLOCAL | CREAD;
+	uart->attr.c_cflag = CS8 | CLOCAL | CREAD;
+	cfsetospeed(&uart->attr, baudrate);
+    cfsetispeed(&uart->attr, baudrate);
 
-	uartAttr.c_iflag = IGNPAR; //| ICRNL;
-	uartAttr.c_oflag = 0;
-	uartAttr.c_lflag = 0;
-	tcflush(uartFD, TCIFLUSH); // limpa buffer de recepo sem ser lido
-	tcsetattr(uartFD, TCSANOW, &uartAttr);
+	uart->attr.c_iflag = IGNPAR; //| ICRNL;
+	uart->attr.c_oflag = 0;
+	uart->attr.c_lflag = 0;
+	tcflush(uart->fd, TCIFLUSH); // limpa buffer de recepo sem ser lido
+	tcsetattr(uart->fd, TCSANOW, &uart->attr);
 	
-	rxcnt = 0;
-	rxpos = 0;
+	uart->rxcnt = 0;
+	uart->rxpos = 0;
 
 	return pdPASS;
 }
 
+// -------------------------------------------------------------------------------------------------------------------
+// Descrio: 	Converte a velocidade em bps para a constante do termios usada pelo uart_Init
+// Parametros:	bps: Velocidade em bits por segundo. Ex: 57600
+// Retorna:		Constante Bxxx, ou 0 (B0) se a velocidade no  suportada
+// -------------------------------------------------------------------------------------------------------------------
+static const uint speeds[][2] = {
+	{ 1200, B1200 }, { 2400, B2400 }, { 4800, B4800 }, { 9600, B9600 }, { 19200, B19200 }, { 38400, B38400 },
+	{ 57600, B57600 }, { 115200, B115200 }, { 230400, B230400 }, { 460800, B460800 }, { 500000, B500000 },
+	{ 576000, B576000 }, { 921600, B921600 }, { 1000000, B1000000 }, { 1152000, B1152000 }, { 1500000, B1500000 },
+	{ 2000000, B2000000 }, { 2500000, B2500000 }, { 3000000, B3000000 }, { 3500000, B3500000 }, { 4000000, B4000000 }
+};
+
+uint uart_Speed(uint bps) {
+	uint x; for (x=0; x<sizeof(speeds)/sizeof(speeds[0]); x++)
+		if (speeds[x][0] == bps) return speeds[x][1];
+	return 0;
+}
+
+// -------------------------------------------------------------------------------------------------------------------
+// Descrio: 	Converte a constante do termios para a velocidade em bps, inverso do uart_Speed
+// Parametros:	speed: Constante Bxxx. Ex: B57600
+// Retorna:		Velocidade em bits por segundo, ou 0 se a constante no  suportada
+// -------------------------------------------------------------------------------------------------------------------
+uint uart_Bps(uint speed) {
+	uint x; for (x=0; x<sizeof(speeds)/sizeof(speeds[0]); x++)
+		if (speeds[x][1] == speed) return speeds[x][0];
+	return 0;
+}
+
 // -------------------------------------------------------------------------------------------------------------------
 // Descrio: 	Fecha a porta UART e restaura as configuraes anteriores antes de ser usada por essa lib
 // Parametros:	Nenhum
 // Retorna:		Nada
 // -------------------------------------------------------------------------------------------------------------------
-void uart_Close(void) {
-	tcsetattr(uartFD, TCSANOW, &uartAttrOld);
-	close(uartFD);
+void uart_Close(tUart* uart) {
+	tcsetattr(uart->fd, TCSANOW, &uart->attrOld);
+	close(uart->fd);
 }
 
 // -------------------------------------------------------------------------------------------------------------------
@@ -96,8 +127,10 @@ void uart_Close(void) {
 //				size: Quantidade de dados do buffer que ser enviado a FIFO
 // Retorna:		Retorna o cdigo da operao. Se for valor negativo houve erro na escrita da FIFO da UART
 // -------------------------------------------------------------------------------------------------------------------
-int uart_SendString(const char* buf) {
-	return write(uartFD, buf, strlen(buf));		//Filestream, bytes to write, number of bytes to write
+int uart_SendString(tUart* uart, const char* buf) {
+	int ret = write(uart->fd, buf, strlen(buf));		//Filestream, bytes to write, number of bytes to write
+	if (ret > 0) uart->txBytes += ret;
+	return ret;
 }
 
 // -------------------------------------------------------------------------------------------------------------------
@@ -109,11 +142,13 @@ int uart_SendString(const char* buf) {
 // -------------------------------------------------------------------------------------------------------------------
 //#include "stdio_uc.h"
 //#include <stdio.h>
-int uart_SendBuffer(u8* buf, u16 size) {
+int uart_SendBuffer(tUart* uart, u8* buf, u16 size) {
 //	printf("UART: TX: ");
 //	int x; for (x=0;x<size;x++) printf("0x%x ", buf[x]);
 //	printf(CMD_TERMINATOR);
-	return write(uartFD, buf, size);		//Filestream, bytes to write, number of bytes to write
+	int ret = write(uart->fd, buf, size);		//Filestream, bytes to write, number of bytes to write
+	if (ret > 0) uart->txBytes += ret;
+	return ret;
 }
 
 // -------------------------------------------------------------------------------------------------------------------
@@ -121,8 +156,10 @@ int uart_SendBuffer(u8* buf, u16 size) {
 // Parametros:	ch: byte a ser enviado
 // Retorna:		Retorna o cdigo da operao. Se for valor negativo houve erro na escrita da FIFO da UART
 // -------------------------------------------------------------------------------------------------------------------
-int uart_PutChar(n16 ch) {
-	return write(uartFD, &ch, 1);		//Filestream, bytes to write, number of bytes to write
+int uart_PutChar(tUart* uart, n16 ch) {
+	int ret = write(uart->fd, &ch, 1);		//Filestream, bytes to write, number of bytes to write
+	if (ret > 0) uart->txBytes += ret;
+	return ret;
 }
 
 // -------------------------------------------------------------------------------------------------------------------
@@ -132,7 +169,7 @@ int uart_PutChar(n16 ch) {
 //				pdFAIL se no bytes na FIFO da UART ou na leitura da FIFO da UART
 // -------------------------------------------------------------------------------------------------------------------
 //int uart_GetChar(u8* ch) {
-//	int ret = read(uartFD, (void *)ch, 1);
+//	int ret = read(uart->fd, (void *)ch, 1);
 //	if (ret <= 0) return pdFAIL;
 //	return pdPASS;
 //}
@@ -143,18 +180,19 @@ int uart_PutChar(n16 ch) {
 // Retorna TRUE se o caractere foi recuperado, se retornar FALSE o buffer
 //              est vazio ou  houve algum erro de leitura
 // -----------------------------------------------------------------------------
-int uart_GetChar(u8* ch) {
+int uart_GetChar(tUart* uart, u8* ch) {
     // SE O BUFFER RX ESTIVER VAZIO VAMOS CARREG-LO DA FIFO DE RECEPO DA UART
-	if (rxcnt <= 0) { // Checa se o buffer RX est vazio
-		rxpos = 0;
-		rxcnt = read(uartFD, rxbuf, lenBUFFER);
-		if (rxcnt <= 0) return pdFAIL; // erro de leitura? cancela...
+	if (uart->rxcnt <= 0) { // Checa se o buffer RX est vazio
+		uart->rxpos = 0;
+		uart->rxcnt = read(uart->fd, uart->rxbuf, lenUART_BUFFER);
+		if (uart->rxcnt <= 0) return pdFAIL; // erro de leitura? cancela...
+		uart->rxBytes += uart->rxcnt;
 	}
 
 	// recupera o dado do buffer RX
-	*ch = rxbuf[rxpos];
-	rxpos++;
-	rxcnt--;
+	*ch = uart->rxbuf[uart->rxpos];
+	uart->rxpos++;
+	uart->rxcnt--;
 	return pdPASS;
 }
 
@@ -164,9 +202,9 @@ int uart_GetChar(u8* ch) {
 // Parametros:	Nenhum
 // Retorna:		Nada
 // -----------------------------------------------------------------------------------------------------------------
-void uart_ClearBufferRx(void) {
-	tcflush(uartFD, TCIFLUSH);
-	rxcnt = 0;
+void uart_ClearBufferRx(tUart* uart) {
+	tcflush(uart->fd, TCIFLUSH);
+	uart->rxcnt = 0;
 	// tcflush() discards data written to the object referred to by fd but not transmitted, or data received but not read, depending on the value of queue_selector:
 	//		TCIFLUSH: flushes data received but not read.
 	//		TCOFLUSH: flushes data written but not transmitted.
@@ -179,9 +217,9 @@ void uart_ClearBufferRx(void) {
 // Parametros:	Nenhum
 // Retorna:		Nada
 // -----------------------------------------------------------------------------------------------------------------
-void uart_ClearBufferTx(void) {
-	tcflush(uartFD, TCOFLUSH);
-	rxcnt = 0;
+void uart_ClearBufferTx(tUart* uart) {
+	tcflush(uart->fd, TCOFLUSH);
+	uart->rxcnt = 0;
 	// tcflush() discards data written to the object referred to by fd but not transmitted, or data received but not read, depending on the value of queue_selector:
 	//		TCIFLUSH: flushes data received but not read.
 	//		TCOFLUSH: flushes data written but not transmitted.
@@ -193,9 +231,9 @@ void uart_ClearBufferTx(void) {
 // Descrio: 	Retorna com a quantidade de bytes recebidos no buffer de recepo
 // Parametros:	Nenhum
 // -----------------------------------------------------------------------------------------------------------------
-int uart_BufferQtdRx(void) {
+int uart_BufferQtdRx(tUart* uart) {
 	int nBytes;
-	ioctl(uartFD, FIONREAD, &nBytes);
+	ioctl(uart->fd, FIONREAD, &nBytes);
 	return nBytes;
 }
 
@@ -208,7 +246,7 @@ int uart_BufferQtdRx(void) {
 //int uart_BufferQtdTx(void) {
 //	int nBytes = 0;
 //	int rc;
-//	rc = ioctl(uartFD, TIOCOUTQ, &nBytes);
+//	rc = ioctl(uart->fd, TIOCOUTQ, &nBytes);
 //	return rc;
 //}
 
@@ -217,7 +255,7 @@ int uart_BufferQtdRx(void) {
 
 	// Read up to 255 characters from the port if they are there
 //		unsigned char rx_buffer[256];
-//		int rx_length = read(uartFD, (void*)rx_buffer, 255);		//Filestream, buffer to store in, number of bytes to read (max)
+//		int rx_length = read(uart->fd, (void*)rx_buffer, 255);		//Filestream, buffer to store in, number of bytes to read (max)
 //		if (rx_length > 0) {
 //			//Bytes received
 //			rx_buffer[rx_length] = '\0';
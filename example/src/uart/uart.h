@@ -4,14 +4,26 @@
 #include "../uc_libdefs.h"
 #include <termios.h>
 
-int uart_Init(const char* port, uint baudrate);
-void uart_Close(void);
-int uart_SendString(const char* buf);
-int uart_SendBuffer(u8* buf, u16 size);
-int uart_PutChar(n16 ch);
-int uart_GetChar(u8* ch);
-void uart_ClearBufferRx(void);
-int uart_BufferQtdRx(void);
-void uart_ClearBufferTx(void);
+#define lenUART_BUFFER 8*1024
+
+typedef struct {
+	int fd;									// Id da porta UART
+	struct termios attrOld, attr;			// Vars para atributos da porta UART
+	u8 rxbuf[lenUART_BUFFER];
+	int rxcnt, rxpos;
+	u64 txBytes, rxBytes;					// Bytes enviados e recebidos pela porta, no so zerados pelo uart_Init
+} tUart;
+
+int uart_Init(tUart* uart, const char* port, uint baudrate);
+uint uart_Speed(uint bps);
+uint uart_Bps(uint speed);
+void uart_Close(tUart* uart);
+int uart_SendString(tUart* uart, const char* buf);
+int uart_SendBuffer(tUart* uart, u8* buf, u16 size);
+int uart_PutChar(tUart* uart, n16 ch);
+int uart_GetChar(tUart* uart, u8* ch);
+void uart_ClearBufferRx(tUart* uart);
+int uart_BufferQtdRx(tUart* uart);
+void uart_ClearBufferTx(tUart* uart);
 //int uart_BufferQtdTx(void);
 #endif